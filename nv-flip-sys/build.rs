@@ -11,4 +11,6 @@ fn main() {
 
     println!("cargo:rerun-if-changed=src/bindings.cpp");
     println!("cargo:rerun-if-changed=src/bindings.hpp");
+    println!("cargo:rerun-if-changed=src/bucketing.hpp");
+    println!("cargo:rerun-if-changed=src/terms.hpp");
 }
@@ -1,4 +1,8 @@
+#include <atomic>
+#include <chrono>
 #include <cmath> // std::sqrt, std::exp
+#include <mutex>
+#include <optional>
 
 #include "sharedflip.h"
 #include "image.h"
@@ -6,6 +10,163 @@
 #include "mapMagma.h"
 
 #include "bindings.hpp"
+#include "bucketing.hpp"
+#include "terms.hpp"
+
+// None of the functions below touch global mutable state: the FLIP CPP headers only define
+// constant tables (constants, MapMagma) and build filters per call. Concurrent calls are
+// therefore safe as long as no handle is written by one call while used by another.
+// Keep it that way - any new scratch state must live in a handle or be thread_local.
+
+// Passes the pixels of an image to `update` in row-major runs of contiguous values, so that
+// pools can bucket them in bulk.
+template<typename Update>
+static void forEachValueRun(FLIP::image<float> const& image, Update const& update) {
+    constexpr size_t RunSize = 16 * 1024;
+    static thread_local std::vector<float> run;
+    run.resize(RunSize);
+    size_t size = 0;
+    for (int y = 0; y < image.getHeight(); y++) {
+        for (int x = 0; x < image.getWidth(); x++) {
+            run[size++] = image.get(x, y);
+            if (size == RunSize) {
+                update(run.data(), size);
+                size = 0;
+            }
+        }
+    }
+    if (size) {
+        update(run.data(), size);
+    }
+}
+
+struct YuvSample8 {
+    static float read(uint8_t const* plane, size_t i) { return plane[i]; }
+};
+
+// Little endian, whatever the host.
+struct YuvSample16 {
+    static float read(uint8_t const* plane, size_t i) { return float(plane[2 * i] | (plane[2 * i + 1] << 8)); }
+};
+
+// Chroma position and weight of each luma position along one axis, with chroma sited at
+// the center of the luma samples it covers, or co-sited with the first of them.
+static void chromaTaps(int size, int factor, bool cosited, std::vector<int>& first, std::vector<int>& second, std::vector<float>& weight) {
+    int chroma_size = (size + factor - 1) / factor;
+    first.resize(size);
+    second.resize(size);
+    weight.resize(size);
+    for (int i = 0; i < size; i++) {
+        float position = cosited ? float(i) / float(factor) : std::max((float(i) + 0.5f) / float(factor) - 0.5f, 0.0f);
+        int lower = std::min(int(position), chroma_size - 1);
+        first[i] = lower;
+        second[i] = std::min(lower + 1, chroma_size - 1);
+        weight[i] = position - float(lower);
+    }
+}
+
+// Converts a planar Y'CbCr frame to the gamma encoded RGB FLIP expects, upsampling chroma
+// bilinearly. Works a row at a time: chroma rows are blended vertically at chroma width,
+// then spread to luma width, then converted, each pass a plain loop over float arrays that
+// the compiler can vectorize, except for the gather spreading chroma.
+template<typename Sample>
+static void setColor3Yuv(FLIP::image<FLIP::color3>& image, uint8_t const* y_plane, uint8_t const* u_plane, uint8_t const* v_plane, int x_factor, int y_factor, bool x_cosited, bool y_cosited, uint32_t bit_depth, float kr, float kb, bool full_range) {
+    int width = image.getWidth();
+    int height = image.getHeight();
+    int chroma_width = (width + x_factor - 1) / x_factor;
+
+    float scale = float(1u << (bit_depth - 8));
+    float max_value = float((1u << bit_depth) - 1);
+    float luma_offset = full_range ? 0.0f : 16.0f * scale;
+    float luma_range = full_range ? max_value : 219.0f * scale;
+    float chroma_offset = 128.0f * scale;
+    float chroma_range = full_range ? max_value : 224.0f * scale;
+    float kg = 1.0f - kr - kb;
+
+    std::vector<int> x_first, x_second, y_first, y_second;
+    std::vector<float> x_weight, y_weight;
+    chromaTaps(width, x_factor, x_cosited, x_first, x_second, x_weight);
+    chromaTaps(height, y_factor, y_cosited, y_first, y_second, y_weight);
+
+    std::vector<float> luma(width), pb(width), pr(width), cb_row(chroma_width), cr_row(chroma_width);
+    for (int y = 0; y < height; y++) {
+        size_t luma_row = size_t(y) * width;
+        size_t chroma_row_1 = size_t(y_first[y]) * chroma_width;
+        size_t chroma_row_2 = size_t(y_second[y]) * chroma_width;
+        float wy = y_weight[y];
+        for (int x = 0; x < chroma_width; x++) {
+            cb_row[x] = (Sample::read(u_plane, chroma_row_1 + x) * (1.0f - wy) + Sample::read(u_plane, chroma_row_2 + x) * wy - chroma_offset) / chroma_range;
+            cr_row[x] = (Sample::read(v_plane, chroma_row_1 + x) * (1.0f - wy) + Sample::read(v_plane, chroma_row_2 + x) * wy - chroma_offset) / chroma_range;
+        }
+        for (int x = 0; x < width; x++) {
+            pb[x] = cb_row[x_first[x]] * (1.0f - x_weight[x]) + cb_row[x_second[x]] * x_weight[x];
+            pr[x] = cr_row[x_first[x]] * (1.0f - x_weight[x]) + cr_row[x_second[x]] * x_weight[x];
+        }
+        for (int x = 0; x < width; x++) {
+            luma[x] = (Sample::read(y_plane, luma_row + x) - luma_offset) / luma_range;
+        }
+        for (int x = 0; x < width; x++) {
+            float r = luma[x] + 2.0f * (1.0f - kr) * pr[x];
+            float b = luma[x] + 2.0f * (1.0f - kb) * pb[x];
+            float g = (luma[x] - kr * r - kb * b) / kg;
+            image.set(x, y, FLIP::color3(
+                std::min(std::max(r, 0.0f), 1.0f),
+                std::min(std::max(g, 0.0f), 1.0f),
+                std::min(std::max(b, 0.0f), 1.0f)
+            ));
+        }
+    }
+}
+
+static void setTerms(FLIP::image<float>& error_map, std::vector<float> const& terms) {
+    int width = error_map.getWidth();
+    for (int y = 0; y < error_map.getHeight(); y++) {
+        for (int x = 0; x < width; x++) {
+            error_map.set(x, y, terms[size_t(y) * width + x]);
+        }
+    }
+}
+
+// Compares single channel images, each value divided by `divisor` being sRGB in [0, 1]. Gives
+// the same result as comparing color images with that value in every channel. A single term
+// skips building them, and the chroma filters with them.
+template<typename T>
+static void flipGray(FLIP::image<float>& error_map, T const* reference_data, T const* test_data, float divisor, float pixels_per_degree, FlipImageComponents components) {
+    int width = error_map.getWidth();
+    int height = error_map.getHeight();
+    if (components == FlipImageComponentsBoth) {
+        // FLIP's stages are only reachable as a whole, expand straight into its input.
+        auto expand = [&](T const* data) {
+            FLIP::image<FLIP::color3> image(width, height);
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    float value = float(*data++) / divisor;
+                    image.set(x, y, FLIP::color3(value, value, value));
+                }
+            }
+            return image;
+        };
+        FLIP::image<FLIP::color3> reference = expand(reference_data);
+        FLIP::image<FLIP::color3> test = expand(test_data);
+        error_map.FLIP(reference, test, pixels_per_degree);
+        return;
+    }
+
+    auto input = [&](T const* data) {
+        return FlipTerms::fromGray(width, height, [&](int x, int y) {
+            return float(data[size_t(y) * width + x]) / divisor;
+        });
+    };
+    YCxCzImage reference = input(reference_data);
+    YCxCzImage test = input(test_data);
+    std::vector<float> terms(size_t(width) * height);
+    if (components == FlipImageComponentsColor) {
+        FlipTerms::colorDifference(reference, test, pixels_per_degree, terms.data());
+    } else {
+        FlipTerms::featureDifference(reference, test, pixels_per_degree, terms.data());
+    }
+    setTerms(error_map, terms);
+}
 
 extern "C" {
     struct FlipImageColor3 {
@@ -19,16 +180,7 @@ extern "C" {
     FlipImageColor3* flip_image_color3_new(uint32_t width, uint32_t height, uint8_t const* data) {
         if (data) {
             auto image = new FlipImageColor3 { FLIP::image<FLIP::color3>(width, height) };
-            for (uint32_t y = 0; y < height; y++) {
-                for (uint32_t x = 0; x < width; x++) {
-                    image->inner.set(x, y, FLIP::color3(
-                        float(data[0]) / 255.0f,
-                        float(data[1]) / 255.0f,
-                        float(data[2]) / 255.0f
-                    ));
-                    data += 3;
-                }
-            }
+            flip_image_color3_set_rows(image, 0, height, data);
             return image;
         } else {
             return new FlipImageColor3 { FLIP::image<FLIP::color3>(width, height, FLIP::color3(0.0f, 0.0f, 0.0f)) };
@@ -42,7 +194,30 @@ extern "C" {
     inline static float fClamp(float value) { return std::max(0.0f, std::min(1.0f, value)); }
 
     void flip_image_color3_get_data(FlipImageColor3 const* image, uint8_t* data) {
-        for (uint32_t y = 0; y < image->inner.getHeight(); y++) {
+        flip_image_color3_get_rows(image, 0, image->inner.getHeight(), data);
+    }
+
+    // Row range variants operate on rows [y_begin, y_end) and touch nothing outside of them,
+    // so disjoint ranges of the same image may be processed from different threads.
+    static void setColor3Rows(FLIP::image<FLIP::color3>& image, uint32_t y_begin, uint32_t y_end, uint8_t const* data) {
+        for (uint32_t y = y_begin; y < y_end; y++) {
+            for (uint32_t x = 0; x < image.getWidth(); x++) {
+                image.set(x, y, FLIP::color3(
+                    float(data[0]) / 255.0f,
+                    float(data[1]) / 255.0f,
+                    float(data[2]) / 255.0f
+                ));
+                data += 3;
+            }
+        }
+    }
+
+    void flip_image_color3_set_rows(FlipImageColor3* image, uint32_t y_begin, uint32_t y_end, uint8_t const* data) {
+        setColor3Rows(image->inner, y_begin, y_end, data);
+    }
+
+    void flip_image_color3_get_rows(FlipImageColor3 const* image, uint32_t y_begin, uint32_t y_end, uint8_t* data) {
+        for (uint32_t y = y_begin; y < y_end; y++) {
             for (uint32_t x = 0; x < image->inner.getWidth(); x++) {
                 auto color = image->inner.get(x, y);
                 data[0] = uint8_t(fClamp(color.r) * 255.0f + 0.5f);
@@ -53,6 +228,26 @@ extern "C" {
         }
     }
 
+    void flip_image_color3_set_yuv(FlipImageColor3* image, uint8_t const* y_plane, uint8_t const* u_plane, uint8_t const* v_plane, FlipImageChromaSubsampling subsampling, FlipImageChromaSiting siting, uint32_t bit_depth, FlipImageYuvMatrix matrix, bool full_range) {
+        int x_factor = subsampling == FlipImageChromaSubsampling444 ? 1 : 2;
+        int y_factor = subsampling == FlipImageChromaSubsampling420 ? 2 : 1;
+        bool x_cosited = siting != FlipImageChromaSitingCenter;
+        bool y_cosited = siting == FlipImageChromaSitingTopLeft;
+        float kr = 0.2126f, kb = 0.0722f;
+        if (matrix == FlipImageYuvMatrixBt601) {
+            kr = 0.299f;
+            kb = 0.114f;
+        } else if (matrix == FlipImageYuvMatrixBt2020) {
+            kr = 0.2627f;
+            kb = 0.0593f;
+        }
+        if (bit_depth == 8) {
+            setColor3Yuv<YuvSample8>(image->inner, y_plane, u_plane, v_plane, x_factor, y_factor, x_cosited, y_cosited, bit_depth, kr, kb, full_range);
+        } else {
+            setColor3Yuv<YuvSample16>(image->inner, y_plane, u_plane, v_plane, x_factor, y_factor, x_cosited, y_cosited, bit_depth, kr, kb, full_range);
+        }
+    }
+
     void flip_image_color3_free(FlipImageColor3* image) {
         delete image;
     }
@@ -68,12 +263,7 @@ extern "C" {
     FlipImageFloat* flip_image_float_new(uint32_t width, uint32_t height, float const* data) {
         if (data) {
             auto image = new FlipImageFloat { FLIP::image<float>(width, height) };
-            for (uint32_t y = 0; y < height; y++) {
-                for (uint32_t x = 0; x < width; x++) {
-                    image->inner.set(x, y, *data);
-                    data += 1;
-                }
-            }
+            flip_image_float_set_rows(image, 0, height, data);
             return image;
         } else {
             return new FlipImageFloat { FLIP::image<float>(width, height, 0.0f) };
@@ -85,7 +275,20 @@ extern "C" {
     }
 
     void flip_image_float_get_data(FlipImageFloat const* image, float* data) {
-        for (uint32_t y = 0; y < image->inner.getHeight(); y++) {
+        flip_image_float_get_rows(image, 0, image->inner.getHeight(), data);
+    }
+
+    void flip_image_float_set_rows(FlipImageFloat* image, uint32_t y_begin, uint32_t y_end, float const* data) {
+        for (uint32_t y = y_begin; y < y_end; y++) {
+            for (uint32_t x = 0; x < image->inner.getWidth(); x++) {
+                image->inner.set(x, y, *data);
+                data += 1;
+            }
+        }
+    }
+
+    void flip_image_float_get_rows(FlipImageFloat const* image, uint32_t y_begin, uint32_t y_end, float* data) {
+        for (uint32_t y = y_begin; y < y_end; y++) {
             for (uint32_t x = 0; x < image->inner.getWidth(); x++) {
                 auto value = image->inner.get(x, y);
                 *data = value;
@@ -98,10 +301,75 @@ extern "C" {
         delete image;
     }
 
+    // Counts in a single pass the values above each threshold into `exceeding`, and the values in each
+    // of cdf_size equal buckets over [0, 1] into `cdf`, accumulated so that cdf[i] counts the values
+    // below (i + 1) / cdf_size. Values outside of [0, 1] count towards the first or last bucket.
+    void flip_image_float_threshold_counts(FlipImageFloat const* image, float const* thresholds, size_t threshold_count, uint64_t* exceeding, size_t cdf_size, uint64_t* cdf) {
+        std::fill(exceeding, exceeding + threshold_count, 0);
+        std::fill(cdf, cdf + cdf_size, 0);
+        std::optional<BucketLayout> layout;
+        if (cdf_size) {
+            layout.emplace(BucketLayout::linear(cdf_size));
+        }
+        forEachValueRun(image->inner, [&](float const* values, size_t count) {
+            for (size_t t = 0; t < threshold_count; t++) {
+                // A run fits 32 bits, which keeps the compare and add vectorized.
+                float threshold = thresholds[t];
+                uint32_t above = 0;
+                for (size_t i = 0; i < count; i++) {
+                    above += values[i] > threshold ? 1 : 0;
+                }
+                exceeding[t] += above;
+            }
+            if (layout) {
+                countBuckets(
+                    cdf_size, values, count,
+                    [&](float const* block, size_t size, uint32_t* ids) { layout->bucketIds(block, size, ids); },
+                    [&](size_t bucket_id, uint64_t bucket_count) { cdf[bucket_id] += bucket_count; });
+            }
+        });
+        for (size_t i = 1; i < cdf_size; i++) {
+            cdf[i] += cdf[i - 1];
+        }
+    }
+
     void flip_image_float_flip(FlipImageFloat* error_map, FlipImageColor3* reference_image, FlipImageColor3* test_image, float pixels_per_degree) {
         error_map->inner.FLIP(reference_image->inner, test_image->inner, pixels_per_degree);
     }
 
+    static YCxCzImage colorTermsInput(FLIP::image<FLIP::color3> const& image) {
+        return FlipTerms::fromSrgb(image.getWidth(), image.getHeight(), [&](int x, int y, float* rgb) {
+            auto color = image.get(x, y);
+            rgb[0] = color.r;
+            rgb[1] = color.g;
+            rgb[2] = color.b;
+        });
+    }
+
+    void flip_image_float_flip_components(FlipImageFloat* error_map, FlipImageColor3* reference_image, FlipImageColor3* test_image, float pixels_per_degree, FlipImageComponents components) {
+        if (components == FlipImageComponentsBoth) {
+            error_map->inner.FLIP(reference_image->inner, test_image->inner, pixels_per_degree);
+            return;
+        }
+        YCxCzImage reference = colorTermsInput(reference_image->inner);
+        YCxCzImage test = colorTermsInput(test_image->inner);
+        std::vector<float> terms(size_t(reference.width) * reference.height);
+        if (components == FlipImageComponentsColor) {
+            FlipTerms::colorDifference(reference, test, pixels_per_degree, terms.data());
+        } else {
+            FlipTerms::featureDifference(reference, test, pixels_per_degree, terms.data());
+        }
+        setTerms(error_map->inner, terms);
+    }
+
+    void flip_image_float_flip_gray8(FlipImageFloat* error_map, uint8_t const* reference_data, uint8_t const* test_data, float pixels_per_degree, FlipImageComponents components) {
+        flipGray(error_map->inner, reference_data, test_data, 255.0f, pixels_per_degree, components);
+    }
+
+    void flip_image_float_flip_gray32f(FlipImageFloat* error_map, float const* reference_data, float const* test_data, float pixels_per_degree, FlipImageComponents components) {
+        flipGray(error_map->inner, reference_data, test_data, 1.0f, pixels_per_degree, components);
+    }
+
     void flip_image_float_copy_float_to_color3(FlipImageFloat* error_map, FlipImageColor3* output) {
         output->inner.copyFloat2Color3(error_map->inner);
     }
@@ -122,6 +390,20 @@ extern "C" {
     size_t flip_image_histogram_ref_get_bucket_value(FlipImageHistogramRef const* histogram, size_t bucket_id) {
         return histogram->inner.getBucketValue(bucket_id);
     }
+    // Writes flip_image_histogram_ref_size() values.
+    void flip_image_histogram_ref_get_bucket_values(FlipImageHistogramRef const* histogram, size_t* values) {
+        for (size_t bucket_id = 0; bucket_id < histogram->inner.size(); bucket_id++) {
+            values[bucket_id] = histogram->inner.getBucketValue(bucket_id);
+        }
+    }
+    // Writes flip_image_histogram_ref_size() + 1 values, bucket i covers [edges[i], edges[i + 1]).
+    void flip_image_histogram_ref_get_bucket_edges(FlipImageHistogramRef const* histogram, float* edges) {
+        size_t buckets = histogram->inner.size();
+        for (size_t bucket_id = 0; bucket_id < buckets; bucket_id++) {
+            edges[bucket_id] = histogram->inner.getMinValue() + float(bucket_id) * histogram->inner.getBucketSize();
+        }
+        edges[buckets] = histogram->inner.getMaxValue();
+    }
     size_t flip_image_histogram_ref_size(FlipImageHistogramRef const* histogram) {
         return histogram->inner.size();
     }
@@ -144,6 +426,33 @@ extern "C" {
         histogram->inner.inc(value, count);
     }
     void flip_image_histogram_ref_inc_image(FlipImageHistogramRef* histogram, FlipImageFloat const* image) {
+        ::histogram<float>& inner = histogram->inner;
+        if (inner.getMinValue() == 0.0f && inner.size() > 0) {
+            // Counts every bucket in bulk and increments it once through a value inside of it. The ids
+            // divide by the bucket size like valueBucketId, a reciprocal could round differently.
+            // Values outside of the histogram get the extra id size() and go through inc one by one,
+            // so the histogram sees the actual values there.
+            size_t size = inner.size();
+            float max_value = inner.getMaxValue();
+            float bucket_size = inner.getBucketSize();
+            auto bucket_ids = [&](float const* values, size_t count, uint32_t* ids) {
+                dividedBucketIds(values, count, max_value, bucket_size, uint32_t(size), ids);
+                for (size_t i = 0; i < count; i++) {
+                    if (ids[i] == size) {
+                        inner.inc(values[i], 1);
+                    }
+                }
+            };
+            auto add = [&](size_t bucket_id, uint64_t count) {
+                if (bucket_id < size) {
+                    inner.inc((float(bucket_id) + 0.5f) * bucket_size, size_t(count));
+                }
+            };
+            forEachValueRun(image->inner, [&](float const* values, size_t count) {
+                countBuckets(size + 1, values, count, bucket_ids, add);
+            });
+            return;
+        }
         for (uint32_t y = 0; y < image->inner.getHeight(); y++) {
             for (uint32_t x = 0; x < image->inner.getWidth(); x++) {
                 auto value = image->inner.get(x, y);
@@ -157,6 +466,8 @@ extern "C" {
 
     struct FlipImagePool {
         pooling<float> inner;
+        // Handed out by flip_image_pool_borrow_histogram so that accessing the histogram doesn't allocate.
+        FlipImageHistogramRef histogram { inner.getHistogram() };
     };
 
     FlipImagePool* flip_image_pool_new(size_t buckets) {
@@ -165,6 +476,10 @@ extern "C" {
     FlipImageHistogramRef* flip_image_pool_get_histogram(FlipImagePool* pool) {
         return new FlipImageHistogramRef { pool->inner.getHistogram() };
     }
+    // Owned by the pool, must not be passed to flip_image_histogram_ref_free.
+    FlipImageHistogramRef* flip_image_pool_borrow_histogram(FlipImagePool* pool) {
+        return &pool->histogram;
+    }
     float flip_image_pool_get_min_value(FlipImagePool const* pool) {
         return pool->inner.getMinValue();
     }
@@ -181,7 +496,10 @@ extern "C" {
         return pool->inner.getPercentile(percentile, weighted);
     }
     void flip_image_pool_update_image(FlipImagePool* pool, FlipImageFloat const* image) {
-        for (uint32_t y = 0; y < image->inner.getHeight(); y++) {
+        flip_image_pool_update_rows(pool, image, 0, image->inner.getHeight());
+    }
+    void flip_image_pool_update_rows(FlipImagePool* pool, FlipImageFloat const* image, uint32_t y_begin, uint32_t y_end) {
+        for (uint32_t y = y_begin; y < y_end; y++) {
             for (uint32_t x = 0; x < image->inner.getWidth(); x++) {
                 pool->inner.update(x, y, image->inner.get(x, y));
             }
@@ -193,4 +511,876 @@ extern "C" {
     void flip_image_pool_free(FlipImagePool* pool) {
         delete pool;
     }
-}
\ No newline at end of file
+
+    struct FlipImageBucketLayout {
+        BucketLayout inner;
+    };
+
+    FlipImageBucketLayout* flip_image_bucket_layout_new_linear(size_t buckets) {
+        return new FlipImageBucketLayout { BucketLayout::linear(buckets) };
+    }
+    FlipImageBucketLayout* flip_image_bucket_layout_new_logarithmic(uint32_t mantissa_bits, int32_t min_exponent) {
+        return new FlipImageBucketLayout { BucketLayout::logarithmic(mantissa_bits, min_exponent) };
+    }
+    FlipImageBucketLayout* flip_image_bucket_layout_new_adaptive(size_t buckets, FlipImageFloat const* training_image) {
+        std::vector<float> values(size_t(training_image->inner.getWidth()) * size_t(training_image->inner.getHeight()));
+        flip_image_float_get_data(training_image, values.data());
+        return new FlipImageBucketLayout { BucketLayout::adaptive(buckets, values.data(), values.size()) };
+    }
+    FlipImageBucketLayout* flip_image_bucket_layout_clone(FlipImageBucketLayout const* layout) {
+        return new FlipImageBucketLayout { layout->inner };
+    }
+    size_t flip_image_bucket_layout_size(FlipImageBucketLayout const* layout) {
+        return layout->inner.size();
+    }
+    size_t flip_image_bucket_layout_value_bucket_id(FlipImageBucketLayout const* layout, float value) {
+        return layout->inner.bucketId(value);
+    }
+    // Writes flip_image_bucket_layout_size() + 1 values.
+    void flip_image_bucket_layout_get_edges(FlipImageBucketLayout const* layout, float* edges) {
+        std::copy(layout->inner.edges(), layout->inner.edges() + layout->inner.size() + 1, edges);
+    }
+    void flip_image_bucket_layout_free(FlipImageBucketLayout* layout) {
+        delete layout;
+    }
+
+    struct FlipImageBucketPool {
+        BucketPool inner;
+    };
+
+    FlipImageBucketPool* flip_image_bucket_pool_new(FlipImageBucketLayout const* layout) {
+        return new FlipImageBucketPool { BucketPool(layout->inner) };
+    }
+    FlipImageBucketPool* flip_image_bucket_pool_clone(FlipImageBucketPool const* pool) {
+        return new FlipImageBucketPool { pool->inner };
+    }
+    size_t flip_image_bucket_pool_size(FlipImageBucketPool const* pool) {
+        return pool->inner.size();
+    }
+    // Writes flip_image_bucket_pool_size() values.
+    void flip_image_bucket_pool_get_bucket_values(FlipImageBucketPool const* pool, double* values) {
+        for (size_t bucket_id = 0; bucket_id < pool->inner.size(); bucket_id++) {
+            values[bucket_id] = pool->inner.getBucketValue(bucket_id);
+        }
+    }
+    // Writes flip_image_bucket_pool_size() + 1 values.
+    void flip_image_bucket_pool_get_bucket_edges(FlipImageBucketPool const* pool, float* edges) {
+        BucketLayout const& layout = pool->inner.getLayout();
+        std::copy(layout.edges(), layout.edges() + layout.size() + 1, edges);
+    }
+    double flip_image_bucket_pool_get_count(FlipImageBucketPool const* pool) {
+        return pool->inner.getCount();
+    }
+    float flip_image_bucket_pool_get_min_value(FlipImageBucketPool const* pool) {
+        return pool->inner.getMinValue();
+    }
+    float flip_image_bucket_pool_get_max_value(FlipImageBucketPool const* pool) {
+        return pool->inner.getMaxValue();
+    }
+    float flip_image_bucket_pool_get_mean(FlipImageBucketPool const* pool) {
+        return float(pool->inner.getMean());
+    }
+    float flip_image_bucket_pool_get_percentile(FlipImageBucketPool const* pool, float percentile, bool weighted) {
+        return float(pool->inner.getPercentile(percentile, weighted));
+    }
+    void flip_image_bucket_pool_update_image(FlipImageBucketPool* pool, FlipImageFloat const* image) {
+        forEachValueRun(image->inner, [&](float const* values, size_t count) { pool->inner.update(values, count); });
+    }
+    // Adds every pixel in rows [y_begin, y_end) to the pool of its label. `labels` holds one label per
+    // pixel of the whole image, pixels with a label of label_count or above are skipped.
+    void flip_image_bucket_pool_update_labeled_rows(FlipImageBucketPool* const* pools, size_t label_count, FlipImageFloat const* image, uint32_t const* labels, uint32_t y_begin, uint32_t y_end) {
+        size_t width = size_t(image->inner.getWidth());
+        for (uint32_t y = y_begin; y < y_end; y++) {
+            uint32_t const* row_labels = labels + size_t(y) * width;
+            for (uint32_t x = 0; x < width; x++) {
+                uint32_t label = row_labels[x];
+                if (label < label_count) {
+                    pools[label]->inner.update(image->inner.get(x, y));
+                }
+            }
+        }
+    }
+    bool flip_image_bucket_pool_merge(FlipImageBucketPool* pool, FlipImageBucketPool const* other) {
+        return pool->inner.merge(other->inner);
+    }
+    void flip_image_bucket_pool_clear(FlipImageBucketPool* pool) {
+        pool->inner.clear();
+    }
+    void flip_image_bucket_pool_free(FlipImageBucketPool* pool) {
+        delete pool;
+    }
+
+    struct FlipImageWindowedPool {
+        FlipImageBucketPool total;
+        BucketPoolWindow window;
+    };
+
+    FlipImageWindowedPool* flip_image_windowed_pool_new(FlipImageBucketLayout const* layout, size_t frames) {
+        return new FlipImageWindowedPool { FlipImageBucketPool { BucketPool(layout->inner) }, BucketPoolWindow(layout->inner, frames) };
+    }
+    // Owned by the windowed pool, must not be passed to flip_image_bucket_pool_free.
+    FlipImageBucketPool const* flip_image_windowed_pool_get_pool(FlipImageWindowedPool const* pool) {
+        return &pool->total;
+    }
+    size_t flip_image_windowed_pool_get_window_size(FlipImageWindowedPool const* pool) {
+        return pool->window.getWindowSize();
+    }
+    size_t flip_image_windowed_pool_get_frame_count(FlipImageWindowedPool const* pool) {
+        return pool->window.getFrameCount();
+    }
+    void flip_image_windowed_pool_push_image(FlipImageWindowedPool* pool, FlipImageFloat const* image) {
+        BucketPool& frame = pool->window.beginFrame(pool->total.inner);
+        forEachValueRun(image->inner, [&](float const* values, size_t count) { frame.update(values, count); });
+        pool->window.endFrame(pool->total.inner);
+    }
+    void flip_image_windowed_pool_clear(FlipImageWindowedPool* pool) {
+        pool->window.clear(pool->total.inner);
+    }
+    void flip_image_windowed_pool_free(FlipImageWindowedPool* pool) {
+        delete pool;
+    }
+
+    struct FlipImageDecayingPool {
+        DecayingBucketPool inner;
+    };
+
+    FlipImageDecayingPool* flip_image_decaying_pool_new(FlipImageBucketLayout const* layout, double decay) {
+        return new FlipImageDecayingPool { DecayingBucketPool(layout->inner, decay) };
+    }
+    double flip_image_decaying_pool_get_decay(FlipImageDecayingPool const* pool) {
+        return pool->inner.getDecay();
+    }
+    size_t flip_image_decaying_pool_size(FlipImageDecayingPool const* pool) {
+        return pool->inner.getPool().size();
+    }
+    // Writes flip_image_decaying_pool_size() values.
+    void flip_image_decaying_pool_get_bucket_values(FlipImageDecayingPool const* pool, double* values) {
+        for (size_t bucket_id = 0; bucket_id < pool->inner.getPool().size(); bucket_id++) {
+            values[bucket_id] = pool->inner.getBucketValue(bucket_id);
+        }
+    }
+    double flip_image_decaying_pool_get_count(FlipImageDecayingPool const* pool) {
+        return pool->inner.getCount();
+    }
+    float flip_image_decaying_pool_get_min_value(FlipImageDecayingPool const* pool) {
+        return pool->inner.getMinValue();
+    }
+    float flip_image_decaying_pool_get_max_value(FlipImageDecayingPool const* pool) {
+        return pool->inner.getMaxValue();
+    }
+    float flip_image_decaying_pool_get_mean(FlipImageDecayingPool const* pool) {
+        return float(pool->inner.getPool().getMean());
+    }
+    float flip_image_decaying_pool_get_percentile(FlipImageDecayingPool const* pool, float percentile, bool weighted) {
+        return float(pool->inner.getPool().getPercentile(percentile, weighted));
+    }
+    void flip_image_decaying_pool_update_image(FlipImageDecayingPool* pool, FlipImageFloat const* image) {
+        double weight = pool->inner.beginUpdate();
+        forEachValueRun(image->inner, [&](float const* values, size_t count) { pool->inner.update(values, count, weight); });
+    }
+    void flip_image_decaying_pool_clear(FlipImageDecayingPool* pool) {
+        pool->inner.clear();
+    }
+    void flip_image_decaying_pool_free(FlipImageDecayingPool* pool) {
+        delete pool;
+    }
+
+    struct FlipImageConcurrentPool {
+        ConcurrentBucketPool inner;
+    };
+
+    // Passing 0 shards picks one per hardware thread.
+    FlipImageConcurrentPool* flip_image_concurrent_pool_new(FlipImageBucketLayout const* layout, size_t shards) {
+        return new FlipImageConcurrentPool { ConcurrentBucketPool(layout->inner, shards) };
+    }
+    // The update functions may be called from any number of threads at once.
+    void flip_image_concurrent_pool_update_image(FlipImageConcurrentPool* pool, FlipImageFloat const* image) {
+        forEachValueRun(image->inner, [&](float const* values, size_t count) { pool->inner.update(values, count); });
+    }
+    void flip_image_concurrent_pool_update_values(FlipImageConcurrentPool* pool, float const* values, size_t count) {
+        pool->inner.update(values, count);
+    }
+    FlipImageBucketPool* flip_image_concurrent_pool_snapshot(FlipImageConcurrentPool const* pool) {
+        return new FlipImageBucketPool { pool->inner.snapshot() };
+    }
+    void flip_image_concurrent_pool_clear(FlipImageConcurrentPool* pool) {
+        pool->inner.clear();
+    }
+    void flip_image_concurrent_pool_free(FlipImageConcurrentPool* pool) {
+        delete pool;
+    }
+
+    // Mirrors the bounds checking FlipPool::get_percentile does on the rust side.
+    static float boundedPercentile(pooling<float>& pool, size_t count, float percentile, bool weighted) {
+        return pool.getPercentile(std::min(percentile, 1.0f - 1.0f / float(count)), weighted);
+    }
+
+    // Scratch images and pool reused between calls on the same thread, so repeated comparisons
+    // of same sized images do not allocate. Reallocated whenever the image size changes.
+    struct FlipImageWorkspace {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::optional<FLIP::image<FLIP::color3>> reference;
+        std::optional<FLIP::image<FLIP::color3>> test;
+        std::optional<FLIP::image<float>> errorMap;
+        pooling<float> pool = pooling<float>(100);
+    };
+
+    static thread_local FlipImageWorkspace workspace;
+
+    // Images above this many pixels don't keep their scratch after the call, so one large
+    // comparison doesn't pin a few hundred megabytes on every thread that ever ran one.
+    static constexpr size_t MaxRetainedWorkspacePixels = size_t(1920) * 1080;
+
+    static void releaseWorkspace() {
+        workspace.reference.reset();
+        workspace.test.reset();
+        workspace.errorMap.reset();
+        workspace.width = 0;
+        workspace.height = 0;
+        workspace.pool = pooling<float>(100);
+    }
+
+    static void trimWorkspace() {
+        if (size_t(workspace.width) * size_t(workspace.height) > MaxRetainedWorkspacePixels) {
+            releaseWorkspace();
+        }
+    }
+
+    void flip_image_release_workspace() {
+        releaseWorkspace();
+    }
+
+    // Compares two Rgb8 buffers of at least one pixel using the thread's workspace and returns
+    // the error map, which stays valid until the next comparison on the same thread.
+    static FLIP::image<float>& workspaceFlip(uint32_t width, uint32_t height, uint8_t const* reference_data, uint8_t const* test_data, float pixels_per_degree) {
+        if (!workspace.errorMap || workspace.width != width || workspace.height != height) {
+            workspace.reference.emplace(width, height);
+            workspace.test.emplace(width, height);
+            workspace.errorMap.emplace(width, height);
+            workspace.width = width;
+            workspace.height = height;
+        }
+
+        // FLIP converts both inputs in place, so they have to be refilled every call.
+        setColor3Rows(*workspace.reference, 0, height, reference_data);
+        setColor3Rows(*workspace.test, 0, height, test_data);
+        workspace.errorMap->FLIP(*workspace.reference, *workspace.test, pixels_per_degree);
+        return *workspace.errorMap;
+    }
+
+    void flip_image_statistics_from_rgb8(uint32_t width, uint32_t height, uint8_t const* reference_data, uint8_t const* test_data, float pixels_per_degree, FlipImageStatistics* statistics) {
+        *statistics = FlipImageStatistics {};
+        size_t count = size_t(width) * size_t(height);
+        if (count == 0) {
+            return;
+        }
+
+        FLIP::image<float>& error_map = workspaceFlip(width, height, reference_data, test_data, pixels_per_degree);
+        pooling<float>& pool = workspace.pool;
+        pool.clear();
+        for (uint32_t y = 0; y < height; y++) {
+            for (uint32_t x = 0; x < width; x++) {
+                pool.update(x, y, error_map.get(x, y));
+            }
+        }
+
+        statistics->mean = pool.getMean();
+        statistics->weighted_median = boundedPercentile(pool, count, 0.5f, true);
+        statistics->first_weighted_quartile = boundedPercentile(pool, count, 0.25f, true);
+        statistics->third_weighted_quartile = boundedPercentile(pool, count, 0.75f, true);
+        statistics->min_value = pool.getMinValue();
+        statistics->max_value = pool.getMaxValue();
+        trimWorkspace();
+    }
+
+    float flip_image_mean_from_rgb8(uint32_t width, uint32_t height, uint8_t const* reference_data, uint8_t const* test_data, float pixels_per_degree) {
+        size_t count = size_t(width) * size_t(height);
+        if (count == 0) {
+            return 0.0f;
+        }
+
+        FLIP::image<float>& error_map = workspaceFlip(width, height, reference_data, test_data, pixels_per_degree);
+
+        // Every row is summed into four independent double lanes, then the row sums are added with
+        // Neumaier's compensated summation, so the mean stays exact to float precision at any size.
+        double sum = 0.0;
+        double compensation = 0.0;
+        for (int y = 0; y < int(height); y++) {
+            double lanes[4] = { 0.0, 0.0, 0.0, 0.0 };
+            int x = 0;
+            for (; x + 4 <= int(width); x += 4) {
+                for (int lane = 0; lane < 4; lane++) {
+                    lanes[lane] += double(error_map.get(x + lane, y));
+                }
+            }
+            for (; x < int(width); x++) {
+                lanes[0] += double(error_map.get(x, y));
+            }
+            double row = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+            double total = sum + row;
+            compensation += std::abs(sum) >= std::abs(row) ? (sum - total) + row : (row - total) + sum;
+            sum = total;
+        }
+        trimWorkspace();
+        return float((sum + compensation) / double(count));
+    }
+
+    // FLIP is local: the error of a pixel only depends on the inputs within this many pixels of it.
+    // That is the larger of the spatial filter radius, 3 standard deviations of the widest CSF
+    // Gaussian (b = 0.04 deg^2), and the feature filter radius, 3 * 0.5 * 0.082 degrees, plus a
+    // pixel of slack for rounding.
+    static int flipSupportRadius(float pixels_per_degree) {
+        constexpr float Pi = 3.14159265f;
+        float spatial = 3.0f * std::sqrt(0.04f / (2.0f * Pi * Pi)) * pixels_per_degree;
+        float feature = 3.0f * 0.5f * 0.082f * pixels_per_degree;
+        return int(std::ceil(std::max(spatial, feature))) + 1;
+    }
+
+    // Scratch images for comparing small regions, reallocated whenever the region size changes.
+    struct FlipImageRegionWorkspace {
+        int width = 0;
+        int height = 0;
+        std::optional<FLIP::image<FLIP::color3>> reference;
+        std::optional<FLIP::image<FLIP::color3>> test;
+        std::optional<FLIP::image<float>> errorMap;
+    };
+
+    static thread_local FlipImageRegionWorkspace regionWorkspace;
+
+    // Fills `image` with the pixels of an Rgb8 buffer `width` pixels wide, starting at (x_begin, y_begin).
+    static void setColor3Region(FLIP::image<FLIP::color3>& image, uint32_t width, uint8_t const* data, int x_begin, int y_begin) {
+        for (int y = 0; y < image.getHeight(); y++) {
+            uint8_t const* row = data + (size_t(y_begin + y) * width + size_t(x_begin)) * 3;
+            for (int x = 0; x < image.getWidth(); x++) {
+                image.set(x, y, FLIP::color3(
+                    float(row[3 * x]) / 255.0f,
+                    float(row[3 * x + 1]) / 255.0f,
+                    float(row[3 * x + 2]) / 255.0f
+                ));
+            }
+        }
+    }
+
+    // Fills `image` with the pixels of an Rgb8 buffer of `width` x `height` pixels, starting at
+    // (x_begin, y_begin). Coordinates outside of the buffer repeat its edge pixels.
+    static void setColor3Clamped(FLIP::image<FLIP::color3>& image, uint32_t width, uint32_t height, uint8_t const* data, int x_begin, int y_begin) {
+        for (int y = 0; y < image.getHeight(); y++) {
+            int source_y = std::min(std::max(y_begin + y, 0), int(height) - 1);
+            uint8_t const* row = data + size_t(source_y) * width * 3;
+            for (int x = 0; x < image.getWidth(); x++) {
+                uint8_t const* pixel = row + size_t(std::min(std::max(x_begin + x, 0), int(width) - 1)) * 3;
+                image.set(x, y, FLIP::color3(
+                    float(pixel[0]) / 255.0f,
+                    float(pixel[1]) / 255.0f,
+                    float(pixel[2]) / 255.0f
+                ));
+            }
+        }
+    }
+
+    static FlipImageRegionWorkspace& regionScratch(int width, int height) {
+        FlipImageRegionWorkspace& region = regionWorkspace;
+        if (!region.errorMap || region.width != width || region.height != height) {
+            region.reference.emplace(width, height);
+            region.test.emplace(width, height);
+            region.errorMap.emplace(width, height);
+            region.width = width;
+            region.height = height;
+        }
+        return region;
+    }
+
+    // Compares the region [x_begin, x_end) x [y_begin, y_end) of two Rgb8 buffers `width` pixels wide.
+    // The returned error map matches the full comparison at pixels that are flipSupportRadius or more
+    // inside every edge of the region which isn't also an edge of the image.
+    static FLIP::image<float>& flipRegion(uint32_t width, uint8_t const* reference_data, uint8_t const* test_data, int x_begin, int y_begin, int x_end, int y_end, float pixels_per_degree) {
+        FlipImageRegionWorkspace& region = regionScratch(x_end - x_begin, y_end - y_begin);
+        setColor3Region(*region.reference, width, reference_data, x_begin, y_begin);
+        setColor3Region(*region.test, width, test_data, x_begin, y_begin);
+        region.errorMap->FLIP(*region.reference, *region.test, pixels_per_degree);
+        return *region.errorMap;
+    }
+
+    // Error of a single pixel, comparing only its support. The window is always centered on the pixel,
+    // so samples near the image edges don't reallocate the workspace. Outside of the image it repeats the
+    // edge pixels, which are exactly what FLIP's clamped filters read there in the full comparison.
+    static float flipPixel(uint32_t width, uint32_t height, uint8_t const* reference_data, uint8_t const* test_data, int x, int y, float pixels_per_degree) {
+        int radius = flipSupportRadius(pixels_per_degree);
+        FlipImageRegionWorkspace& region = regionScratch(2 * radius + 1, 2 * radius + 1);
+        setColor3Clamped(*region.reference, width, height, reference_data, x - radius, y - radius);
+        setColor3Clamped(*region.test, width, height, test_data, x - radius, y - radius);
+        region.errorMap->FLIP(*region.reference, *region.test, pixels_per_degree);
+        return region.errorMap->get(radius, radius);
+    }
+
+    static uint64_t splitMix64(uint64_t& state) {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    struct SampledMean {
+        double mean;
+        double standardError;
+        double samples;
+    };
+
+    // Estimates the mean error of two images of at least one pixel from about sample_count > 0 samples.
+    static SampledMean sampleMean(uint32_t width, uint32_t height, uint8_t const* reference_data, uint8_t const* test_data, float pixels_per_degree, size_t sample_count, uint64_t seed) {
+        // One sample at a uniformly random pixel of every cell of a grid with about sample_count
+        // cells of roughly square shape. With as many samples as pixels every pixel is its own cell.
+        double aspect = double(width) / double(height);
+        uint32_t columns = uint32_t(std::min<double>(width, std::max(1.0, std::round(std::sqrt(double(sample_count) * aspect)))));
+        uint32_t rows = uint32_t(std::min<size_t>(height, std::max<size_t>(1, (sample_count + columns - 1) / columns)));
+
+        uint64_t state = seed;
+        double weighted_sum = 0.0;
+        double sum = 0.0;
+        double square_sum = 0.0;
+        for (uint32_t row = 0; row < rows; row++) {
+            uint32_t y_begin = uint32_t(uint64_t(row) * height / rows);
+            uint32_t y_end = uint32_t(uint64_t(row + 1) * height / rows);
+            for (uint32_t column = 0; column < columns; column++) {
+                uint32_t x_begin = uint32_t(uint64_t(column) * width / columns);
+                uint32_t x_end = uint32_t(uint64_t(column + 1) * width / columns);
+                uint32_t x = x_begin + uint32_t(splitMix64(state) % (x_end - x_begin));
+                uint32_t y = y_begin + uint32_t(splitMix64(state) % (y_end - y_begin));
+                double value = flipPixel(width, height, reference_data, test_data, int(x), int(y), pixels_per_degree);
+                // Cells differ in size by up to a pixel per side, so samples are weighted by area.
+                weighted_sum += value * double(x_end - x_begin) * double(y_end - y_begin);
+                sum += value;
+                square_sum += value * value;
+            }
+        }
+
+        // The standard error treats the samples as a simple random sample, which overestimates it for
+        // stratified samples, and applies the finite population correction, so it is 0 once every
+        // pixel has been sampled.
+        double count = double(width) * double(height);
+        double samples = double(rows) * double(columns);
+        double sample_mean = sum / samples;
+        double variance = samples > 1.0 ? std::max(0.0, (square_sum - samples * sample_mean * sample_mean) / (samples - 1.0)) : 0.0;
+        return SampledMean { weighted_sum / count, std::sqrt(variance / samples * (1.0 - samples / count)), samples };
+    }
+
+    static void setSampledMean(FlipImageSampledMean* mean, SampledMean const& estimate) {
+        mean->mean = float(estimate.mean);
+        mean->standard_error = float(estimate.standardError);
+        mean->lower = float(std::max(0.0, estimate.mean - 1.96 * estimate.standardError));
+        mean->upper = float(std::min(1.0, estimate.mean + 1.96 * estimate.standardError));
+        mean->sample_count = uint64_t(estimate.samples);
+    }
+
+    void flip_image_sampled_mean_from_rgb8(uint32_t width, uint32_t height, uint8_t const* reference_data, uint8_t const* test_data, float pixels_per_degree, size_t sample_count, uint64_t seed, FlipImageSampledMean* mean) {
+        *mean = FlipImageSampledMean {};
+        if (size_t(width) * size_t(height) == 0 || sample_count == 0) {
+            return;
+        }
+        setSampledMean(mean, sampleMean(width, height, reference_data, test_data, pixels_per_degree, sample_count, seed));
+    }
+
+    // Estimates the mean error within about budget_seconds. A first round of samples measures the cost of
+    // a sample. If a full comparison fits the remaining budget it is done instead, otherwise rounds of
+    // twice as many samples run while they fit, and the rounds are combined weighted by sample count.
+    void flip_image_budgeted_mean_from_rgb8(uint32_t width, uint32_t height, uint8_t const* reference_data, uint8_t const* test_data, float pixels_per_degree, double budget_seconds, uint64_t seed, FlipImageSampledMean* mean) {
+        constexpr size_t FirstRound = 64;
+        *mean = FlipImageSampledMean {};
+        size_t count = size_t(width) * size_t(height);
+        if (count == 0) {
+            return;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        auto elapsed = [&]() { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); };
+
+        SampledMean first = sampleMean(width, height, reference_data, test_data, pixels_per_degree, FirstRound, seed);
+        if (first.samples >= double(count)) {
+            setSampledMean(mean, first);
+            return;
+        }
+        double sample_cost = elapsed() / first.samples;
+
+        // A sample compares its whole support, so a full comparison costs about one sample per
+        // support area.
+        double support = 2.0 * flipSupportRadius(pixels_per_degree) + 1.0;
+        if (sample_cost * double(count) / (support * support) < budget_seconds - elapsed()) {
+            float exact = flip_image_mean_from_rgb8(width, height, reference_data, test_data, pixels_per_degree);
+            setSampledMean(mean, SampledMean { exact, 0.0, double(count) });
+            return;
+        }
+
+        double samples = first.samples;
+        double sum = first.mean * first.samples;
+        double square_error_sum = first.standardError * first.standardError * first.samples * first.samples;
+        size_t round = FirstRound;
+        for (uint64_t index = 1;; index++) {
+            // Leaves some of the remaining time as margin for the estimated cost being off.
+            double affordable = std::max(0.0, (budget_seconds - elapsed()) * 0.9 / sample_cost);
+            round = size_t(std::min(double(round * 2), affordable));
+            if (round < FirstRound) {
+                break;
+            }
+            double round_start = elapsed();
+            SampledMean estimate = sampleMean(width, height, reference_data, test_data, pixels_per_degree, round, seed + index * 0x9e3779b97f4a7c15ull);
+            sample_cost = (elapsed() - round_start) / estimate.samples;
+            samples += estimate.samples;
+            sum += estimate.mean * estimate.samples;
+            square_error_sum += estimate.standardError * estimate.standardError * estimate.samples * estimate.samples;
+        }
+        setSampledMean(mean, SampledMean { sum / samples, std::sqrt(square_error_sum) / samples, samples });
+    }
+
+    // Fills `error_map` with the comparison of two Rgb8 buffers of its size, evaluating FLIP only near
+    // pixels that differ. A prepass takes the largest absolute channel difference of every tile. Tiles
+    // with a differing pixel within flipSupportRadius are compared in horizontal runs, every other tile
+    // has identical inputs over its whole support, so its error is exactly 0. Returns the number of
+    // pixels evaluated.
+    size_t flip_image_float_flip_guided_rgb8(FlipImageFloat* error_map, uint8_t const* reference_data, uint8_t const* test_data, float pixels_per_degree) {
+        constexpr uint32_t TileSize = 32;
+        uint32_t width = uint32_t(error_map->inner.getWidth());
+        uint32_t height = uint32_t(error_map->inner.getHeight());
+        uint32_t columns = (width + TileSize - 1) / TileSize;
+        uint32_t rows = (height + TileSize - 1) / TileSize;
+
+        std::vector<uint8_t> importance(size_t(columns) * rows, 0);
+        size_t row_bytes = size_t(width) * 3;
+        for (uint32_t y = 0; y < height; y++) {
+            uint8_t const* reference_row = reference_data + size_t(y) * row_bytes;
+            uint8_t const* test_row = test_data + size_t(y) * row_bytes;
+            uint8_t* tile_importance = &importance[size_t(y / TileSize) * columns];
+            for (uint32_t column = 0; column < columns; column++) {
+                size_t begin = size_t(column) * TileSize * 3;
+                size_t end = std::min(row_bytes, begin + TileSize * 3);
+                // Branch free so that it vectorizes.
+                uint8_t difference = tile_importance[column];
+                for (size_t i = begin; i < end; i++) {
+                    uint8_t a = reference_row[i];
+                    uint8_t b = test_row[i];
+                    difference = std::max<uint8_t>(difference, a > b ? a - b : b - a);
+                }
+                tile_importance[column] = difference;
+            }
+        }
+
+        // A tile needs evaluating if any tile within the support radius has a difference.
+        int radius = flipSupportRadius(pixels_per_degree);
+        int reach = (radius + int(TileSize) - 1) / int(TileSize);
+        std::vector<uint8_t> evaluate(importance.size(), 0);
+        for (int row = 0; row < int(rows); row++) {
+            for (int column = 0; column < int(columns); column++) {
+                if (importance[size_t(row) * columns + column] == 0) {
+                    continue;
+                }
+                for (int r = std::max(0, row - reach); r <= std::min(int(rows) - 1, row + reach); r++) {
+                    for (int c = std::max(0, column - reach); c <= std::min(int(columns) - 1, column + reach); c++) {
+                        evaluate[size_t(r) * columns + c] = 1;
+                    }
+                }
+            }
+        }
+
+        size_t evaluated = 0;
+        for (uint32_t row = 0; row < rows; row++) {
+            int y_begin = int(row * TileSize);
+            int y_end = std::min(int(height), y_begin + int(TileSize));
+            uint32_t column = 0;
+            while (column < columns) {
+                bool run = evaluate[size_t(row) * columns + column] != 0;
+                uint32_t run_end = column;
+                while (run_end < columns && (evaluate[size_t(row) * columns + run_end] != 0) == run) {
+                    run_end++;
+                }
+                int x_begin = int(column * TileSize);
+                int x_end = std::min(int(width), int(run_end * TileSize));
+                if (run) {
+                    int region_x = std::max(0, x_begin - radius);
+                    int region_y = std::max(0, y_begin - radius);
+                    FLIP::image<float>& region = flipRegion(
+                        width, reference_data, test_data,
+                        region_x, region_y, std::min(int(width), x_end + radius), std::min(int(height), y_end + radius),
+                        pixels_per_degree);
+                    for (int y = y_begin; y < y_end; y++) {
+                        for (int x = x_begin; x < x_end; x++) {
+                            error_map->inner.set(x, y, region.get(x - region_x, y - region_y));
+                        }
+                    }
+                    evaluated += size_t(x_end - x_begin) * size_t(y_end - y_begin);
+                } else {
+                    for (int y = y_begin; y < y_end; y++) {
+                        for (int x = x_begin; x < x_end; x++) {
+                            error_map->inner.set(x, y, 0.0f);
+                        }
+                    }
+                }
+                column = run_end;
+            }
+        }
+        return evaluated;
+    }
+
+    // Compares two images as their rows arrive. Input rows are kept from flipSupportRadius rows above
+    // the first row not yet compared, and a band of rows is compared once flipSupportRadius rows below
+    // it have arrived, or the images are finished.
+    struct FlipImageStream {
+        uint32_t width;
+        float pixelsPerDegree;
+        int radius;
+        // Rows [bufferBegin, pushed) of both images.
+        std::vector<uint8_t> reference;
+        std::vector<uint8_t> test;
+        uint32_t bufferBegin = 0;
+        uint32_t pushed = 0;
+        uint32_t compared = 0;
+        bool finished = false;
+        // Error rows compared but not taken yet.
+        std::vector<float> errors;
+    };
+
+    // Compares the band of rows that is ready, if it is large enough to be worth the margin around it.
+    static void compareStreamBand(FlipImageStream& stream) {
+        uint32_t radius = uint32_t(stream.radius);
+        uint32_t ready = stream.finished ? stream.pushed : (stream.pushed > radius ? stream.pushed - radius : 0);
+        uint32_t minimum = stream.finished ? 1 : std::max<uint32_t>(32, 2 * radius);
+        if (ready < stream.compared + minimum || stream.width == 0) {
+            return;
+        }
+
+        int region_begin = int(std::max(stream.compared, radius) - radius - stream.bufferBegin);
+        int region_end = int(stream.pushed - stream.bufferBegin);
+        FLIP::image<float>& region = flipRegion(
+            stream.width, stream.reference.data(), stream.test.data(),
+            0, region_begin, int(stream.width), region_end, stream.pixelsPerDegree);
+        int first = int(stream.compared - stream.bufferBegin) - region_begin;
+        for (int y = first; y < first + int(ready - stream.compared); y++) {
+            for (int x = 0; x < int(stream.width); x++) {
+                stream.errors.push_back(region.get(x, y));
+            }
+        }
+        stream.compared = ready;
+
+        // Rows above the next band's margin are no longer needed.
+        uint32_t keep = std::max(stream.compared, radius) - radius;
+        size_t dropped = size_t(keep - stream.bufferBegin) * stream.width * 3;
+        stream.reference.erase(stream.reference.begin(), stream.reference.begin() + dropped);
+        stream.test.erase(stream.test.begin(), stream.test.begin() + dropped);
+        stream.bufferBegin = keep;
+    }
+
+    FlipImageStream* flip_image_stream_new(uint32_t width, float pixels_per_degree) {
+        return new FlipImageStream { width, pixels_per_degree, flipSupportRadius(pixels_per_degree) };
+    }
+    // Appends `rows` rows of both images, each `width` Rgb8 pixels. Returns the number of error rows
+    // ready to be taken.
+    uint32_t flip_image_stream_push_rows(FlipImageStream* stream, uint32_t rows, uint8_t const* reference_data, uint8_t const* test_data) {
+        size_t bytes = size_t(rows) * stream->width * 3;
+        stream->reference.insert(stream->reference.end(), reference_data, reference_data + bytes);
+        stream->test.insert(stream->test.end(), test_data, test_data + bytes);
+        stream->pushed += rows;
+        compareStreamBand(*stream);
+        return flip_image_stream_ready_rows(stream);
+    }
+    // Marks the last row as pushed and compares the remaining rows. Returns the number of error rows
+    // ready to be taken.
+    uint32_t flip_image_stream_finish(FlipImageStream* stream) {
+        stream->finished = true;
+        compareStreamBand(*stream);
+        return flip_image_stream_ready_rows(stream);
+    }
+    uint32_t flip_image_stream_ready_rows(FlipImageStream const* stream) {
+        return stream->width ? uint32_t(stream->errors.size() / stream->width) : 0;
+    }
+    // Writes flip_image_stream_ready_rows() * width values, the error rows in order, and removes them.
+    void flip_image_stream_take_rows(FlipImageStream* stream, float* values) {
+        std::copy(stream->errors.begin(), stream->errors.end(), values);
+        stream->errors.clear();
+    }
+    void flip_image_stream_free(FlipImageStream* stream) {
+        delete stream;
+    }
+
+    // Comparison split into bands of rows, each prepared (inputs converted) and then compared (FLIP
+    // evaluated over the band plus the support margin, and the band's rows written to the error map).
+    // Task 2 * band prepares a band, task 2 * band + 1 compares it once the preparation is done.
+    // The library runs nothing on its own, the caller's scheduler hands out, runs and retires tasks.
+    struct FlipImageTaskGraph {
+        enum State : uint8_t {
+            Waiting,
+            Ready,
+            HandedOut,
+            Running,
+            Ran,
+            Done,
+        };
+
+        struct Band {
+            int yBegin;
+            int yEnd;
+            int regionBegin;
+            int regionEnd;
+            std::optional<FLIP::image<FLIP::color3>> reference;
+            std::optional<FLIP::image<FLIP::color3>> test;
+        };
+
+        FLIP::image<float>& errorMap;
+        uint8_t const* referenceData;
+        uint8_t const* testData;
+        float pixelsPerDegree;
+        std::vector<Band> bands;
+        std::vector<State> states;
+        size_t done = 0;
+        std::mutex mutex;
+    };
+
+    FlipImageTaskGraph* flip_image_task_graph_new(FlipImageFloat* error_map, uint8_t const* reference_data, uint8_t const* test_data, float pixels_per_degree, uint32_t band_rows) {
+        auto graph = new FlipImageTaskGraph { error_map->inner, reference_data, test_data, pixels_per_degree };
+        int height = error_map->inner.getHeight();
+        int rows = band_rows ? int(band_rows) : 64;
+        int radius = flipSupportRadius(pixels_per_degree);
+        if (error_map->inner.getWidth() > 0) {
+            for (int y = 0; y < height; y += rows) {
+                int y_end = std::min(height, y + rows);
+                graph->bands.push_back(FlipImageTaskGraph::Band { y, y_end, std::max(0, y - radius), std::min(height, y_end + radius) });
+            }
+        }
+        graph->states.resize(2 * graph->bands.size(), FlipImageTaskGraph::Waiting);
+        for (size_t band = 0; band < graph->bands.size(); band++) {
+            graph->states[2 * band] = FlipImageTaskGraph::Ready;
+        }
+        return graph;
+    }
+    size_t flip_image_task_graph_task_count(FlipImageTaskGraph const* graph) {
+        return graph->states.size();
+    }
+    // Writes the ids of up to `capacity` tasks whose dependencies are done and which weren't handed out
+    // before, and returns how many were written.
+    size_t flip_image_task_graph_get_ready_tasks(FlipImageTaskGraph* graph, uint32_t* tasks, size_t capacity) {
+        std::lock_guard<std::mutex> lock(graph->mutex);
+        size_t count = 0;
+        for (size_t task = 0; task < graph->states.size() && count < capacity; task++) {
+            if (graph->states[task] == FlipImageTaskGraph::Ready) {
+                graph->states[task] = FlipImageTaskGraph::HandedOut;
+                tasks[count++] = uint32_t(task);
+            }
+        }
+        return count;
+    }
+    // Runs a handed out task on the calling thread. Different tasks may run concurrently. Returns false
+    // without doing anything if the task wasn't handed out or already ran.
+    bool flip_image_task_graph_run_task(FlipImageTaskGraph* graph, uint32_t task) {
+        {
+            std::lock_guard<std::mutex> lock(graph->mutex);
+            if (task >= graph->states.size() || graph->states[task] != FlipImageTaskGraph::HandedOut) {
+                return false;
+            }
+            graph->states[task] = FlipImageTaskGraph::Running;
+        }
+
+        FlipImageTaskGraph::Band& band = graph->bands[task / 2];
+        int width = graph->errorMap.getWidth();
+        if (task % 2 == 0) {
+            band.reference.emplace(width, band.regionEnd - band.regionBegin);
+            band.test.emplace(width, band.regionEnd - band.regionBegin);
+            setColor3Region(*band.reference, uint32_t(width), graph->referenceData, 0, band.regionBegin);
+            setColor3Region(*band.test, uint32_t(width), graph->testData, 0, band.regionBegin);
+        } else {
+            FLIP::image<float> region(width, band.regionEnd - band.regionBegin);
+            region.FLIP(*band.reference, *band.test, graph->pixelsPerDegree);
+            for (int y = band.yBegin; y < band.yEnd; y++) {
+                for (int x = 0; x < width; x++) {
+                    graph->errorMap.set(x, y, region.get(x, y - band.regionBegin));
+                }
+            }
+            // The inputs are only needed by this task, free them right away.
+            band.reference.reset();
+            band.test.reset();
+        }
+
+        std::lock_guard<std::mutex> lock(graph->mutex);
+        graph->states[task] = FlipImageTaskGraph::Ran;
+        return true;
+    }
+    // Retires a task that ran, making the tasks depending on it ready. Returns false if it hasn't run.
+    bool flip_image_task_graph_mark_done(FlipImageTaskGraph* graph, uint32_t task) {
+        std::lock_guard<std::mutex> lock(graph->mutex);
+        if (task >= graph->states.size() || graph->states[task] != FlipImageTaskGraph::Ran) {
+            return false;
+        }
+        graph->states[task] = FlipImageTaskGraph::Done;
+        graph->done++;
+        if (task % 2 == 0) {
+            graph->states[task + 1] = FlipImageTaskGraph::Ready;
+        }
+        return true;
+    }
+    bool flip_image_task_graph_is_done(FlipImageTaskGraph* graph) {
+        std::lock_guard<std::mutex> lock(graph->mutex);
+        return graph->done == graph->states.size();
+    }
+    void flip_image_task_graph_free(FlipImageTaskGraph* graph) {
+        delete graph;
+    }
+
+    struct FlipImageCancelToken {
+        std::atomic<bool> cancelled { false };
+    };
+
+    FlipImageCancelToken* flip_image_cancel_token_new() {
+        return new FlipImageCancelToken;
+    }
+    // May be called from any thread, also while a comparison using the token is running.
+    void flip_image_cancel_token_cancel(FlipImageCancelToken* token) {
+        token->cancelled.store(true, std::memory_order_relaxed);
+    }
+    bool flip_image_cancel_token_is_cancelled(FlipImageCancelToken const* token) {
+        return token->cancelled.load(std::memory_order_relaxed);
+    }
+    void flip_image_cancel_token_free(FlipImageCancelToken* token) {
+        delete token;
+    }
+
+    // Compares two Rgb8 buffers the size of error_map one band of rows at a time. Before every band the
+    // token is checked, and after every band `progress` is called with the fraction of rows done, which
+    // may return false to stop as well. Both may be null. Returns false if stopped early, in which
+    // case the error map is only partially written. Scratch images are freed before returning.
+    bool flip_image_float_flip_rgb8_cancellable(FlipImageFloat* error_map, uint8_t const* reference_data, uint8_t const* test_data, float pixels_per_degree, FlipImageCancelToken const* token, FlipImageProgressCallback progress, void* user_data) {
+        int width = error_map->inner.getWidth();
+        int height = error_map->inner.getHeight();
+        int radius = flipSupportRadius(pixels_per_degree);
+        // Every band also compares `radius` rows above and below it, bands of 32 radii keep that to 6%.
+        int band_rows = std::max(64, 32 * radius);
+        if (width == 0) {
+            return !(token && flip_image_cancel_token_is_cancelled(token));
+        }
+
+        std::optional<FLIP::image<FLIP::color3>> reference;
+        std::optional<FLIP::image<FLIP::color3>> test;
+        std::optional<FLIP::image<float>> region;
+        for (int y_begin = 0; y_begin < height; y_begin += band_rows) {
+            if (token && flip_image_cancel_token_is_cancelled(token)) {
+                return false;
+            }
+            int y_end = std::min(height, y_begin + band_rows);
+            int region_begin = std::max(0, y_begin - radius);
+            int region_height = std::min(height, y_end + radius) - region_begin;
+            if (!region || region->getHeight() != region_height) {
+                reference.emplace(width, region_height);
+                test.emplace(width, region_height);
+                region.emplace(width, region_height);
+            }
+            setColor3Region(*reference, uint32_t(width), reference_data, 0, region_begin);
+            setColor3Region(*test, uint32_t(width), test_data, 0, region_begin);
+            region->FLIP(*reference, *test, pixels_per_degree);
+            for (int y = y_begin; y < y_end; y++) {
+                for (int x = 0; x < width; x++) {
+                    error_map->inner.set(x, y, region->get(x, y - region_begin));
+                }
+            }
+            if (progress && !progress(user_data, float(y_end) / float(height))) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
@@ -12,6 +12,30 @@ extern "C" {
     FlipImageColor3* flip_image_color3_new(uint32_t width, uint32_t height, uint8_t const* data);
     FlipImageColor3* flip_image_color3_clone(FlipImageColor3* image);
     void flip_image_color3_get_data(FlipImageColor3 const* image, uint8_t* data);
+    void flip_image_color3_set_rows(FlipImageColor3* image, uint32_t y_begin, uint32_t y_end, uint8_t const* data);
+    void flip_image_color3_get_rows(FlipImageColor3 const* image, uint32_t y_begin, uint32_t y_end, uint8_t* data);
+    enum FlipImageChromaSubsampling {
+        FlipImageChromaSubsampling420,
+        FlipImageChromaSubsampling422,
+        FlipImageChromaSubsampling444,
+    };
+
+    enum FlipImageYuvMatrix {
+        FlipImageYuvMatrixBt601,
+        FlipImageYuvMatrixBt709,
+        FlipImageYuvMatrixBt2020,
+    };
+
+    // Where subsampled chroma sits relative to the luma samples it covers.
+    enum FlipImageChromaSiting {
+        FlipImageChromaSitingCenter,
+        FlipImageChromaSitingLeft,
+        FlipImageChromaSitingTopLeft,
+    };
+
+    // Tightly packed planes, chroma rounded up in size. Samples are bytes if bit_depth is 8,
+    // otherwise 16 bit little endian holding bit_depth (9 to 16) bits.
+    void flip_image_color3_set_yuv(FlipImageColor3* image, uint8_t const* y_plane, uint8_t const* u_plane, uint8_t const* v_plane, FlipImageChromaSubsampling subsampling, FlipImageChromaSiting siting, uint32_t bit_depth, FlipImageYuvMatrix matrix, bool full_range);
     void flip_image_color3_free(FlipImageColor3* image);
 
     FlipImageColor3* flip_image_color3_magma_map();
@@ -20,10 +44,27 @@ extern "C" {
     FlipImageFloat* flip_image_float_new(uint32_t width, uint32_t height, float const* data);
     FlipImageFloat* flip_image_float_clone(FlipImageFloat* image);
     void flip_image_float_get_data(FlipImageFloat const* image, float* data);
+    void flip_image_float_set_rows(FlipImageFloat* image, uint32_t y_begin, uint32_t y_end, float const* data);
+    void flip_image_float_get_rows(FlipImageFloat const* image, uint32_t y_begin, uint32_t y_end, float* data);
     void flip_image_float_free(FlipImageFloat* image);
+    // Writes threshold_count values to `exceeding` and cdf_size values to `cdf`.
+    void flip_image_float_threshold_counts(FlipImageFloat const* image, float const* thresholds, size_t threshold_count, uint64_t* exceeding, size_t cdf_size, uint64_t* cdf);
 
     void flip_image_float_flip(FlipImageFloat* error_map, FlipImageColor3* reference_image, FlipImageColor3* test_image, float pixels_per_degree);
 
+    enum FlipImageComponents {
+        FlipImageComponentsColor = 1,
+        FlipImageComponentsFeature = 2,
+        FlipImageComponentsBoth = 3,
+    };
+
+    // Color and Feature write only that term of the error, Both is the same as flip_image_float_flip.
+    void flip_image_float_flip_components(FlipImageFloat* error_map, FlipImageColor3* reference_image, FlipImageColor3* test_image, float pixels_per_degree, FlipImageComponents components);
+
+    // Single channel sRGB images, the same as color images with the value in every channel.
+    void flip_image_float_flip_gray8(FlipImageFloat* error_map, uint8_t const* reference_data, uint8_t const* test_data, float pixels_per_degree, FlipImageComponents components);
+    void flip_image_float_flip_gray32f(FlipImageFloat* error_map, float const* reference_data, float const* test_data, float pixels_per_degree, FlipImageComponents components);
+
     void flip_image_float_copy_float_to_color3(FlipImageFloat* error_map, FlipImageColor3* output);
 
     struct FlipImageHistogramRef;
@@ -33,6 +74,8 @@ extern "C" {
     size_t flip_image_histogram_ref_get_bucket_id_min(FlipImageHistogramRef const* histogram);
     size_t flip_image_histogram_ref_get_bucket_id_max(FlipImageHistogramRef const* histogram);
     size_t flip_image_histogram_ref_get_bucket_value(FlipImageHistogramRef const* histogram, size_t bucket_id);
+    void flip_image_histogram_ref_get_bucket_values(FlipImageHistogramRef const* histogram, size_t* values);
+    void flip_image_histogram_ref_get_bucket_edges(FlipImageHistogramRef const* histogram, float* edges);
     size_t flip_image_histogram_ref_size(FlipImageHistogramRef const* histogram);
     float flip_image_histogram_ref_get_min_value(FlipImageHistogramRef const* histogram);
     float flip_image_histogram_ref_get_max_value(FlipImageHistogramRef const* histogram);
@@ -47,15 +90,151 @@ extern "C" {
 
     FlipImagePool* flip_image_pool_new(size_t buckets);
     FlipImageHistogramRef* flip_image_pool_get_histogram(FlipImagePool* pool);
+    FlipImageHistogramRef* flip_image_pool_borrow_histogram(FlipImagePool* pool);
     float flip_image_pool_get_min_value(FlipImagePool const* pool);
     float flip_image_pool_get_max_value(FlipImagePool const* pool);
     float flip_image_pool_get_mean(FlipImagePool const* pool);
     double flip_image_pool_get_weighted_percentile(FlipImagePool const* pool, double percentile);
     float flip_image_pool_get_percentile(FlipImagePool* pool, float percentile, bool weighted);
     void flip_image_pool_update_image(FlipImagePool* pool, FlipImageFloat const* image);
+    void flip_image_pool_update_rows(FlipImagePool* pool, FlipImageFloat const* image, uint32_t y_begin, uint32_t y_end);
     void flip_image_pool_clear(FlipImagePool* pool);
     void flip_image_pool_free(FlipImagePool* pool);
 
+    struct FlipImageBucketLayout;
+
+    FlipImageBucketLayout* flip_image_bucket_layout_new_linear(size_t buckets);
+    FlipImageBucketLayout* flip_image_bucket_layout_new_logarithmic(uint32_t mantissa_bits, int32_t min_exponent);
+    FlipImageBucketLayout* flip_image_bucket_layout_new_adaptive(size_t buckets, FlipImageFloat const* training_image);
+    FlipImageBucketLayout* flip_image_bucket_layout_clone(FlipImageBucketLayout const* layout);
+    size_t flip_image_bucket_layout_size(FlipImageBucketLayout const* layout);
+    size_t flip_image_bucket_layout_value_bucket_id(FlipImageBucketLayout const* layout, float value);
+    void flip_image_bucket_layout_get_edges(FlipImageBucketLayout const* layout, float* edges);
+    void flip_image_bucket_layout_free(FlipImageBucketLayout* layout);
+
+    struct FlipImageBucketPool;
+
+    FlipImageBucketPool* flip_image_bucket_pool_new(FlipImageBucketLayout const* layout);
+    FlipImageBucketPool* flip_image_bucket_pool_clone(FlipImageBucketPool const* pool);
+    size_t flip_image_bucket_pool_size(FlipImageBucketPool const* pool);
+    void flip_image_bucket_pool_get_bucket_values(FlipImageBucketPool const* pool, double* values);
+    void flip_image_bucket_pool_get_bucket_edges(FlipImageBucketPool const* pool, float* edges);
+    double flip_image_bucket_pool_get_count(FlipImageBucketPool const* pool);
+    float flip_image_bucket_pool_get_min_value(FlipImageBucketPool const* pool);
+    float flip_image_bucket_pool_get_max_value(FlipImageBucketPool const* pool);
+    float flip_image_bucket_pool_get_mean(FlipImageBucketPool const* pool);
+    float flip_image_bucket_pool_get_percentile(FlipImageBucketPool const* pool, float percentile, bool weighted);
+    void flip_image_bucket_pool_update_image(FlipImageBucketPool* pool, FlipImageFloat const* image);
+    void flip_image_bucket_pool_update_labeled_rows(FlipImageBucketPool* const* pools, size_t label_count, FlipImageFloat const* image, uint32_t const* labels, uint32_t y_begin, uint32_t y_end);
+    // Returns false without merging if the pools have different layouts.
+    bool flip_image_bucket_pool_merge(FlipImageBucketPool* pool, FlipImageBucketPool const* other);
+    void flip_image_bucket_pool_clear(FlipImageBucketPool* pool);
+    void flip_image_bucket_pool_free(FlipImageBucketPool* pool);
+
+    struct FlipImageWindowedPool;
+
+    FlipImageWindowedPool* flip_image_windowed_pool_new(FlipImageBucketLayout const* layout, size_t frames);
+    FlipImageBucketPool const* flip_image_windowed_pool_get_pool(FlipImageWindowedPool const* pool);
+    size_t flip_image_windowed_pool_get_window_size(FlipImageWindowedPool const* pool);
+    size_t flip_image_windowed_pool_get_frame_count(FlipImageWindowedPool const* pool);
+    void flip_image_windowed_pool_push_image(FlipImageWindowedPool* pool, FlipImageFloat const* image);
+    void flip_image_windowed_pool_clear(FlipImageWindowedPool* pool);
+    void flip_image_windowed_pool_free(FlipImageWindowedPool* pool);
+
+    struct FlipImageDecayingPool;
+
+    FlipImageDecayingPool* flip_image_decaying_pool_new(FlipImageBucketLayout const* layout, double decay);
+    double flip_image_decaying_pool_get_decay(FlipImageDecayingPool const* pool);
+    size_t flip_image_decaying_pool_size(FlipImageDecayingPool const* pool);
+    void flip_image_decaying_pool_get_bucket_values(FlipImageDecayingPool const* pool, double* values);
+    double flip_image_decaying_pool_get_count(FlipImageDecayingPool const* pool);
+    float flip_image_decaying_pool_get_min_value(FlipImageDecayingPool const* pool);
+    float flip_image_decaying_pool_get_max_value(FlipImageDecayingPool const* pool);
+    float flip_image_decaying_pool_get_mean(FlipImageDecayingPool const* pool);
+    float flip_image_decaying_pool_get_percentile(FlipImageDecayingPool const* pool, float percentile, bool weighted);
+    void flip_image_decaying_pool_update_image(FlipImageDecayingPool* pool, FlipImageFloat const* image);
+    void flip_image_decaying_pool_clear(FlipImageDecayingPool* pool);
+    void flip_image_decaying_pool_free(FlipImageDecayingPool* pool);
+
+    struct FlipImageConcurrentPool;
+
+    FlipImageConcurrentPool* flip_image_concurrent_pool_new(FlipImageBucketLayout const* layout, size_t shards);
+    void flip_image_concurrent_pool_update_image(FlipImageConcurrentPool* pool, FlipImageFloat const* image);
+    void flip_image_concurrent_pool_update_values(FlipImageConcurrentPool* pool, float const* values, size_t count);
+    FlipImageBucketPool* flip_image_concurrent_pool_snapshot(FlipImageConcurrentPool const* pool);
+    void flip_image_concurrent_pool_clear(FlipImageConcurrentPool* pool);
+    void flip_image_concurrent_pool_free(FlipImageConcurrentPool* pool);
+
+    struct FlipImageStatistics {
+        float mean;
+        float weighted_median;
+        float first_weighted_quartile;
+        float third_weighted_quartile;
+        float min_value;
+        float max_value;
+    };
+
+    void flip_image_statistics_from_rgb8(uint32_t width, uint32_t height, uint8_t const* reference_data, uint8_t const* test_data, float pixels_per_degree, FlipImageStatistics* statistics);
+    // Mean of the error map only, 0.0 for empty images.
+    float flip_image_mean_from_rgb8(uint32_t width, uint32_t height, uint8_t const* reference_data, uint8_t const* test_data, float pixels_per_degree);
+    // Frees the scratch images the two functions above keep on the calling thread.
+    void flip_image_release_workspace();
+
+    struct FlipImageSampledMean {
+        float mean;
+        float standard_error;
+        // 95% confidence interval of the mean.
+        float lower;
+        float upper;
+        uint64_t sample_count;
+    };
+
+    // Estimates the mean error from about sample_count stratified samples, each computed from its
+    // local filter support only. All zero for empty images or no samples.
+    void flip_image_sampled_mean_from_rgb8(uint32_t width, uint32_t height, uint8_t const* reference_data, uint8_t const* test_data, float pixels_per_degree, size_t sample_count, uint64_t seed, FlipImageSampledMean* mean);
+    // Estimates the mean error within about budget_seconds, exactly if a full comparison fits. Always
+    // evaluates a first small round of samples, even if that exceeds the budget.
+    void flip_image_budgeted_mean_from_rgb8(uint32_t width, uint32_t height, uint8_t const* reference_data, uint8_t const* test_data, float pixels_per_degree, double budget_seconds, uint64_t seed, FlipImageSampledMean* mean);
+
+    // Writes the comparison of two Rgb8 buffers the size of error_map, skipping regions whose inputs are
+    // identical. Returns the number of pixels that were evaluated.
+    size_t flip_image_float_flip_guided_rgb8(FlipImageFloat* error_map, uint8_t const* reference_data, uint8_t const* test_data, float pixels_per_degree);
+
+    struct FlipImageStream;
+
+    FlipImageStream* flip_image_stream_new(uint32_t width, float pixels_per_degree);
+    uint32_t flip_image_stream_push_rows(FlipImageStream* stream, uint32_t rows, uint8_t const* reference_data, uint8_t const* test_data);
+    uint32_t flip_image_stream_finish(FlipImageStream* stream);
+    uint32_t flip_image_stream_ready_rows(FlipImageStream const* stream);
+    // Writes flip_image_stream_ready_rows() * width values.
+    void flip_image_stream_take_rows(FlipImageStream* stream, float* values);
+    void flip_image_stream_free(FlipImageStream* stream);
+
+    struct FlipImageTaskGraph;
+
+    // The error map and both Rgb8 buffers must outlive the graph. Passing 0 band_rows picks a default.
+    FlipImageTaskGraph* flip_image_task_graph_new(FlipImageFloat* error_map, uint8_t const* reference_data, uint8_t const* test_data, float pixels_per_degree, uint32_t band_rows);
+    size_t flip_image_task_graph_task_count(FlipImageTaskGraph const* graph);
+    // Writes up to `capacity` task ids.
+    size_t flip_image_task_graph_get_ready_tasks(FlipImageTaskGraph* graph, uint32_t* tasks, size_t capacity);
+    bool flip_image_task_graph_run_task(FlipImageTaskGraph* graph, uint32_t task);
+    bool flip_image_task_graph_mark_done(FlipImageTaskGraph* graph, uint32_t task);
+    bool flip_image_task_graph_is_done(FlipImageTaskGraph* graph);
+    void flip_image_task_graph_free(FlipImageTaskGraph* graph);
+
+    struct FlipImageCancelToken;
+
+    FlipImageCancelToken* flip_image_cancel_token_new();
+    void flip_image_cancel_token_cancel(FlipImageCancelToken* token);
+    bool flip_image_cancel_token_is_cancelled(FlipImageCancelToken const* token);
+    void flip_image_cancel_token_free(FlipImageCancelToken* token);
+
+    // Returns false to stop the comparison.
+    typedef bool (*FlipImageProgressCallback)(void* user_data, float progress);
+
+    // token, progress and user_data may be null. Returns false if stopped before the end.
+    bool flip_image_float_flip_rgb8_cancellable(FlipImageFloat* error_map, uint8_t const* reference_data, uint8_t const* test_data, float pixels_per_degree, FlipImageCancelToken const* token, FlipImageProgressCallback progress, void* user_data);
+
 
 #ifdef __cplusplus
 }
@@ -19,6 +19,47 @@ extern "C" {
 extern "C" {
     pub fn flip_image_color3_get_data(image: *const FlipImageColor3, data: *mut u8);
 }
+extern "C" {
+    pub fn flip_image_color3_set_rows(
+        image: *mut FlipImageColor3,
+        y_begin: u32,
+        y_end: u32,
+        data: *const u8,
+    );
+}
+extern "C" {
+    pub fn flip_image_color3_get_rows(
+        image: *const FlipImageColor3,
+        y_begin: u32,
+        y_end: u32,
+        data: *mut u8,
+    );
+}
+pub const FlipImageChromaSubsampling_FlipImageChromaSubsampling420: FlipImageChromaSubsampling = 0;
+pub const FlipImageChromaSubsampling_FlipImageChromaSubsampling422: FlipImageChromaSubsampling = 1;
+pub const FlipImageChromaSubsampling_FlipImageChromaSubsampling444: FlipImageChromaSubsampling = 2;
+pub type FlipImageChromaSubsampling = ::std::os::raw::c_uint;
+pub const FlipImageYuvMatrix_FlipImageYuvMatrixBt601: FlipImageYuvMatrix = 0;
+pub const FlipImageYuvMatrix_FlipImageYuvMatrixBt709: FlipImageYuvMatrix = 1;
+pub const FlipImageYuvMatrix_FlipImageYuvMatrixBt2020: FlipImageYuvMatrix = 2;
+pub type FlipImageYuvMatrix = ::std::os::raw::c_uint;
+pub const FlipImageChromaSiting_FlipImageChromaSitingCenter: FlipImageChromaSiting = 0;
+pub const FlipImageChromaSiting_FlipImageChromaSitingLeft: FlipImageChromaSiting = 1;
+pub const FlipImageChromaSiting_FlipImageChromaSitingTopLeft: FlipImageChromaSiting = 2;
+pub type FlipImageChromaSiting = ::std::os::raw::c_uint;
+extern "C" {
+    pub fn flip_image_color3_set_yuv(
+        image: *mut FlipImageColor3,
+        y_plane: *const u8,
+        u_plane: *const u8,
+        v_plane: *const u8,
+        subsampling: FlipImageChromaSubsampling,
+        siting: FlipImageChromaSiting,
+        bit_depth: u32,
+        matrix: FlipImageYuvMatrix,
+        full_range: bool,
+    );
+}
 extern "C" {
     pub fn flip_image_color3_free(image: *mut FlipImageColor3);
 }
@@ -41,9 +82,35 @@ extern "C" {
 extern "C" {
     pub fn flip_image_float_get_data(image: *const FlipImageFloat, data: *mut f32);
 }
+extern "C" {
+    pub fn flip_image_float_set_rows(
+        image: *mut FlipImageFloat,
+        y_begin: u32,
+        y_end: u32,
+        data: *const f32,
+    );
+}
+extern "C" {
+    pub fn flip_image_float_get_rows(
+        image: *const FlipImageFloat,
+        y_begin: u32,
+        y_end: u32,
+        data: *mut f32,
+    );
+}
 extern "C" {
     pub fn flip_image_float_free(image: *mut FlipImageFloat);
 }
+extern "C" {
+    pub fn flip_image_float_threshold_counts(
+        image: *const FlipImageFloat,
+        thresholds: *const f32,
+        threshold_count: usize,
+        exceeding: *mut u64,
+        cdf_size: usize,
+        cdf: *mut u64,
+    );
+}
 extern "C" {
     pub fn flip_image_float_flip(
         error_map: *mut FlipImageFloat,
@@ -52,6 +119,37 @@ extern "C" {
         pixels_per_degree: f32,
     );
 }
+pub const FlipImageComponents_FlipImageComponentsColor: FlipImageComponents = 1;
+pub const FlipImageComponents_FlipImageComponentsFeature: FlipImageComponents = 2;
+pub const FlipImageComponents_FlipImageComponentsBoth: FlipImageComponents = 3;
+pub type FlipImageComponents = ::std::os::raw::c_uint;
+extern "C" {
+    pub fn flip_image_float_flip_components(
+        error_map: *mut FlipImageFloat,
+        reference_image: *mut FlipImageColor3,
+        test_image: *mut FlipImageColor3,
+        pixels_per_degree: f32,
+        components: FlipImageComponents,
+    );
+}
+extern "C" {
+    pub fn flip_image_float_flip_gray8(
+        error_map: *mut FlipImageFloat,
+        reference_data: *const u8,
+        test_data: *const u8,
+        pixels_per_degree: f32,
+        components: FlipImageComponents,
+    );
+}
+extern "C" {
+    pub fn flip_image_float_flip_gray32f(
+        error_map: *mut FlipImageFloat,
+        reference_data: *const f32,
+        test_data: *const f32,
+        pixels_per_degree: f32,
+        components: FlipImageComponents,
+    );
+}
 extern "C" {
     pub fn flip_image_float_copy_float_to_color3(
         error_map: *mut FlipImageFloat,
@@ -91,6 +189,18 @@ extern "C" {
         bucket_id: usize,
     ) -> usize;
 }
+extern "C" {
+    pub fn flip_image_histogram_ref_get_bucket_values(
+        histogram: *const FlipImageHistogramRef,
+        values: *mut usize,
+    );
+}
+extern "C" {
+    pub fn flip_image_histogram_ref_get_bucket_edges(
+        histogram: *const FlipImageHistogramRef,
+        edges: *mut f32,
+    );
+}
 extern "C" {
     pub fn flip_image_histogram_ref_size(histogram: *const FlipImageHistogramRef) -> usize;
 }
@@ -139,6 +249,10 @@ extern "C" {
 extern "C" {
     pub fn flip_image_pool_get_histogram(pool: *mut FlipImagePool) -> *mut FlipImageHistogramRef;
 }
+extern "C" {
+    pub fn flip_image_pool_borrow_histogram(pool: *mut FlipImagePool)
+        -> *mut FlipImageHistogramRef;
+}
 extern "C" {
     pub fn flip_image_pool_get_min_value(pool: *const FlipImagePool) -> f32;
 }
@@ -164,9 +278,568 @@ extern "C" {
 extern "C" {
     pub fn flip_image_pool_update_image(pool: *mut FlipImagePool, image: *const FlipImageFloat);
 }
+extern "C" {
+    pub fn flip_image_pool_update_rows(
+        pool: *mut FlipImagePool,
+        image: *const FlipImageFloat,
+        y_begin: u32,
+        y_end: u32,
+    );
+}
 extern "C" {
     pub fn flip_image_pool_clear(pool: *mut FlipImagePool);
 }
 extern "C" {
     pub fn flip_image_pool_free(pool: *mut FlipImagePool);
 }
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct FlipImageBucketLayout {
+    _unused: [u8; 0],
+}
+extern "C" {
+    pub fn flip_image_bucket_layout_new_linear(buckets: usize) -> *mut FlipImageBucketLayout;
+}
+extern "C" {
+    pub fn flip_image_bucket_layout_new_logarithmic(
+        mantissa_bits: u32,
+        min_exponent: i32,
+    ) -> *mut FlipImageBucketLayout;
+}
+extern "C" {
+    pub fn flip_image_bucket_layout_new_adaptive(
+        buckets: usize,
+        training_image: *const FlipImageFloat,
+    ) -> *mut FlipImageBucketLayout;
+}
+extern "C" {
+    pub fn flip_image_bucket_layout_clone(
+        layout: *const FlipImageBucketLayout,
+    ) -> *mut FlipImageBucketLayout;
+}
+extern "C" {
+    pub fn flip_image_bucket_layout_size(layout: *const FlipImageBucketLayout) -> usize;
+}
+extern "C" {
+    pub fn flip_image_bucket_layout_value_bucket_id(
+        layout: *const FlipImageBucketLayout,
+        value: f32,
+    ) -> usize;
+}
+extern "C" {
+    pub fn flip_image_bucket_layout_get_edges(
+        layout: *const FlipImageBucketLayout,
+        edges: *mut f32,
+    );
+}
+extern "C" {
+    pub fn flip_image_bucket_layout_free(layout: *mut FlipImageBucketLayout);
+}
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct FlipImageBucketPool {
+    _unused: [u8; 0],
+}
+extern "C" {
+    pub fn flip_image_bucket_pool_new(
+        layout: *const FlipImageBucketLayout,
+    ) -> *mut FlipImageBucketPool;
+}
+extern "C" {
+    pub fn flip_image_bucket_pool_clone(
+        pool: *const FlipImageBucketPool,
+    ) -> *mut FlipImageBucketPool;
+}
+extern "C" {
+    pub fn flip_image_bucket_pool_size(pool: *const FlipImageBucketPool) -> usize;
+}
+extern "C" {
+    pub fn flip_image_bucket_pool_get_bucket_values(
+        pool: *const FlipImageBucketPool,
+        values: *mut f64,
+    );
+}
+extern "C" {
+    pub fn flip_image_bucket_pool_get_bucket_edges(
+        pool: *const FlipImageBucketPool,
+        edges: *mut f32,
+    );
+}
+extern "C" {
+    pub fn flip_image_bucket_pool_get_count(pool: *const FlipImageBucketPool) -> f64;
+}
+extern "C" {
+    pub fn flip_image_bucket_pool_get_min_value(pool: *const FlipImageBucketPool) -> f32;
+}
+extern "C" {
+    pub fn flip_image_bucket_pool_get_max_value(pool: *const FlipImageBucketPool) -> f32;
+}
+extern "C" {
+    pub fn flip_image_bucket_pool_get_mean(pool: *const FlipImageBucketPool) -> f32;
+}
+extern "C" {
+    pub fn flip_image_bucket_pool_get_percentile(
+        pool: *const FlipImageBucketPool,
+        percentile: f32,
+        weighted: bool,
+    ) -> f32;
+}
+extern "C" {
+    pub fn flip_image_bucket_pool_update_image(
+        pool: *mut FlipImageBucketPool,
+        image: *const FlipImageFloat,
+    );
+}
+extern "C" {
+    pub fn flip_image_bucket_pool_update_labeled_rows(
+        pools: *const *mut FlipImageBucketPool,
+        label_count: usize,
+        image: *const FlipImageFloat,
+        labels: *const u32,
+        y_begin: u32,
+        y_end: u32,
+    );
+}
+extern "C" {
+    pub fn flip_image_bucket_pool_merge(
+        pool: *mut FlipImageBucketPool,
+        other: *const FlipImageBucketPool,
+    ) -> bool;
+}
+extern "C" {
+    pub fn flip_image_bucket_pool_clear(pool: *mut FlipImageBucketPool);
+}
+extern "C" {
+    pub fn flip_image_bucket_pool_free(pool: *mut FlipImageBucketPool);
+}
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct FlipImageWindowedPool {
+    _unused: [u8; 0],
+}
+extern "C" {
+    pub fn flip_image_windowed_pool_new(
+        layout: *const FlipImageBucketLayout,
+        frames: usize,
+    ) -> *mut FlipImageWindowedPool;
+}
+extern "C" {
+    pub fn flip_image_windowed_pool_get_pool(
+        pool: *const FlipImageWindowedPool,
+    ) -> *const FlipImageBucketPool;
+}
+extern "C" {
+    pub fn flip_image_windowed_pool_get_window_size(pool: *const FlipImageWindowedPool) -> usize;
+}
+extern "C" {
+    pub fn flip_image_windowed_pool_get_frame_count(pool: *const FlipImageWindowedPool) -> usize;
+}
+extern "C" {
+    pub fn flip_image_windowed_pool_push_image(
+        pool: *mut FlipImageWindowedPool,
+        image: *const FlipImageFloat,
+    );
+}
+extern "C" {
+    pub fn flip_image_windowed_pool_clear(pool: *mut FlipImageWindowedPool);
+}
+extern "C" {
+    pub fn flip_image_windowed_pool_free(pool: *mut FlipImageWindowedPool);
+}
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct FlipImageDecayingPool {
+    _unused: [u8; 0],
+}
+extern "C" {
+    pub fn flip_image_decaying_pool_new(
+        layout: *const FlipImageBucketLayout,
+        decay: f64,
+    ) -> *mut FlipImageDecayingPool;
+}
+extern "C" {
+    pub fn flip_image_decaying_pool_get_decay(pool: *const FlipImageDecayingPool) -> f64;
+}
+extern "C" {
+    pub fn flip_image_decaying_pool_size(pool: *const FlipImageDecayingPool) -> usize;
+}
+extern "C" {
+    pub fn flip_image_decaying_pool_get_bucket_values(
+        pool: *const FlipImageDecayingPool,
+        values: *mut f64,
+    );
+}
+extern "C" {
+    pub fn flip_image_decaying_pool_get_count(pool: *const FlipImageDecayingPool) -> f64;
+}
+extern "C" {
+    pub fn flip_image_decaying_pool_get_min_value(pool: *const FlipImageDecayingPool) -> f32;
+}
+extern "C" {
+    pub fn flip_image_decaying_pool_get_max_value(pool: *const FlipImageDecayingPool) -> f32;
+}
+extern "C" {
+    pub fn flip_image_decaying_pool_get_mean(pool: *const FlipImageDecayingPool) -> f32;
+}
+extern "C" {
+    pub fn flip_image_decaying_pool_get_percentile(
+        pool: *const FlipImageDecayingPool,
+        percentile: f32,
+        weighted: bool,
+    ) -> f32;
+}
+extern "C" {
+    pub fn flip_image_decaying_pool_update_image(
+        pool: *mut FlipImageDecayingPool,
+        image: *const FlipImageFloat,
+    );
+}
+extern "C" {
+    pub fn flip_image_decaying_pool_clear(pool: *mut FlipImageDecayingPool);
+}
+extern "C" {
+    pub fn flip_image_decaying_pool_free(pool: *mut FlipImageDecayingPool);
+}
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct FlipImageConcurrentPool {
+    _unused: [u8; 0],
+}
+extern "C" {
+    pub fn flip_image_concurrent_pool_new(
+        layout: *const FlipImageBucketLayout,
+        shards: usize,
+    ) -> *mut FlipImageConcurrentPool;
+}
+extern "C" {
+    pub fn flip_image_concurrent_pool_update_image(
+        pool: *mut FlipImageConcurrentPool,
+        image: *const FlipImageFloat,
+    );
+}
+extern "C" {
+    pub fn flip_image_concurrent_pool_update_values(
+        pool: *mut FlipImageConcurrentPool,
+        values: *const f32,
+        count: usize,
+    );
+}
+extern "C" {
+    pub fn flip_image_concurrent_pool_snapshot(
+        pool: *const FlipImageConcurrentPool,
+    ) -> *mut FlipImageBucketPool;
+}
+extern "C" {
+    pub fn flip_image_concurrent_pool_clear(pool: *mut FlipImageConcurrentPool);
+}
+extern "C" {
+    pub fn flip_image_concurrent_pool_free(pool: *mut FlipImageConcurrentPool);
+}
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct FlipImageStatistics {
+    pub mean: f32,
+    pub weighted_median: f32,
+    pub first_weighted_quartile: f32,
+    pub third_weighted_quartile: f32,
+    pub min_value: f32,
+    pub max_value: f32,
+}
+#[test]
+fn bindgen_test_layout_FlipImageStatistics() {
+    const UNINIT: ::std::mem::MaybeUninit<FlipImageStatistics> = ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<FlipImageStatistics>(),
+        24usize,
+        concat!("Size of: ", stringify!(FlipImageStatistics))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<FlipImageStatistics>(),
+        4usize,
+        concat!("Alignment of ", stringify!(FlipImageStatistics))
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).mean) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(FlipImageStatistics),
+            "::",
+            stringify!(mean)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).weighted_median) as usize - ptr as usize },
+        4usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(FlipImageStatistics),
+            "::",
+            stringify!(weighted_median)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).first_weighted_quartile) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(FlipImageStatistics),
+            "::",
+            stringify!(first_weighted_quartile)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).third_weighted_quartile) as usize - ptr as usize },
+        12usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(FlipImageStatistics),
+            "::",
+            stringify!(third_weighted_quartile)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).min_value) as usize - ptr as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(FlipImageStatistics),
+            "::",
+            stringify!(min_value)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).max_value) as usize - ptr as usize },
+        20usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(FlipImageStatistics),
+            "::",
+            stringify!(max_value)
+        )
+    );
+}
+extern "C" {
+    pub fn flip_image_statistics_from_rgb8(
+        width: u32,
+        height: u32,
+        reference_data: *const u8,
+        test_data: *const u8,
+        pixels_per_degree: f32,
+        statistics: *mut FlipImageStatistics,
+    );
+}
+extern "C" {
+    pub fn flip_image_mean_from_rgb8(
+        width: u32,
+        height: u32,
+        reference_data: *const u8,
+        test_data: *const u8,
+        pixels_per_degree: f32,
+    ) -> f32;
+}
+extern "C" {
+    pub fn flip_image_release_workspace();
+}
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct FlipImageSampledMean {
+    pub mean: f32,
+    pub standard_error: f32,
+    pub lower: f32,
+    pub upper: f32,
+    pub sample_count: u64,
+}
+#[test]
+fn bindgen_test_layout_FlipImageSampledMean() {
+    const UNINIT: ::std::mem::MaybeUninit<FlipImageSampledMean> = ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<FlipImageSampledMean>(),
+        24usize,
+        concat!("Size of: ", stringify!(FlipImageSampledMean))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<FlipImageSampledMean>(),
+        8usize,
+        concat!("Alignment of ", stringify!(FlipImageSampledMean))
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).mean) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(FlipImageSampledMean),
+            "::",
+            stringify!(mean)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).standard_error) as usize - ptr as usize },
+        4usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(FlipImageSampledMean),
+            "::",
+            stringify!(standard_error)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).lower) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(FlipImageSampledMean),
+            "::",
+            stringify!(lower)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).upper) as usize - ptr as usize },
+        12usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(FlipImageSampledMean),
+            "::",
+            stringify!(upper)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).sample_count) as usize - ptr as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(FlipImageSampledMean),
+            "::",
+            stringify!(sample_count)
+        )
+    );
+}
+extern "C" {
+    pub fn flip_image_sampled_mean_from_rgb8(
+        width: u32,
+        height: u32,
+        reference_data: *const u8,
+        test_data: *const u8,
+        pixels_per_degree: f32,
+        sample_count: usize,
+        seed: u64,
+        mean: *mut FlipImageSampledMean,
+    );
+}
+extern "C" {
+    pub fn flip_image_budgeted_mean_from_rgb8(
+        width: u32,
+        height: u32,
+        reference_data: *const u8,
+        test_data: *const u8,
+        pixels_per_degree: f32,
+        budget_seconds: f64,
+        seed: u64,
+        mean: *mut FlipImageSampledMean,
+    );
+}
+extern "C" {
+    pub fn flip_image_float_flip_guided_rgb8(
+        error_map: *mut FlipImageFloat,
+        reference_data: *const u8,
+        test_data: *const u8,
+        pixels_per_degree: f32,
+    ) -> usize;
+}
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct FlipImageStream {
+    _unused: [u8; 0],
+}
+extern "C" {
+    pub fn flip_image_stream_new(width: u32, pixels_per_degree: f32) -> *mut FlipImageStream;
+}
+extern "C" {
+    pub fn flip_image_stream_push_rows(
+        stream: *mut FlipImageStream,
+        rows: u32,
+        reference_data: *const u8,
+        test_data: *const u8,
+    ) -> u32;
+}
+extern "C" {
+    pub fn flip_image_stream_finish(stream: *mut FlipImageStream) -> u32;
+}
+extern "C" {
+    pub fn flip_image_stream_ready_rows(stream: *const FlipImageStream) -> u32;
+}
+extern "C" {
+    pub fn flip_image_stream_take_rows(stream: *mut FlipImageStream, values: *mut f32);
+}
+extern "C" {
+    pub fn flip_image_stream_free(stream: *mut FlipImageStream);
+}
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct FlipImageTaskGraph {
+    _unused: [u8; 0],
+}
+extern "C" {
+    pub fn flip_image_task_graph_new(
+        error_map: *mut FlipImageFloat,
+        reference_data: *const u8,
+        test_data: *const u8,
+        pixels_per_degree: f32,
+        band_rows: u32,
+    ) -> *mut FlipImageTaskGraph;
+}
+extern "C" {
+    pub fn flip_image_task_graph_task_count(graph: *const FlipImageTaskGraph) -> usize;
+}
+extern "C" {
+    pub fn flip_image_task_graph_get_ready_tasks(
+        graph: *mut FlipImageTaskGraph,
+        tasks: *mut u32,
+        capacity: usize,
+    ) -> usize;
+}
+extern "C" {
+    pub fn flip_image_task_graph_run_task(graph: *mut FlipImageTaskGraph, task: u32) -> bool;
+}
+extern "C" {
+    pub fn flip_image_task_graph_mark_done(graph: *mut FlipImageTaskGraph, task: u32) -> bool;
+}
+extern "C" {
+    pub fn flip_image_task_graph_is_done(graph: *mut FlipImageTaskGraph) -> bool;
+}
+extern "C" {
+    pub fn flip_image_task_graph_free(graph: *mut FlipImageTaskGraph);
+}
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct FlipImageCancelToken {
+    _unused: [u8; 0],
+}
+extern "C" {
+    pub fn flip_image_cancel_token_new() -> *mut FlipImageCancelToken;
+}
+extern "C" {
+    pub fn flip_image_cancel_token_cancel(token: *mut FlipImageCancelToken);
+}
+extern "C" {
+    pub fn flip_image_cancel_token_is_cancelled(token: *const FlipImageCancelToken) -> bool;
+}
+extern "C" {
+    pub fn flip_image_cancel_token_free(token: *mut FlipImageCancelToken);
+}
+pub type FlipImageProgressCallback = ::std::option::Option<
+    unsafe extern "C" fn(user_data: *mut ::std::os::raw::c_void, progress: f32) -> bool,
+>;
+extern "C" {
+    pub fn flip_image_float_flip_rgb8_cancellable(
+        error_map: *mut FlipImageFloat,
+        reference_data: *const u8,
+        test_data: *const u8,
+        pixels_per_degree: f32,
+        token: *const FlipImageCancelToken,
+        progress: FlipImageProgressCallback,
+        user_data: *mut ::std::os::raw::c_void,
+    ) -> bool;
+}
@@ -0,0 +1,720 @@
+#pragma once
+
+// Histogram based pooling with configurable bucket layouts.
+//
+// FLIP's own histogram only supports linear buckets, which need thousands of buckets
+// to resolve the tail of an error map with mostly small errors. The layouts here map
+// a value to its bucket in O(1) and resolve small values with a few hundred buckets.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <functional>
+#include <memory>
+#include <new>
+#include <thread>
+#include <vector>
+
+// Bulk bucketing uses SSE2 where it is part of the target, everywhere else the scalar
+// loops are simple enough for the compiler to vectorize.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BUCKETING_SSE2 1
+#endif
+
+class BucketLayout {
+public:
+    enum Kind : uint32_t {
+        Linear = 0,
+        Logarithmic = 1,
+        Adaptive = 2,
+    };
+
+    // `buckets` buckets of equal width over [0, 1].
+    static BucketLayout linear(size_t buckets) {
+        BucketLayout layout(Linear);
+        buckets = std::max<size_t>(buckets, 1);
+        layout.mScale = float(buckets);
+        layout.mEdges.resize(buckets + 1);
+        for (size_t i = 0; i <= buckets; i++) {
+            layout.mEdges[i] = float(i) / float(buckets);
+        }
+        return layout;
+    }
+
+    // 2^mantissa_bits buckets per power of two between 2^min_exponent and 1, plus one bucket
+    // for [0, 2^min_exponent). The bucket is read straight out of the bits of the float.
+    static BucketLayout logarithmic(uint32_t mantissa_bits, int32_t min_exponent) {
+        BucketLayout layout(Logarithmic);
+        layout.mMantissaBits = std::min<uint32_t>(mantissa_bits, 16);
+        layout.mMinExponent = std::min<int32_t>(std::max<int32_t>(min_exponent, -126), -1);
+        size_t per_octave = size_t(1) << layout.mMantissaBits;
+        size_t octaves = size_t(-layout.mMinExponent);
+        layout.mEdges.resize(1 + octaves * per_octave + 1);
+        layout.mEdges[0] = 0.0f;
+        for (size_t octave = 0; octave < octaves; octave++) {
+            float base = std::ldexp(1.0f, layout.mMinExponent + int32_t(octave));
+            for (size_t step = 0; step < per_octave; step++) {
+                layout.mEdges[1 + octave * per_octave + step] = base * (1.0f + float(step) / float(per_octave));
+            }
+        }
+        layout.mEdges.back() = 1.0f;
+        return layout;
+    }
+
+    // Up to `buckets` buckets refined to the distribution of `values`, usually the error map of
+    // a representative comparison. Bucket edges are snapped to a fine logarithmic grid, so lookup
+    // stays O(1) through a table from fine to coarse buckets.
+    static BucketLayout adaptive(size_t buckets, float const* values, size_t count) {
+        BucketLayout fine = logarithmic(AdaptiveMantissaBits, AdaptiveMinExponent);
+        size_t fine_buckets = fine.size();
+        buckets = std::min(std::max<size_t>(buckets, 1), size_t(std::numeric_limits<uint16_t>::max()));
+
+        std::vector<double> mass(fine_buckets, 0.0);
+        for (size_t i = 0; i < count; i++) {
+            mass[fine.bucketId(values[i])] += 1.0;
+        }
+
+        // Edges are equally spaced in a mix of the training CDF, its tail over four decades
+        // and the fine grid itself. Dense and tail regions of the training data get most of
+        // the buckets while every range keeps some resolution for data that looks different.
+        BucketLayout layout(Adaptive);
+        layout.mFine.reset(new BucketLayout(fine));
+        layout.mFineToBucket.resize(fine_buckets);
+        double cumulative = 0.0;
+        size_t previous = std::numeric_limits<size_t>::max();
+        uint16_t bucket = 0;
+        for (size_t i = 0; i < fine_buckets; i++) {
+            double cdf = count ? cumulative / double(count) : 0.0;
+            double tail = std::min(1.0, -std::log10(std::max(1.0 - cdf, 1e-4)) / 4.0);
+            double grid = double(i) / double(fine_buckets);
+            double position = (cdf + tail + grid) / 3.0;
+            size_t target = std::min(buckets - 1, size_t(position * double(buckets)));
+            if (target != previous) {
+                if (previous != std::numeric_limits<size_t>::max()) {
+                    bucket++;
+                }
+                layout.mEdges.push_back(fine.edge(i));
+                previous = target;
+            }
+            layout.mFineToBucket[i] = bucket;
+            cumulative += mass[i];
+        }
+        layout.mEdges.push_back(1.0f);
+        return layout;
+    }
+
+    BucketLayout(BucketLayout const& other)
+        : mKind(other.mKind)
+        , mScale(other.mScale)
+        , mMantissaBits(other.mMantissaBits)
+        , mMinExponent(other.mMinExponent)
+        , mEdges(other.mEdges)
+        , mFineToBucket(other.mFineToBucket)
+        , mFine(other.mFine ? new BucketLayout(*other.mFine) : nullptr) {}
+    BucketLayout(BucketLayout&&) = default;
+
+    Kind kind() const { return mKind; }
+    size_t size() const { return mEdges.size() - 1; }
+    // Bucket i covers [edge(i), edge(i + 1)), the last bucket also includes 1.0.
+    float edge(size_t i) const { return mEdges[i]; }
+    float const* edges() const { return mEdges.data(); }
+
+    // Layouts of the same kind with the same edges bucket every value the same way, adaptive
+    // layouts included since their edges lie on the same fine grid.
+    bool operator==(BucketLayout const& other) const { return mKind == other.mKind && mEdges == other.mEdges; }
+
+    // Values outside of [0, 1] are clamped into the first or last bucket.
+    size_t bucketId(float value) const {
+        switch (mKind) {
+        case Linear:
+            return linearBucketId(value);
+        case Logarithmic:
+            return logarithmicBucketId(value);
+        default:
+            return mFineToBucket[mFine->logarithmicBucketId(value)];
+        }
+    }
+
+    // bucketId of `count` values at once.
+    void bucketIds(float const* values, size_t count, uint32_t* ids) const {
+        switch (mKind) {
+        case Linear:
+            linearBucketIds(values, count, ids);
+            break;
+        case Logarithmic:
+            logarithmicBucketIds(values, count, ids);
+            break;
+        default:
+            mFine->logarithmicBucketIds(values, count, ids);
+            for (size_t i = 0; i < count; i++) {
+                ids[i] = mFineToBucket[ids[i]];
+            }
+            break;
+        }
+    }
+
+    // Representative value of a bucket, used to weight percentiles.
+    float center(size_t i) const { return 0.5f * (mEdges[i] + mEdges[i + 1]); }
+
+private:
+    static constexpr uint32_t AdaptiveMantissaBits = 7;
+    static constexpr int32_t AdaptiveMinExponent = -20;
+
+    explicit BucketLayout(Kind kind) : mKind(kind) {}
+
+    size_t linearBucketId(float value) const {
+        // Negated comparison also sends NaN to the first bucket.
+        if (!(value > 0.0f)) {
+            return 0;
+        }
+        // Clamping before the conversion keeps infinity in range.
+        return size_t(std::min(value * mScale, float(size() - 1)));
+    }
+
+    void linearBucketIds(float const* values, size_t count, uint32_t* ids) const {
+        size_t i = 0;
+#if BUCKETING_SSE2
+        __m128 scale = _mm_set1_ps(mScale);
+        __m128 zero = _mm_setzero_ps();
+        __m128 last = _mm_set1_ps(float(size() - 1));
+        for (; i + 4 <= count; i += 4) {
+            // max_ps returns its second operand if either is NaN, so NaN also lands in the first bucket.
+            __m128 scaled = _mm_max_ps(_mm_mul_ps(_mm_loadu_ps(values + i), scale), zero);
+            __m128i id = _mm_cvttps_epi32(_mm_min_ps(scaled, last));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(ids + i), id);
+        }
+#endif
+        for (; i < count; i++) {
+            ids[i] = uint32_t(linearBucketId(values[i]));
+        }
+    }
+
+    size_t logarithmicBucketId(float value) const {
+        // Negated comparison also sends NaN to the first bucket.
+        if (!(value > 0.0f)) {
+            return 0;
+        }
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        int32_t exponent = int32_t(bits >> 23) - 127;
+        if (exponent < mMinExponent) {
+            return 0;
+        }
+        if (exponent >= 0) {
+            return size() - 1;
+        }
+        uint32_t mantissa = (bits & 0x7fffff) >> (23 - mMantissaBits);
+        return 1 + (size_t(exponent - mMinExponent) << mMantissaBits) + mantissa;
+    }
+
+    void logarithmicBucketIds(float const* values, size_t count, uint32_t* ids) const {
+        size_t i = 0;
+#if BUCKETING_SSE2
+        // For positive values the bucket is the bits shifted right minus a constant, smaller and
+        // larger exponents fall below 0 or above the last bucket. SSE2 has no 32 bit integer
+        // min or max, so those are clamped with compares and masks.
+        __m128i shift = _mm_cvtsi32_si128(int(23 - mMantissaBits));
+        __m128i offset = _mm_set1_epi32(((127 + mMinExponent) << mMantissaBits) - 1);
+        __m128i last = _mm_set1_epi32(int32_t(size() - 1));
+        __m128i zero = _mm_setzero_si128();
+        for (; i + 4 <= count; i += 4) {
+            __m128 value = _mm_loadu_ps(values + i);
+            __m128i id = _mm_sub_epi32(_mm_srl_epi32(_mm_castps_si128(value), shift), offset);
+            // Compares false for NaN, which goes to the first bucket like non-positive values.
+            id = _mm_and_si128(id, _mm_castps_si128(_mm_cmpgt_ps(value, _mm_setzero_ps())));
+            id = _mm_andnot_si128(_mm_cmplt_epi32(id, zero), id);
+            __m128i above = _mm_cmpgt_epi32(id, last);
+            id = _mm_or_si128(_mm_and_si128(above, last), _mm_andnot_si128(above, id));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(ids + i), id);
+        }
+#endif
+        for (; i < count; i++) {
+            ids[i] = uint32_t(logarithmicBucketId(values[i]));
+        }
+    }
+
+    Kind mKind;
+    float mScale = 0.0f;
+    uint32_t mMantissaBits = 0;
+    int32_t mMinExponent = 0;
+    std::vector<float> mEdges;
+    std::vector<uint16_t> mFineToBucket;
+    std::unique_ptr<BucketLayout> mFine;
+};
+
+// Bucket ids of FLIP's linear histogram over [0, max_value], which divides by the bucket size.
+// Values outside of it, NaN included, get the id `size`.
+inline void dividedBucketIds(float const* values, size_t count, float max_value, float bucket_size, uint32_t size, uint32_t* ids) {
+    float last = float(size - 1);
+    size_t i = 0;
+#if BUCKETING_SSE2
+    __m128 zero = _mm_setzero_ps();
+    __m128 max = _mm_set1_ps(max_value);
+    __m128 divisor = _mm_set1_ps(bucket_size);
+    __m128 clamp = _mm_set1_ps(last);
+    __m128i outside = _mm_set1_epi32(int32_t(size));
+    for (; i + 4 <= count; i += 4) {
+        __m128 value = _mm_loadu_ps(values + i);
+        __m128i inside = _mm_castps_si128(_mm_and_ps(_mm_cmpge_ps(value, zero), _mm_cmple_ps(value, max)));
+        __m128i id = _mm_cvttps_epi32(_mm_min_ps(_mm_div_ps(value, divisor), clamp));
+        id = _mm_or_si128(_mm_and_si128(inside, id), _mm_andnot_si128(inside, outside));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(ids + i), id);
+    }
+#endif
+    for (; i < count; i++) {
+        float value = values[i];
+        ids[i] = value >= 0.0f && value <= max_value ? uint32_t(std::min(value / bucket_size, last)) : size;
+    }
+}
+
+// Scratch counters of countBuckets, all zero between calls.
+inline std::vector<uint32_t>& bucketCounterScratch() {
+    static thread_local std::vector<uint32_t> counts;
+    return counts;
+}
+
+// Counts `count` values into `buckets` buckets and calls add(bucket_id, count) for every non-empty
+// one. bucket_ids(values, n, ids) computes the ids of a block of values at once, which keeps the
+// bucketing vectorized. The ids are then counted into four interleaved sub-histograms, so that
+// runs of equal ids - most of an error map - don't wait on the increment of the same counter.
+template<typename BucketIds, typename Add>
+void countBuckets(size_t buckets, float const* values, size_t count, BucketIds const& bucket_ids, Add const& add) {
+    constexpr size_t Lanes = 4;
+    constexpr size_t BlockSize = 256;
+    // Keeps the 32 bit counters from overflowing.
+    constexpr size_t FlushSize = size_t(1) << 31;
+
+    std::vector<uint32_t>& counts = bucketCounterScratch();
+    if (counts.size() < Lanes * buckets) {
+        counts.resize(Lanes * buckets, 0);
+    }
+    uint32_t* lanes[Lanes] = { counts.data(), counts.data() + buckets, counts.data() + 2 * buckets, counts.data() + 3 * buckets };
+    uint32_t ids[BlockSize];
+    for (size_t flush_begin = 0; flush_begin < count; flush_begin += FlushSize) {
+        size_t flush_end = std::min(count, flush_begin + FlushSize);
+        for (size_t begin = flush_begin; begin < flush_end; begin += BlockSize) {
+            size_t size = std::min(BlockSize, flush_end - begin);
+            bucket_ids(values + begin, size, ids);
+            size_t i = 0;
+            for (; i + Lanes <= size; i += Lanes) {
+                lanes[0][ids[i]]++;
+                lanes[1][ids[i + 1]]++;
+                lanes[2][ids[i + 2]]++;
+                lanes[3][ids[i + 3]]++;
+            }
+            for (; i < size; i++) {
+                lanes[0][ids[i]]++;
+            }
+        }
+        for (size_t bucket_id = 0; bucket_id < buckets; bucket_id++) {
+            uint64_t total = uint64_t(lanes[0][bucket_id]) + lanes[1][bucket_id] + lanes[2][bucket_id] + lanes[3][bucket_id];
+            if (total) {
+                add(bucket_id, total);
+                for (uint32_t* lane : lanes) {
+                    lane[bucket_id] = 0;
+                }
+            }
+        }
+    }
+}
+
+// Counts, moments and extrema of the pooled values. Counts are doubles so that
+// pools can weight or scale them.
+class BucketPool {
+public:
+    explicit BucketPool(BucketLayout layout) : mLayout(std::move(layout)), mBuckets(mLayout.size(), 0.0) { clear(); }
+
+    BucketLayout const& getLayout() const { return mLayout; }
+    size_t size() const { return mBuckets.size(); }
+    double getBucketValue(size_t bucket_id) const { return mBuckets[bucket_id]; }
+    double getCount() const { return mCount; }
+    float getMinValue() const { return mMinValue; }
+    float getMaxValue() const { return mMaxValue; }
+    double getMean() const { return mCount > 0.0 ? mSum / mCount : 0.0; }
+    double getVariance() const {
+        if (mCount <= 0.0) {
+            return 0.0;
+        }
+        double mean = getMean();
+        return std::max(0.0, mSquareSum / mCount - mean * mean);
+    }
+
+    void update(float value, double weight = 1.0) {
+        mBuckets[mLayout.bucketId(value)] += weight;
+        mCount += weight;
+        mSum += double(value) * weight;
+        mSquareSum += double(value) * double(value) * weight;
+        mMinValue = std::min(mMinValue, value);
+        mMaxValue = std::max(mMaxValue, value);
+    }
+
+    // Same as updating with every value in turn, but buckets them in bulk.
+    void update(float const* values, size_t count, double weight = 1.0) {
+        countBuckets(
+            mBuckets.size(), values, count,
+            [&](float const* block, size_t size, uint32_t* ids) { mLayout.bucketIds(block, size, ids); },
+            [&](size_t bucket_id, uint64_t bucket_count) { mBuckets[bucket_id] += double(bucket_count) * weight; });
+        double sum = 0.0;
+        double square_sum = 0.0;
+        for (size_t i = 0; i < count; i++) {
+            sum += double(values[i]);
+            square_sum += double(values[i]) * double(values[i]);
+            mMinValue = std::min(mMinValue, values[i]);
+            mMaxValue = std::max(mMaxValue, values[i]);
+        }
+        mCount += double(count) * weight;
+        mSum += sum * weight;
+        mSquareSum += square_sum * weight;
+    }
+
+    // Percentile [0, 1] of the pooled values, interpolated linearly inside the bucket.
+    // If `weighted`, every value is weighted by itself, like pooling<T>::getPercentile.
+    double getPercentile(double percentile, bool weighted) const {
+        if (mCount <= 0.0) {
+            return 0.0;
+        }
+        percentile = std::min(std::max(percentile, 0.0), 1.0);
+        double total = 0.0;
+        for (size_t i = 0; i < mBuckets.size(); i++) {
+            total += bucketMass(i, weighted);
+        }
+        double target = percentile * total;
+        double cumulative = 0.0;
+        for (size_t i = 0; i < mBuckets.size(); i++) {
+            double mass = bucketMass(i, weighted);
+            if (mass <= 0.0) {
+                continue;
+            }
+            if (cumulative + mass >= target) {
+                double low = std::max(double(mLayout.edge(i)), double(mMinValue));
+                double high = std::min(double(mLayout.edge(i + 1)), double(mMaxValue));
+                double fraction = (target - cumulative) / mass;
+                return low + std::max(0.0, high - low) * fraction;
+            }
+            cumulative += mass;
+        }
+        return mMaxValue;
+    }
+
+    // Adds (sign = 1) or removes (sign = -1) the bucket counts of a pool with the same layout.
+    // Moments and extrema are left alone, see combineMoments.
+    void accumulateBuckets(BucketPool const& other, double sign) {
+        for (size_t i = 0; i < mBuckets.size(); i++) {
+            mBuckets[i] += sign * other.mBuckets[i];
+        }
+    }
+
+    // Adds the contents of a pool with the same layout. Returns false and leaves the pool as is
+    // if the layouts differ.
+    bool merge(BucketPool const& other) {
+        if (!(mLayout == other.mLayout)) {
+            return false;
+        }
+        accumulateBuckets(other, 1.0);
+        mCount += other.mCount;
+        mSum += other.mSum;
+        mSquareSum += other.mSquareSum;
+        mMinValue = std::min(mMinValue, other.mMinValue);
+        mMaxValue = std::max(mMaxValue, other.mMaxValue);
+        return true;
+    }
+
+    // Multiplies all counts and moments by `factor`, extrema are unaffected.
+    void scale(double factor) {
+        for (double& bucket : mBuckets) {
+            bucket *= factor;
+        }
+        mCount *= factor;
+        mSum *= factor;
+        mSquareSum *= factor;
+    }
+
+    // Replaces moments and extrema by those of the first `count` pools combined.
+    void combineMoments(BucketPool const* pools, size_t count) {
+        mCount = 0.0;
+        mSum = 0.0;
+        mSquareSum = 0.0;
+        mMinValue = std::numeric_limits<float>::max();
+        mMaxValue = std::numeric_limits<float>::lowest();
+        for (size_t i = 0; i < count; i++) {
+            mCount += pools[i].mCount;
+            mSum += pools[i].mSum;
+            mSquareSum += pools[i].mSquareSum;
+            mMinValue = std::min(mMinValue, pools[i].mMinValue);
+            mMaxValue = std::max(mMaxValue, pools[i].mMaxValue);
+        }
+    }
+
+    void clear() {
+        std::fill(mBuckets.begin(), mBuckets.end(), 0.0);
+        mCount = 0.0;
+        mSum = 0.0;
+        mSquareSum = 0.0;
+        mMinValue = std::numeric_limits<float>::max();
+        mMaxValue = std::numeric_limits<float>::lowest();
+    }
+
+private:
+    friend class ConcurrentBucketPool;
+
+    double bucketMass(size_t i, bool weighted) const {
+        return weighted ? mBuckets[i] * mLayout.center(i) : mBuckets[i];
+    }
+
+    BucketLayout mLayout;
+    std::vector<double> mBuckets;
+    double mCount;
+    double mSum;
+    double mSquareSum;
+    float mMinValue;
+    float mMaxValue;
+};
+
+// Ring of per-frame pools whose sum is kept in a separate total pool.
+//
+// Pushing a frame removes the evicted frame's buckets from the total and adds the new
+// ones, so aggregating costs O(buckets) rather than O(pixels * frames). Moments are
+// recombined from the frames, O(frames), so that no rounding error builds up in them.
+class BucketPoolWindow {
+public:
+    BucketPoolWindow(BucketLayout const& layout, size_t frames)
+        : mFrames(std::max<size_t>(frames, 1), BucketPool(layout)) {}
+
+    size_t getWindowSize() const { return mFrames.size(); }
+    size_t getFrameCount() const { return mFilled; }
+
+    // Evicts the oldest frame from `total` if the window is full, and returns the
+    // cleared pool to fill with the next frame.
+    BucketPool& beginFrame(BucketPool& total) {
+        BucketPool& frame = mFrames[mNext];
+        if (mFilled == mFrames.size()) {
+            total.accumulateBuckets(frame, -1.0);
+        }
+        frame.clear();
+        return frame;
+    }
+
+    // Adds the frame returned by beginFrame to `total`.
+    void endFrame(BucketPool& total) {
+        total.accumulateBuckets(mFrames[mNext], 1.0);
+        mNext = (mNext + 1) % mFrames.size();
+        mFilled = std::min(mFilled + 1, mFrames.size());
+        // The filled frames are always the first mFilled ones, the ring only wraps once full.
+        total.combineMoments(mFrames.data(), mFilled);
+    }
+
+    void clear(BucketPool& total) {
+        for (BucketPool& frame : mFrames) {
+            frame.clear();
+        }
+        total.clear();
+        mNext = 0;
+        mFilled = 0;
+    }
+
+private:
+    std::vector<BucketPool> mFrames;
+    size_t mNext = 0;
+    size_t mFilled = 0;
+};
+
+// Pool whose contents are multiplied by a constant decay factor on every update.
+//
+// Rather than scaling every bucket on each update, values are added with weight 1 / scale,
+// scale being the product of all decay factors so far. Mean and percentiles don't depend
+// on the scale, counts are multiplied by it when read. The stored counts are only rescaled
+// once the weights grow large, so decay costs nothing per value.
+class DecayingBucketPool {
+public:
+    DecayingBucketPool(BucketLayout const& layout, double decay)
+        : mPool(layout), mDecay(std::min(decay, 1.0)) {}
+
+    // Counts are relative to the scale, everything else can be read as is.
+    BucketPool const& getPool() const { return mPool; }
+    double getDecay() const { return mDecay; }
+    double getCount() const { return mPool.getCount() * mScale; }
+    double getBucketValue(size_t bucket_id) const { return mPool.getBucketValue(bucket_id) * mScale; }
+
+    // Extrema of the values that haven't decayed away, to the precision of their buckets. The
+    // extrema ever added stay forever, since weights never quite reach 0, so they only tighten
+    // the edges of the lowest and highest buckets whose weight is still above ForgottenWeight.
+    float getMinValue() const {
+        for (size_t i = 0; i < mPool.size(); i++) {
+            if (getBucketValue(i) >= ForgottenWeight) {
+                return i == 0 ? mPool.getMinValue() : std::max(mPool.getLayout().edge(i), mPool.getMinValue());
+            }
+        }
+        return mPool.getMinValue();
+    }
+    float getMaxValue() const {
+        for (size_t i = mPool.size(); i-- > 0;) {
+            if (getBucketValue(i) >= ForgottenWeight) {
+                return i + 1 == mPool.size() ? mPool.getMaxValue() : std::min(mPool.getLayout().edge(i + 1), mPool.getMaxValue());
+            }
+        }
+        return mPool.getMaxValue();
+    }
+
+    // Decays the current contents and returns the weight to add the values of this update with.
+    double beginUpdate() {
+        if (!(mDecay > 0.0)) {
+            mPool.clear();
+            return 1.0;
+        }
+        mScale *= mDecay;
+        if (mScale < RescaleThreshold) {
+            mPool.scale(mScale);
+            mScale = 1.0;
+        }
+        return 1.0 / mScale;
+    }
+
+    void update(float value, double weight) { mPool.update(value, weight); }
+    void update(float const* values, size_t count, double weight) { mPool.update(values, count, weight); }
+
+    void clear() {
+        mPool.clear();
+        mScale = 1.0;
+    }
+
+private:
+    // 2^-64, leaves plenty of headroom in the double precision counts.
+    static constexpr double RescaleThreshold = 5.421010862427522e-20;
+    // 2^-24, a value weighted less than this relative to a fresh one is below float precision.
+    static constexpr double ForgottenWeight = 5.9604644775390625e-08;
+
+    BucketPool mPool;
+    double mDecay;
+    double mScale = 1.0;
+};
+
+// Pool that can be updated from any number of threads at once without locks.
+//
+// Every update counts its values into thread local counters and moments first, then
+// publishes them with atomic adds into one of several shards, picked by thread, so threads
+// rarely contend on the same cache line. Moments are kept as doubles per shard, like the
+// serial pool, and only summed when reading. Reading merges all shards into a regular
+// BucketPool.
+class ConcurrentBucketPool {
+public:
+    ConcurrentBucketPool(BucketLayout const& layout, size_t shards)
+        : mLayout(layout)
+        , mShards(shards ? shards : std::max(1u, std::thread::hardware_concurrency()))
+        // Pad every shard to a whole number of cache lines, the allocation starts on one.
+        , mShardStride((layout.size() + 7) & ~size_t(7))
+        , mCounts(allocateCounts(mShards * mShardStride))
+        , mMoments(new ShardMoments[mShards]) {
+        clear();
+    }
+
+    BucketLayout const& getLayout() const { return mLayout; }
+
+    // May be called concurrently with other updates and snapshots.
+    void update(float const* values, size_t count) {
+        if (count == 0) {
+            return;
+        }
+        size_t shard = std::hash<std::thread::id>{}(std::this_thread::get_id()) % mShards;
+        std::atomic<uint64_t>* counts = &mCounts[shard * mShardStride];
+        countBuckets(
+            mLayout.size(), values, count,
+            [&](float const* block, size_t size, uint32_t* ids) { mLayout.bucketIds(block, size, ids); },
+            [&](size_t bucket_id, uint64_t bucket_count) { counts[bucket_id].fetch_add(bucket_count, std::memory_order_relaxed); });
+
+        double sum = 0.0;
+        double square_sum = 0.0;
+        float min_value = std::numeric_limits<float>::max();
+        float max_value = std::numeric_limits<float>::lowest();
+        for (size_t i = 0; i < count; i++) {
+            sum += double(values[i]);
+            square_sum += double(values[i]) * double(values[i]);
+            min_value = std::min(min_value, values[i]);
+            max_value = std::max(max_value, values[i]);
+        }
+        ShardMoments& moments = mMoments[shard];
+        moments.count.fetch_add(count, std::memory_order_relaxed);
+        atomicAdd(moments.sum, sum);
+        atomicAdd(moments.squareSum, square_sum);
+        atomicMin(moments.minValue, min_value);
+        atomicMax(moments.maxValue, max_value);
+    }
+
+    // Merges all shards. Updates racing with the snapshot may be partially included.
+    BucketPool snapshot() const {
+        BucketPool pool(mLayout);
+        for (size_t shard = 0; shard < mShards; shard++) {
+            for (size_t i = 0; i < mLayout.size(); i++) {
+                pool.mBuckets[i] += double(mCounts[shard * mShardStride + i].load(std::memory_order_relaxed));
+            }
+            ShardMoments const& moments = mMoments[shard];
+            pool.mCount += double(moments.count.load(std::memory_order_relaxed));
+            pool.mSum += moments.sum.load(std::memory_order_relaxed);
+            pool.mSquareSum += moments.squareSum.load(std::memory_order_relaxed);
+            pool.mMinValue = std::min(pool.mMinValue, moments.minValue.load(std::memory_order_relaxed));
+            pool.mMaxValue = std::max(pool.mMaxValue, moments.maxValue.load(std::memory_order_relaxed));
+        }
+        return pool;
+    }
+
+    // Must not be called concurrently with anything else.
+    void clear() {
+        for (size_t i = 0; i < mShards * mShardStride; i++) {
+            mCounts[i].store(0, std::memory_order_relaxed);
+        }
+        for (size_t shard = 0; shard < mShards; shard++) {
+            ShardMoments& moments = mMoments[shard];
+            moments.count.store(0, std::memory_order_relaxed);
+            moments.sum.store(0.0, std::memory_order_relaxed);
+            moments.squareSum.store(0.0, std::memory_order_relaxed);
+            moments.minValue.store(std::numeric_limits<float>::max(), std::memory_order_relaxed);
+            moments.maxValue.store(std::numeric_limits<float>::lowest(), std::memory_order_relaxed);
+        }
+    }
+
+private:
+    static constexpr size_t CacheLine = 64;
+
+    struct alignas(CacheLine) ShardMoments {
+        std::atomic<uint64_t> count;
+        std::atomic<double> sum;
+        std::atomic<double> squareSum;
+        std::atomic<float> minValue;
+        std::atomic<float> maxValue;
+    };
+
+    struct CountsDeleter {
+        void operator()(std::atomic<uint64_t>* counts) const { ::operator delete[](counts, std::align_val_t(CacheLine)); }
+    };
+
+    static std::atomic<uint64_t>* allocateCounts(size_t size) {
+        void* memory = ::operator new[](size * sizeof(std::atomic<uint64_t>), std::align_val_t(CacheLine));
+        auto* counts = static_cast<std::atomic<uint64_t>*>(memory);
+        for (size_t i = 0; i < size; i++) {
+            new (&counts[i]) std::atomic<uint64_t>(0);
+        }
+        return counts;
+    }
+
+    static void atomicAdd(std::atomic<double>& target, double value) {
+        double current = target.load(std::memory_order_relaxed);
+        while (!target.compare_exchange_weak(current, current + value, std::memory_order_relaxed)) {}
+    }
+    static void atomicMin(std::atomic<float>& target, float value) {
+        float current = target.load(std::memory_order_relaxed);
+        while (value < current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+    }
+    static void atomicMax(std::atomic<float>& target, float value) {
+        float current = target.load(std::memory_order_relaxed);
+        while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+    }
+
+    BucketLayout mLayout;
+    size_t mShards;
+    size_t mShardStride;
+    std::unique_ptr<std::atomic<uint64_t>[], CountsDeleter> mCounts;
+    std::unique_ptr<ShardMoments[]> mMoments;
+};
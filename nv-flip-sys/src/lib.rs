@@ -1,3 +1,6 @@
+// bindgen names its layout tests and enum constants after the C types.
+#![allow(non_snake_case, non_upper_case_globals)]
+
 include!("bindings.rs");
 
 /// Default configuration for pixels per degree.
@@ -0,0 +1,294 @@
+#pragma once
+
+// The two terms FLIP combines into its error, computed on their own.
+//
+// FLIP's error is color^(1 - feature). The color term compares spatially filtered, Hunt
+// adjusted colors with HyAB, the feature term compares edges and points detected on the
+// luminance. Checks that only care about one of them can skip the other half of the work.
+// Color conversions and error constants are FLIP's own. Its filters and stages only run on
+// whole images, so those are reimplemented here after FLIP v1.2, the version in extern/.
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "color.h"
+#include "sharedflip.h"
+
+// Planes of an image in YCxCz. Gray images leave cx and cz empty, their chroma is 0.
+struct YCxCzImage {
+    int width = 0;
+    int height = 0;
+    std::vector<float> y;
+    std::vector<float> cx;
+    std::vector<float> cz;
+
+    bool gray() const { return cx.empty(); }
+};
+
+class FlipTerms {
+public:
+    // Converts sRGB values in [0, 1], fetched by srgb(x, y, rgb).
+    template<typename Srgb>
+    static YCxCzImage fromSrgb(int width, int height, Srgb const& srgb) {
+        YCxCzImage image = emptyImage(width, height, false);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                float rgb[3];
+                srgb(x, y, rgb);
+                FLIP::color3 ycxcz = sRgbToYCxCz(FLIP::color3(rgb[0], rgb[1], rgb[2]));
+                size_t i = size_t(y) * width + x;
+                image.y[i] = ycxcz.x;
+                // Gray is exactly achromatic, rather than off by the rounding of the conversion.
+                if (rgb[0] != rgb[1] || rgb[1] != rgb[2]) {
+                    image.cx[i] = ycxcz.y;
+                    image.cz[i] = ycxcz.z;
+                }
+            }
+        }
+        return image;
+    }
+
+    // Converts gray sRGB values in [0, 1], fetched by gray(x, y). Equal to converting (v, v, v),
+    // whose chroma is 0 as gray maps to the white point.
+    template<typename Gray>
+    static YCxCzImage fromGray(int width, int height, Gray const& gray) {
+        YCxCzImage image = emptyImage(width, height, true);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                image.y[size_t(y) * width + x] = sRgbToYCxCz(FLIP::color3(gray(x, y))).x;
+            }
+        }
+        return image;
+    }
+
+    // Writes the color term of every pixel. The chroma filters are skipped if both images are gray.
+    static void colorDifference(YCxCzImage const& reference, YCxCzImage const& test, float pixels_per_degree, float* error) {
+        int width = reference.width;
+        int height = reference.height;
+        size_t count = size_t(width) * height;
+        int radius = spatialFilterRadius(pixels_per_degree);
+
+        // Filters of the CSF Gaussians per channel: luminance, red-green, and the two parts of
+        // blue-yellow, which as a sum of two Gaussians isn't separable as a whole.
+        std::vector<float> luminance = spatialFilter(radius, pixels_per_degree, LuminanceA, LuminanceB);
+        std::vector<float> red_green = spatialFilter(radius, pixels_per_degree, RedGreenA, RedGreenB);
+        std::vector<float> blue_yellow_1 = spatialFilter(radius, pixels_per_degree, BlueYellowA1, BlueYellowB1);
+        std::vector<float> blue_yellow_2 = spatialFilter(radius, pixels_per_degree, BlueYellowA2, BlueYellowB2);
+        float sum_1 = sum(blue_yellow_1);
+        float sum_2 = sum(blue_yellow_2);
+        float blue_yellow_norm = sum_1 * sum_1 + sum_2 * sum_2;
+        normalize(luminance);
+        normalize(red_green);
+
+        std::vector<float> scratch(count);
+        std::vector<float> filtered[2][3];
+        YCxCzImage const* images[2] = { &reference, &test };
+        for (int i = 0; i < 2; i++) {
+            YCxCzImage const& image = *images[i];
+            filtered[i][0].resize(count);
+            convolve(image.y.data(), width, height, luminance, luminance, scratch.data(), filtered[i][0].data());
+            if (image.gray()) {
+                continue;
+            }
+            filtered[i][1].resize(count);
+            convolve(image.cx.data(), width, height, red_green, red_green, scratch.data(), filtered[i][1].data());
+            filtered[i][2].resize(count);
+            std::vector<float> second(count);
+            convolve(image.cz.data(), width, height, blue_yellow_1, blue_yellow_1, scratch.data(), filtered[i][2].data());
+            convolve(image.cz.data(), width, height, blue_yellow_2, blue_yellow_2, scratch.data(), second.data());
+            for (size_t p = 0; p < count; p++) {
+                filtered[i][2][p] = (filtered[i][2][p] + second[p]) / blue_yellow_norm;
+            }
+        }
+
+        float exponent = FLIP::FLIPConstants.gqc;
+        float knee = FLIP::FLIPConstants.gpc;
+        float knee_value = FLIP::FLIPConstants.gpt;
+        float max_error = std::pow(hyab(huntLab(FLIP::color3(0.0f, 1.0f, 0.0f)), huntLab(FLIP::color3(0.0f, 0.0f, 1.0f))), exponent);
+        for (size_t p = 0; p < count; p++) {
+            FLIP::color3 lab[2];
+            for (int i = 0; i < 2; i++) {
+                float cx = filtered[i][1].empty() ? 0.0f : filtered[i][1][p];
+                float cz = filtered[i][2].empty() ? 0.0f : filtered[i][2][p];
+                FLIP::color3 rgb = FLIP::color3::XYZ2LinearRGB(FLIP::color3::YCxCz2XYZ(FLIP::color3(filtered[i][0][p], cx, cz)));
+                lab[i] = huntLab(FLIP::color3(clamp01(rgb.r), clamp01(rgb.g), clamp01(rgb.b)));
+            }
+            // Compresses large differences, which all look equally bad, into the top of [0, 1].
+            float value = std::pow(hyab(lab[0], lab[1]), exponent);
+            if (value < knee * max_error) {
+                value *= knee_value / (knee * max_error);
+            } else {
+                value = knee_value + (value - knee * max_error) / (max_error - knee * max_error) * (1.0f - knee_value);
+            }
+            error[p] = value;
+        }
+    }
+
+    // Writes the feature term of every pixel.
+    static void featureDifference(YCxCzImage const& reference, YCxCzImage const& test, float pixels_per_degree, float* error) {
+        int width = reference.width;
+        int height = reference.height;
+        size_t count = size_t(width) * height;
+
+        std::vector<float> gaussian;
+        std::vector<float> edge;
+        std::vector<float> point;
+        featureFilters(pixels_per_degree, gaussian, edge, point);
+
+        std::vector<float> normalized(count);
+        std::vector<float> scratch(count);
+        std::vector<float> edge_x(count), edge_y(count), point_x(count), point_y(count);
+        std::vector<float> edges[2], points[2];
+        YCxCzImage const* images[2] = { &reference, &test };
+        for (int i = 0; i < 2; i++) {
+            for (size_t p = 0; p < count; p++) {
+                normalized[p] = (images[i]->y[p] + 16.0f) / 116.0f;
+            }
+            convolve(normalized.data(), width, height, edge, gaussian, scratch.data(), edge_x.data());
+            convolve(normalized.data(), width, height, gaussian, edge, scratch.data(), edge_y.data());
+            convolve(normalized.data(), width, height, point, gaussian, scratch.data(), point_x.data());
+            convolve(normalized.data(), width, height, gaussian, point, scratch.data(), point_y.data());
+            edges[i].resize(count);
+            points[i].resize(count);
+            for (size_t p = 0; p < count; p++) {
+                edges[i][p] = std::sqrt(edge_x[p] * edge_x[p] + edge_y[p] * edge_y[p]);
+                points[i][p] = std::sqrt(point_x[p] * point_x[p] + point_y[p] * point_y[p]);
+            }
+        }
+
+        for (size_t p = 0; p < count; p++) {
+            float difference = std::max(std::abs(edges[0][p] - edges[1][p]), std::abs(points[0][p] - points[1][p]));
+            error[p] = std::pow(difference / std::sqrt(2.0f), FLIP::FLIPConstants.gqf);
+        }
+    }
+
+private:
+    static constexpr float Pi = 3.14159265f;
+    // Contrast sensitivity Gaussians a * sqrt(pi / b) * exp(-pi^2 * r^2 / b) of the spatial filter,
+    // as in FLIP v1.2. Blue-yellow is the sum of two.
+    static constexpr float LuminanceA = 1.0f;
+    static constexpr float LuminanceB = 0.0047f;
+    static constexpr float RedGreenA = 1.0f;
+    static constexpr float RedGreenB = 0.0053f;
+    static constexpr float BlueYellowA1 = 34.1f;
+    static constexpr float BlueYellowB1 = 0.04f;
+    static constexpr float BlueYellowA2 = 13.5f;
+    static constexpr float BlueYellowB2 = 0.025f;
+
+    static YCxCzImage emptyImage(int width, int height, bool gray) {
+        YCxCzImage image;
+        image.width = width;
+        image.height = height;
+        image.y.resize(size_t(width) * height);
+        if (!gray) {
+            image.cx.resize(size_t(width) * height);
+            image.cz.resize(size_t(width) * height);
+        }
+        return image;
+    }
+
+    static float clamp01(float value) { return std::min(std::max(value, 0.0f), 1.0f); }
+
+    static FLIP::color3 sRgbToYCxCz(FLIP::color3 srgb) {
+        return FLIP::color3::XYZ2YCxCz(FLIP::color3::LinearRGB2XYZ(FLIP::color3::sRGB2LinearRGB(srgb)));
+    }
+
+    // L*a*b* of a linear RGB color, with a and b scaled by the lightness (Hunt effect).
+    static FLIP::color3 huntLab(FLIP::color3 rgb) {
+        FLIP::color3 lab = FLIP::color3::XYZ2CIELab(FLIP::color3::LinearRGB2XYZ(rgb));
+        return FLIP::color3(lab.x, 0.01f * lab.x * lab.y, 0.01f * lab.x * lab.z);
+    }
+
+    static float hyab(FLIP::color3 const& a, FLIP::color3 const& b) {
+        float da = a.y - b.y;
+        float db = a.z - b.z;
+        return std::abs(a.x - b.x) + std::sqrt(da * da + db * db);
+    }
+
+    static int spatialFilterRadius(float pixels_per_degree) {
+        return int(std::ceil(3.0f * std::sqrt(BlueYellowB1 / (2.0f * Pi * Pi)) * pixels_per_degree));
+    }
+
+    // One dimension of a * sqrt(pi / b) * exp(-pi^2 * r^2 / b), r in degrees, not normalized.
+    static std::vector<float> spatialFilter(int radius, float pixels_per_degree, float a, float b) {
+        std::vector<float> filter(2 * radius + 1);
+        for (int x = -radius; x <= radius; x++) {
+            float r = float(x) / pixels_per_degree;
+            filter[x + radius] = std::sqrt(a * std::sqrt(Pi / b)) * std::exp(-Pi * Pi * r * r / b);
+        }
+        return filter;
+    }
+
+    // Gaussian, first and second derivative filters with a standard deviation of half the feature width.
+    // Positive and negative weights of the derivatives are normalized separately.
+    static void featureFilters(float pixels_per_degree, std::vector<float>& gaussian, std::vector<float>& edge, std::vector<float>& point) {
+        float deviation = 0.5f * FLIP::FLIPConstants.gw * pixels_per_degree;
+        int radius = int(std::ceil(3.0f * deviation));
+        gaussian.resize(2 * radius + 1);
+        edge.resize(2 * radius + 1);
+        point.resize(2 * radius + 1);
+        for (int x = -radius; x <= radius; x++) {
+            float value = std::exp(-float(x * x) / (2.0f * deviation * deviation));
+            gaussian[x + radius] = value;
+            edge[x + radius] = -float(x) * value;
+            point[x + radius] = (float(x * x) / (deviation * deviation) - 1.0f) * value;
+        }
+        normalize(gaussian);
+        normalizeSigned(edge);
+        normalizeSigned(point);
+    }
+
+    static float sum(std::vector<float> const& filter) {
+        float total = 0.0f;
+        for (float weight : filter) {
+            total += weight;
+        }
+        return total;
+    }
+
+    static void normalize(std::vector<float>& filter) {
+        float total = sum(filter);
+        for (float& weight : filter) {
+            weight /= total;
+        }
+    }
+
+    static void normalizeSigned(std::vector<float>& filter) {
+        float positive = 0.0f;
+        float negative = 0.0f;
+        for (float weight : filter) {
+            (weight > 0.0f ? positive : negative) += weight;
+        }
+        for (float& weight : filter) {
+            weight /= weight > 0.0f ? positive : -negative;
+        }
+    }
+
+    // Separable convolution with clamp to edge, horizontal then vertical.
+    static void convolve(float const* input, int width, int height, std::vector<float> const& horizontal, std::vector<float> const& vertical, float* scratch, float* output) {
+        int h_radius = int(horizontal.size() / 2);
+        int v_radius = int(vertical.size() / 2);
+        for (int y = 0; y < height; y++) {
+            float const* row = input + size_t(y) * width;
+            for (int x = 0; x < width; x++) {
+                float total = 0.0f;
+                for (int k = -h_radius; k <= h_radius; k++) {
+                    total += horizontal[k + h_radius] * row[std::min(std::max(x + k, 0), width - 1)];
+                }
+                scratch[size_t(y) * width + x] = total;
+            }
+        }
+        for (int y = 0; y < height; y++) {
+            float* row = output + size_t(y) * width;
+            std::fill(row, row + width, 0.0f);
+            for (int k = -v_radius; k <= v_radius; k++) {
+                float weight = vertical[k + v_radius];
+                float const* source = scratch + size_t(std::min(std::max(y + k, 0), height - 1)) * width;
+                for (int x = 0; x < width; x++) {
+                    row[x] += weight * source[x];
+                }
+            }
+        }
+    }
+};
@@ -0,0 +1,52 @@
+//! Comparison daemon keeping reference images in memory, see `nv_flip_tools::daemon`.
+//!
+//! Usage: `flip-daemon <socket path>`
+
+#[cfg(target_os = "linux")]
+fn main() {
+    use std::os::unix::net::{UnixListener, UnixStream};
+    use std::sync::Arc;
+
+    let Some(path) = std::env::args_os().nth(1) else {
+        eprintln!("usage: flip-daemon <socket path>");
+        std::process::exit(2);
+    };
+    // A socket file left behind by a daemon that is gone would make binding fail.
+    if UnixStream::connect(&path).is_ok() {
+        eprintln!(
+            "a daemon is already listening on {}",
+            path.to_string_lossy()
+        );
+        std::process::exit(1);
+    }
+    let _ = std::fs::remove_file(&path);
+    let listener = UnixListener::bind(&path).unwrap_or_else(|error| {
+        eprintln!("can't listen on {}: {error}", path.to_string_lossy());
+        std::process::exit(1);
+    });
+
+    // A thread per connection, so that idle clients don't hold up others, with comparisons
+    // handed to a fixed set of workers, so that the scratch images each worker keeps stay
+    // warm across the many short connections of test runs.
+    let workers = std::thread::available_parallelism().map_or(4, |count| count.get());
+    let daemon = Arc::new(nv_flip_tools::daemon::Daemon::with_workers(workers));
+    for stream in listener.incoming() {
+        match stream {
+            Ok(stream) => {
+                let daemon = Arc::clone(&daemon);
+                std::thread::spawn(move || {
+                    if let Err(error) = daemon.serve(stream) {
+                        eprintln!("connection failed: {error}");
+                    }
+                });
+            }
+            Err(error) => eprintln!("can't accept connection: {error}"),
+        }
+    }
+}
+
+#[cfg(not(target_os = "linux"))]
+fn main() {
+    eprintln!("flip-daemon passes images as memfds and is only supported on Linux");
+    std::process::exit(1);
+}
@@ -0,0 +1,104 @@
+//! Keeps FLIP results of a directory of test images up to date while they are rewritten,
+//! see `nv_flip_tools::watch`.
+//!
+//! Usage: `flip-watch <reference dir> <test dir> [pixels per degree]`
+//!
+//! Pixels per degree must be greater than 0 and at most
+//! `nv_flip_tools::daemon::MAX_PIXELS_PER_DEGREE`.
+//!
+//! Prints one line per pair whenever its result changes: the name, followed by the mean,
+//! weighted median, 1st and 3rd weighted quartiles, min and max, separated by tabs.
+
+#[cfg(target_os = "linux")]
+fn main() {
+    use nv_flip_tools::daemon::MAX_PIXELS_PER_DEGREE;
+    use nv_flip_tools::watch::{Comparisons, DecodedImage, DirectoryWatch, Event, Side, Update};
+    use std::path::PathBuf;
+
+    let args: Vec<_> = std::env::args_os().skip(1).collect();
+    let (reference_dir, test_dir, pixels_per_degree) = match &args[..] {
+        [reference, test] => (reference, test, nv_flip::DEFAULT_PIXELS_PER_DEGREE),
+        [reference, test, ppd] => match ppd
+            .to_str()
+            .and_then(|ppd| ppd.parse::<f32>().ok())
+            .filter(|&ppd| ppd > 0.0 && ppd <= MAX_PIXELS_PER_DEGREE)
+        {
+            Some(ppd) => (reference, test, ppd),
+            None => {
+                eprintln!("invalid pixels per degree: {}", ppd.to_string_lossy());
+                std::process::exit(2);
+            }
+        },
+        _ => {
+            eprintln!("usage: flip-watch <reference dir> <test dir> [pixels per degree]");
+            std::process::exit(2);
+        }
+    };
+    let reference_dir = PathBuf::from(reference_dir);
+    let test_dir = PathBuf::from(test_dir);
+
+    let decode = |contents: &[u8]| {
+        let image = image::load_from_memory(contents).map_err(|error| error.to_string())?;
+        let image = image.into_rgb8();
+        Ok(DecodedImage {
+            width: image.width(),
+            height: image.height(),
+            data: image.to_vec(),
+        })
+    };
+    let report = |name: &std::ffi::OsStr, update: Update| {
+        let name = name.to_string_lossy();
+        match update {
+            Update::Compared(s) => println!(
+                "{name}\t{}\t{}\t{}\t{}\t{}\t{}",
+                s.mean,
+                s.weighted_median,
+                s.first_weighted_quartile,
+                s.third_weighted_quartile,
+                s.min_value,
+                s.max_value
+            ),
+            Update::Failed(error) => eprintln!("{name}: {error}"),
+            Update::Removed => eprintln!("{name}: removed"),
+        }
+    };
+    let fail = |error: std::io::Error| -> ! {
+        eprintln!("flip-watch: {error}");
+        std::process::exit(1);
+    };
+
+    // Watch before the first scan, so that nothing written in between is missed.
+    let mut watch = DirectoryWatch::new(&[&reference_dir, &test_dir]).unwrap_or_else(|e| fail(e));
+    let mut comparisons = Comparisons::new(reference_dir, test_dir, pixels_per_degree, decode);
+    for (name, update) in comparisons.scan().unwrap_or_else(|e| fail(e)) {
+        report(&name, update);
+    }
+    loop {
+        for event in watch.wait().unwrap_or_else(|e| fail(e)) {
+            match event {
+                Event::File(dir, name) => {
+                    let side = if dir == 0 {
+                        Side::Reference
+                    } else {
+                        Side::Test
+                    };
+                    if let Some(update) = comparisons.file_changed(side, &name) {
+                        report(&name, update);
+                    }
+                }
+                // Changes were dropped, find them by reading everything again.
+                Event::Overflow => {
+                    for (name, update) in comparisons.scan().unwrap_or_else(|e| fail(e)) {
+                        report(&name, update);
+                    }
+                }
+            }
+        }
+    }
+}
+
+#[cfg(not(target_os = "linux"))]
+fn main() {
+    eprintln!("flip-watch uses inotify and is only supported on Linux");
+    std::process::exit(1);
+}
@@ -0,0 +1,609 @@
+//! A comparison daemon that keeps reference images in memory.
+//!
+//! Short lived test processes pay process start, decoding and setup for every comparison.
+//! The daemon pays those once: references are registered by name, and every comparison
+//! against them only sends the test image. With [`Daemon::with_workers`], comparisons from
+//! all connections run on a fixed set of worker threads, whose scratch images are reused
+//! while the image size stays the same, see [`nv_flip::flip_statistics`].
+//!
+//! # Protocol
+//!
+//! Clients connect to a Unix domain socket and send requests, one line each of at most
+//! [`MAX_LINE_LEN`] bytes. Images are tightly packed RGB8 data in a memfd sealed with at
+//! least `F_SEAL_SHRINK`, passed along with their request as `SCM_RIGHTS` ancillary data.
+//! Unsealed files are rejected, as a client truncating one mid comparison would bring down
+//! the daemon with `SIGBUS`. Images also sealed with `F_SEAL_WRITE` are compared in place,
+//! others are copied first, so a client writing one before the reply arrived only spoils
+//! its own result. Descriptors sent with other requests, or beyond the first, are closed.
+//! Every request gets one line back, either `ok ...` or `error <message>`.
+//!
+//! - `reference <name> <width> <height>` with the reference image, replacing any
+//!   previous reference of that name. Replies `ok`.
+//! - `compare <name> <pixels per degree>` with a test image the size of the reference.
+//!   Pixels per degree must be greater than 0 and at most [`MAX_PIXELS_PER_DEGREE`].
+//!   Replies `ok <mean> <weighted median> <1st weighted quartile> <3rd weighted quartile>
+//!   <min> <max>`.
+//! - `forget <name>`, dropping the reference. Replies `ok`.
+//!
+//! Names can't contain whitespace. [`Client`] implements the client side.
+
+use std::collections::{HashMap, VecDeque};
+use std::fs::File;
+use std::io::{self, Write};
+use std::os::unix::io::{AsFd, AsRawFd, BorrowedFd, FromRawFd, OwnedFd, RawFd};
+use std::os::unix::net::UnixStream;
+use std::path::Path;
+use std::sync::{mpsc, Arc, Mutex};
+
+use nv_flip::FlipStatistics;
+
+use crate::shm::{self, Mapping, SharedImage};
+
+/// Largest pixels per degree accepted, far beyond any real display. FLIP's filters grow
+/// linearly with it.
+pub const MAX_PIXELS_PER_DEGREE: f32 = 1000.0;
+
+/// Longest line accepted, far beyond any valid request or reply. Longer lines close the
+/// connection.
+pub const MAX_LINE_LEN: usize = 4096;
+
+/// Most file descriptors held for requests that haven't fully arrived. More close the
+/// connection.
+const MAX_PENDING_FDS: usize = 16;
+
+/// Reference images shared by all connections.
+#[derive(Default)]
+pub struct Daemon {
+    references: Mutex<HashMap<String, Arc<Reference>>>,
+    workers: Option<mpsc::Sender<Job>>,
+}
+
+type Job = Box<dyn FnOnce() + Send>;
+
+struct Reference {
+    width: u32,
+    height: u32,
+    data: Vec<u8>,
+}
+
+impl Daemon {
+    /// Creates a daemon without any references, running comparisons on the thread serving
+    /// the connection.
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Creates a daemon without any references, running comparisons on `count` worker
+    /// threads shared by all connections. Connections can then be served from a thread each,
+    /// idle ones cost nothing but their thread, while scratch images stay warm in the
+    /// workers. The workers exit when the daemon is dropped.
+    pub fn with_workers(count: usize) -> Self {
+        let (sender, receiver) = mpsc::channel::<Job>();
+        let receiver = Arc::new(Mutex::new(receiver));
+        for _ in 0..count.max(1) {
+            let receiver = Arc::clone(&receiver);
+            std::thread::spawn(move || loop {
+                let Ok(job) = receiver.lock().unwrap().recv() else {
+                    return;
+                };
+                // A panicking comparison fails its request, the worker stays.
+                let _ = std::panic::catch_unwind(std::panic::AssertUnwindSafe(job));
+            });
+        }
+        Self {
+            references: Mutex::default(),
+            workers: Some(sender),
+        }
+    }
+
+    /// Answers requests on the connection until the client closes it.
+    pub fn serve(&self, stream: UnixStream) -> io::Result<()> {
+        let mut connection = Connection::new(stream);
+        while let Some(line) = connection.read_line()? {
+            // Any others are closed here, rather than kept for the next request.
+            let mut fds = std::mem::take(&mut connection.fds).into_iter();
+            let image = match line.split_whitespace().next() {
+                Some("reference" | "compare") => fds.next(),
+                _ => None,
+            };
+            drop(fds);
+            let reply = match self.handle(&line, image) {
+                Ok(reply) if reply.is_empty() => "ok\n".to_owned(),
+                Ok(reply) => format!("ok {reply}\n"),
+                Err(message) => format!("error {message}\n"),
+            };
+            connection.stream.write_all(reply.as_bytes())?;
+        }
+        Ok(())
+    }
+
+    fn handle(&self, line: &str, image: Option<OwnedFd>) -> Result<String, String> {
+        match line.split_whitespace().collect::<Vec<_>>()[..] {
+            ["reference", name, width, height] => {
+                let width = parse(width, "width")?;
+                let height = parse(height, "height")?;
+                let (mapping, _) = map_image(image, width, height)?;
+                let data = mapping.copy(0..image_len(width, height));
+                let reference = Arc::new(Reference {
+                    width,
+                    height,
+                    data,
+                });
+                self.references
+                    .lock()
+                    .unwrap()
+                    .insert(name.to_owned(), reference);
+                Ok(String::new())
+            }
+            ["compare", name, pixels_per_degree] => {
+                let pixels_per_degree: f32 = parse(pixels_per_degree, "pixels per degree")?;
+                // FLIP sizes its filters by this, out of range values would abort the daemon.
+                if !(pixels_per_degree > 0.0 && pixels_per_degree <= MAX_PIXELS_PER_DEGREE) {
+                    return Err(format!(
+                        "pixels per degree out of range: {pixels_per_degree}"
+                    ));
+                }
+                // Cloned out so that other connections aren't blocked during the comparison.
+                let reference = self.references.lock().unwrap().get(name).cloned();
+                let reference = reference.ok_or_else(|| format!("unknown reference {name}"))?;
+                let (test, sealed) = map_image(image, reference.width, reference.height)?;
+                let compare = move || {
+                    let len = image_len(reference.width, reference.height);
+                    let copy;
+                    let test = if sealed {
+                        // SAFETY: The image is sealed against writes.
+                        unsafe { test.slice(0..len) }
+                    } else {
+                        copy = test.copy(0..len);
+                        &copy
+                    };
+                    nv_flip::flip_statistics(
+                        reference.width,
+                        reference.height,
+                        &reference.data,
+                        test,
+                        pixels_per_degree,
+                    )
+                };
+                let statistics = match &self.workers {
+                    Some(workers) => {
+                        let (sender, receiver) = mpsc::sync_channel(1);
+                        workers
+                            .send(Box::new(move || {
+                                let _ = sender.send(compare());
+                            }))
+                            .map_err(|_| "no workers left".to_owned())?;
+                        receiver
+                            .recv()
+                            .map_err(|_| "comparison failed".to_owned())?
+                    }
+                    None => compare(),
+                };
+                Ok(format!(
+                    "{} {} {} {} {} {}",
+                    statistics.mean,
+                    statistics.weighted_median,
+                    statistics.first_weighted_quartile,
+                    statistics.third_weighted_quartile,
+                    statistics.min_value,
+                    statistics.max_value
+                ))
+            }
+            ["forget", name] => {
+                self.references.lock().unwrap().remove(name);
+                Ok(String::new())
+            }
+            _ => Err(format!("malformed request: {line}")),
+        }
+    }
+}
+
+/// Client side of the daemon protocol.
+pub struct Client {
+    connection: Connection,
+}
+
+impl Client {
+    /// Connects to the daemon listening at `path`.
+    pub fn connect(path: impl AsRef<Path>) -> io::Result<Self> {
+        Ok(Self::from_stream(UnixStream::connect(path)?))
+    }
+
+    /// Uses an already connected stream.
+    pub fn from_stream(stream: UnixStream) -> Self {
+        Self {
+            connection: Connection::new(stream),
+        }
+    }
+
+    /// Registers `data` as the reference image called `name`.
+    ///
+    /// Data is expected in row-major order, from the top left, tightly packed. Do not include alpha.
+    ///
+    /// # Panics
+    ///
+    /// - If the name contains whitespace.
+    /// - If the data is not large enough to fill the image.
+    pub fn set_reference(
+        &mut self,
+        name: &str,
+        width: u32,
+        height: u32,
+        data: &[u8],
+    ) -> io::Result<()> {
+        assert!(!name.contains(char::is_whitespace));
+        let image = SharedImage::with_data(width, height, data)?;
+        self.request(
+            &format!("reference {name} {width} {height}"),
+            Some(image.fd()),
+        )?;
+        Ok(())
+    }
+
+    /// Compares `data` to the reference image called `name`.
+    ///
+    /// Fails if there is no such reference, so that clients can register it and retry.
+    ///
+    /// # Panics
+    ///
+    /// - If the name contains whitespace.
+    pub fn compare(
+        &mut self,
+        name: &str,
+        data: &[u8],
+        pixels_per_degree: f32,
+    ) -> io::Result<FlipStatistics> {
+        assert!(!name.contains(char::is_whitespace));
+        let mut file = File::from(shm::memfd(data.len())?);
+        file.write_all(data)?;
+        shm::add_seals(file.as_fd(), libc::F_SEAL_WRITE)?;
+        self.compare_fd(name, file.as_fd(), pixels_per_degree)
+    }
+
+    /// Compares an image already in shared memory to the reference image called `name`,
+    /// without copying it.
+    ///
+    /// Fails if there is no such reference, so that clients can register it and retry.
+    ///
+    /// # Panics
+    ///
+    /// - If the name contains whitespace.
+    pub fn compare_shared(
+        &mut self,
+        name: &str,
+        image: &SharedImage,
+        pixels_per_degree: f32,
+    ) -> io::Result<FlipStatistics> {
+        assert!(!name.contains(char::is_whitespace));
+        self.compare_fd(name, image.fd(), pixels_per_degree)
+    }
+
+    fn compare_fd(
+        &mut self,
+        name: &str,
+        fd: BorrowedFd<'_>,
+        pixels_per_degree: f32,
+    ) -> io::Result<FlipStatistics> {
+        let reply = self.request(&format!("compare {name} {pixels_per_degree}"), Some(fd))?;
+        let values = reply
+            .split_whitespace()
+            .map(|value| value.parse::<f32>().map_err(|_| invalid_data(&reply)))
+            .collect::<io::Result<Vec<f32>>>()?;
+        match values[..] {
+            [mean, weighted_median, first_weighted_quartile, third_weighted_quartile, min_value, max_value] => {
+                Ok(FlipStatistics {
+                    mean,
+                    weighted_median,
+                    first_weighted_quartile,
+                    third_weighted_quartile,
+                    min_value,
+                    max_value,
+                })
+            }
+            _ => Err(invalid_data(&reply)),
+        }
+    }
+
+    /// Drops the reference image called `name` from the daemon.
+    pub fn forget(&mut self, name: &str) -> io::Result<()> {
+        assert!(!name.contains(char::is_whitespace));
+        self.request(&format!("forget {name}"), None)?;
+        Ok(())
+    }
+
+    /// Sends one request and returns the reply without its `ok`.
+    fn request(&mut self, line: &str, fd: Option<BorrowedFd<'_>>) -> io::Result<String> {
+        send(&self.connection.stream, format!("{line}\n").as_bytes(), fd)?;
+        let reply = self
+            .connection
+            .read_line()?
+            .ok_or_else(|| io::Error::new(io::ErrorKind::UnexpectedEof, "daemon hung up"))?;
+        match reply.split_once(' ').unwrap_or((&reply, "")) {
+            ("ok", rest) => Ok(rest.to_owned()),
+            ("error", message) => Err(io::Error::other(message)),
+            _ => Err(invalid_data(&reply)),
+        }
+    }
+}
+
+fn image_len(width: u32, height: u32) -> usize {
+    width as usize * height as usize * 3
+}
+
+fn parse<T: std::str::FromStr>(value: &str, what: &str) -> Result<T, String> {
+    value
+        .parse()
+        .map_err(|_| format!("invalid {what}: {value}"))
+}
+
+fn invalid_data(reply: &str) -> io::Error {
+    io::Error::new(
+        io::ErrorKind::InvalidData,
+        format!("malformed reply: {reply}"),
+    )
+}
+
+/// Maps the image sent with a request, checking it can't shrink and is large enough.
+/// Also returns whether it is sealed against writes.
+fn map_image(fd: Option<OwnedFd>, width: u32, height: u32) -> Result<(Mapping, bool), String> {
+    let fd = fd.ok_or("missing image file descriptor")?;
+    let seals = shm::seals(fd.as_fd()).map_err(|error| format!("can't get seals: {error}"))?;
+    if seals & libc::F_SEAL_SHRINK == 0 {
+        return Err("image file not sealed against shrinking".to_owned());
+    }
+    let mapping = Mapping::new(&fd, false).map_err(|error| format!("can't map image: {error}"))?;
+    if mapping.len() < image_len(width, height) {
+        return Err(format!(
+            "image of {} bytes is too small for {width}x{height}",
+            mapping.len()
+        ));
+    }
+    Ok((mapping, seals & libc::F_SEAL_WRITE != 0))
+}
+
+/// A stream split into lines, collecting the file descriptors sent along with them.
+struct Connection {
+    stream: UnixStream,
+    buffer: Vec<u8>,
+    /// Stream offset of the first byte in `buffer`.
+    offset: u64,
+    /// Descriptors of lines not read yet, with the stream offset of the last byte received
+    /// along with them. A sender attaches them to its line, so that byte is in the line.
+    pending: VecDeque<(u64, OwnedFd)>,
+    /// Descriptors sent with the line last returned by `read_line`.
+    fds: Vec<OwnedFd>,
+}
+
+impl Connection {
+    fn new(stream: UnixStream) -> Self {
+        Self {
+            stream,
+            buffer: Vec::new(),
+            offset: 0,
+            pending: VecDeque::new(),
+            fds: Vec::new(),
+        }
+    }
+
+    /// Returns None once the peer closed the stream.
+    fn read_line(&mut self) -> io::Result<Option<String>> {
+        loop {
+            if let Some(end) = self.buffer.iter().position(|&byte| byte == b'\n') {
+                let line_end = self.offset + end as u64;
+                self.fds.clear();
+                while self
+                    .pending
+                    .front()
+                    .is_some_and(|(offset, _)| *offset <= line_end)
+                {
+                    self.fds.extend(self.pending.pop_front().map(|(_, fd)| fd));
+                }
+                self.offset = line_end + 1;
+                let line: Vec<u8> = self.buffer.drain(..=end).take(end).collect();
+                return String::from_utf8(line)
+                    .map(Some)
+                    .map_err(|error| io::Error::new(io::ErrorKind::InvalidData, error));
+            }
+            if self.buffer.len() >= MAX_LINE_LEN {
+                return Err(io::Error::new(io::ErrorKind::InvalidData, "line too long"));
+            }
+            if self.receive()? == 0 {
+                return Ok(None);
+            }
+        }
+    }
+
+    fn receive(&mut self) -> io::Result<usize> {
+        let mut data = [0u8; 4096];
+        // Room for a few descriptors, aligned for cmsghdr.
+        let mut control = [0u64; 8];
+        let mut iov = libc::iovec {
+            iov_base: data.as_mut_ptr().cast(),
+            iov_len: data.len(),
+        };
+        let mut header: libc::msghdr = unsafe { std::mem::zeroed() };
+        header.msg_iov = &mut iov;
+        header.msg_iovlen = 1;
+        header.msg_control = control.as_mut_ptr().cast();
+        header.msg_controllen = std::mem::size_of_val(&control) as _;
+
+        let received = loop {
+            let received = unsafe {
+                libc::recvmsg(self.stream.as_raw_fd(), &mut header, libc::MSG_CMSG_CLOEXEC)
+            };
+            if received >= 0 {
+                break received as usize;
+            }
+            let error = io::Error::last_os_error();
+            if error.kind() != io::ErrorKind::Interrupted {
+                return Err(error);
+            }
+        };
+
+        let last = self.offset + (self.buffer.len() + received).saturating_sub(1) as u64;
+        let mut overflow = false;
+        unsafe {
+            let mut message = libc::CMSG_FIRSTHDR(&header);
+            while !message.is_null() {
+                if (*message).cmsg_level == libc::SOL_SOCKET
+                    && (*message).cmsg_type == libc::SCM_RIGHTS
+                {
+                    let count = ((*message).cmsg_len as usize - libc::CMSG_LEN(0) as usize)
+                        / std::mem::size_of::<RawFd>();
+                    let fds = libc::CMSG_DATA(message) as *const RawFd;
+                    for i in 0..count {
+                        let fd = OwnedFd::from_raw_fd(std::ptr::read_unaligned(fds.add(i)));
+                        if self.pending.len() < MAX_PENDING_FDS {
+                            self.pending.push_back((last, fd));
+                        } else {
+                            overflow = true;
+                        }
+                    }
+                }
+                message = libc::CMSG_NXTHDR(&header, message);
+            }
+        }
+        if overflow {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidData,
+                "too many file descriptors pending",
+            ));
+        }
+        if header.msg_flags & libc::MSG_CTRUNC != 0 {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidData,
+                "too many file descriptors in one message",
+            ));
+        }
+
+        self.buffer.extend_from_slice(&data[..received]);
+        Ok(received)
+    }
+}
+
+/// Writes all of `data`, with `fd` attached to the first byte.
+fn send(stream: &UnixStream, data: &[u8], fd: Option<BorrowedFd<'_>>) -> io::Result<()> {
+    let mut control = [0u64; 4];
+    let mut iov = libc::iovec {
+        iov_base: data.as_ptr() as *mut _,
+        iov_len: data.len(),
+    };
+    let mut header: libc::msghdr = unsafe { std::mem::zeroed() };
+    header.msg_iov = &mut iov;
+    header.msg_iovlen = 1;
+    if let Some(fd) = fd {
+        unsafe {
+            header.msg_control = control.as_mut_ptr().cast();
+            header.msg_controllen = libc::CMSG_SPACE(std::mem::size_of::<RawFd>() as u32) as _;
+            let message = libc::CMSG_FIRSTHDR(&header);
+            (*message).cmsg_level = libc::SOL_SOCKET;
+            (*message).cmsg_type = libc::SCM_RIGHTS;
+            (*message).cmsg_len = libc::CMSG_LEN(std::mem::size_of::<RawFd>() as u32) as _;
+            std::ptr::write_unaligned(libc::CMSG_DATA(message) as *mut RawFd, fd.as_raw_fd());
+        }
+    }
+
+    let sent = loop {
+        let sent = unsafe { libc::sendmsg(stream.as_raw_fd(), &header, libc::MSG_NOSIGNAL) };
+        if sent >= 0 {
+            break sent as usize;
+        }
+        let error = io::Error::last_os_error();
+        if error.kind() != io::ErrorKind::Interrupted {
+            return Err(error);
+        }
+    };
+    (&*stream).write_all(&data[sent..])
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn compare_through_daemon() {
+        let (width, height) = (40, 30);
+        let (reference, _) = crate::tests::test_pair(width, height);
+        let mut test = reference.clone();
+        test[100] ^= 0x40;
+
+        let (client, server) = UnixStream::pair().unwrap();
+        let daemon = Daemon::new();
+        std::thread::scope(|scope| {
+            scope.spawn(|| daemon.serve(server).unwrap());
+            let mut client = Client::from_stream(client);
+
+            assert!(client.compare("tree", &test, 67.0).is_err());
+            client
+                .set_reference("tree", width, height, &reference)
+                .unwrap();
+            let statistics = client.compare("tree", &test, 67.0).unwrap();
+            let expected = nv_flip::flip_statistics(width, height, &reference, &test, 67.0);
+            assert_eq!(statistics, expected);
+            assert!(client.compare("tree", &test[..10], 67.0).is_err());
+
+            let shared = SharedImage::with_data(width, height, &test).unwrap();
+            let statistics = client.compare_shared("tree", &shared, 67.0).unwrap();
+            assert_eq!(statistics, expected);
+
+            let unsealed = unsafe { libc::memfd_create(c"unsealed".as_ptr(), libc::MFD_CLOEXEC) };
+            let unsealed = File::from(unsafe { OwnedFd::from_raw_fd(unsealed) });
+            unsealed.set_len(test.len() as u64).unwrap();
+            assert!(client.compare_fd("tree", unsealed.as_fd(), 67.0).is_err());
+            for pixels_per_degree in [f32::NAN, f32::INFINITY, 1e30, 0.0, -1.0] {
+                assert!(client.compare("tree", &test, pixels_per_degree).is_err());
+            }
+
+            client.forget("tree").unwrap();
+            assert!(client.compare("tree", &test, 67.0).is_err());
+        });
+    }
+
+    #[test]
+    fn stray_descriptors_and_long_lines() {
+        let (width, height) = (8, 8);
+        let reference = vec![64; width as usize * height as usize * 3];
+        let daemon = Daemon::new();
+        std::thread::scope(|scope| {
+            let (client, server) = UnixStream::pair().unwrap();
+            let served = scope.spawn(|| daemon.serve(server));
+            let mut client = Client::from_stream(client);
+            client
+                .set_reference("flat", width, height, &reference)
+                .unwrap();
+
+            // The image sent with forget is closed, not used for the next compare.
+            let image = SharedImage::with_data(width, height, &reference).unwrap();
+            client.request("forget other", Some(image.fd())).unwrap();
+            assert!(client.request("compare flat 67", None).is_err());
+            client.compare_shared("flat", &image, 67.0).unwrap();
+
+            let line = "x".repeat(2 * MAX_LINE_LEN);
+            assert!(client.request(&line, None).is_err());
+            assert!(served.join().unwrap().is_err());
+        });
+    }
+
+    #[test]
+    fn idle_connection_doesnt_block_others() {
+        let (width, height) = (16, 8);
+        let reference = vec![128; width as usize * height as usize * 3];
+        let daemon = Daemon::with_workers(1);
+        std::thread::scope(|scope| {
+            let (idle, server) = UnixStream::pair().unwrap();
+            scope.spawn(|| daemon.serve(server).unwrap());
+            let (client, server) = UnixStream::pair().unwrap();
+            scope.spawn(|| daemon.serve(server).unwrap());
+
+            let mut client = Client::from_stream(client);
+            client
+                .set_reference("flat", width, height, &reference)
+                .unwrap();
+            let statistics = client.compare("flat", &reference, 67.0).unwrap();
+            let expected = nv_flip::flip_statistics(width, height, &reference, &reference, 67.0);
+            assert_eq!(statistics, expected);
+            drop(client);
+            drop(idle);
+        });
+    }
+}
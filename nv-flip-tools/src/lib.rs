@@ -0,0 +1,24 @@
+//! Tools built on [`nv_flip`] for running comparisons at scale.
+//!
+//! The binaries in this crate are thin wrappers over the modules here, so that other
+//! programs can talk to them, or embed them, without going through a command line.
+
+#[cfg(target_os = "linux")]
+pub mod daemon;
+#[cfg(target_os = "linux")]
+pub mod shm;
+#[cfg(target_os = "linux")]
+pub mod watch;
+
+#[cfg(all(test, target_os = "linux"))]
+mod tests {
+    /// A noisy reference and a test image differing from it everywhere, tightly packed RGB8.
+    pub(crate) fn test_pair(width: u32, height: u32) -> (Vec<u8>, Vec<u8>) {
+        let noise = |step: u32| {
+            (0..width * height * 3)
+                .map(|i| (i * step % 256) as u8)
+                .collect()
+        };
+        (noise(7), noise(13))
+    }
+}
@@ -0,0 +1,681 @@
+//! Images in shared memory, for handing frames between processes without copying them.
+//!
+//! [`SharedImage`] is a single RGB8 image in a memfd. [`FrameRing`] is a ring of frame slots
+//! in a memfd or a POSIX shared memory object, for a producer, such as a capture process,
+//! handing frames to a consumer, such as a comparison process. Both hand out plain byte
+//! slices over the mapping, which go straight into functions like
+//! [`nv_flip::flip_statistics`] without a copy.
+//!
+//! Slices are only handed out over memory that no other process may touch while they are
+//! borrowed. The ring guarantees that with its counters; for [`SharedImage`] it is up to the
+//! processes sharing it, so its slice accessors are unsafe.
+//!
+//! Memfds are shared by passing their file descriptor, as [`crate::daemon`] does, or by
+//! inheriting it. Named rings are found by name instead.
+
+use std::ffi::CString;
+use std::fs::File;
+use std::io;
+use std::ops::{Deref, DerefMut};
+use std::os::unix::io::{AsFd, AsRawFd, BorrowedFd, FromRawFd, OwnedFd};
+use std::sync::atomic::{AtomicU64, Ordering};
+
+/// A single RGB8 image in a memfd.
+///
+/// Data is stored in row-major order, from the top left, tightly packed, without alpha.
+/// Images created here have their size sealed, as [`crate::daemon`] requires.
+pub struct SharedImage {
+    fd: OwnedFd,
+    mapping: Mapping,
+    width: u32,
+    height: u32,
+}
+
+impl SharedImage {
+    /// Creates a black image in a new memfd.
+    pub fn new(width: u32, height: u32) -> io::Result<Self> {
+        let fd = memfd(image_len(width, height))?;
+        Self::from_fd(fd, width, height)
+    }
+
+    /// Creates an image in a new memfd, holding a copy of `data`.
+    ///
+    /// # Panics
+    ///
+    /// - If the data is not large enough to fill the image.
+    pub fn with_data(width: u32, height: u32, data: &[u8]) -> io::Result<Self> {
+        let len = image_len(width, height);
+        assert!(data.len() >= len);
+        let mut image = Self::new(width, height)?;
+        // SAFETY: The memfd is new, no other process has seen it yet.
+        unsafe { image.as_mut_slice() }.copy_from_slice(&data[..len]);
+        Ok(image)
+    }
+
+    /// Maps an image shared by another process. The file must be open for reading and
+    /// writing, as memfds are, and large enough to hold the image.
+    pub fn from_fd(fd: OwnedFd, width: u32, height: u32) -> io::Result<Self> {
+        let mapping = Mapping::new(&fd, true)?;
+        if mapping.len < image_len(width, height) {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidInput,
+                format!(
+                    "file of {} bytes is too small for {width}x{height}",
+                    mapping.len
+                ),
+            ));
+        }
+        Ok(Self {
+            fd,
+            mapping,
+            width,
+            height,
+        })
+    }
+
+    /// Returns the file descriptor to pass to another process.
+    pub fn fd(&self) -> BorrowedFd<'_> {
+        self.fd.as_fd()
+    }
+
+    /// Returns the width of the image.
+    pub fn width(&self) -> u32 {
+        self.width
+    }
+
+    /// Returns the height of the image.
+    pub fn height(&self) -> u32 {
+        self.height
+    }
+
+    /// Returns a pointer to the pixels, which other processes may read and write at any time.
+    pub fn as_ptr(&self) -> *const u8 {
+        self.mapping.ptr.cast()
+    }
+
+    /// Returns a mutable pointer to the pixels, which other processes may read and write at
+    /// any time.
+    pub fn as_mut_ptr(&mut self) -> *mut u8 {
+        self.mapping.ptr.cast()
+    }
+
+    /// Returns the pixels.
+    ///
+    /// # Safety
+    ///
+    /// No process, including this one through another mapping of the same file, may write
+    /// the pixels while the returned slice is alive.
+    pub unsafe fn as_slice(&self) -> &[u8] {
+        self.mapping.slice(0..image_len(self.width, self.height))
+    }
+
+    /// Returns the pixels for writing.
+    ///
+    /// # Safety
+    ///
+    /// No process, including this one through another mapping of the same file, may read or
+    /// write the pixels while the returned slice is alive.
+    pub unsafe fn as_mut_slice(&mut self) -> &mut [u8] {
+        self.mapping
+            .slice_mut(0..image_len(self.width, self.height))
+    }
+}
+
+// SAFETY: The mapping is owned by the handle, and the pixels are only reachable through
+// raw pointers or the unsafe slice accessors, whose contract covers other threads too.
+unsafe impl Send for SharedImage {}
+unsafe impl Sync for SharedImage {}
+
+/// A ring of RGB8 frame slots in shared memory, with one producer and one consumer.
+///
+/// The producer fills a slot from [`Self::try_write`] and publishes it, the consumer reads
+/// it from [`Self::try_read`] and releases it. Handoff is two counters in the shared header,
+/// so neither side ever blocks or makes a system call: when the ring is full or empty the
+/// `try_` functions return `None`, and the caller decides whether to spin, yield or sleep.
+///
+/// There must be one producer and one consumer handle across all processes. Taking slots
+/// requires `&mut self`, so each handle has at most one slot out at a time.
+pub struct FrameRing {
+    fd: OwnedFd,
+    mapping: Mapping,
+    width: u32,
+    height: u32,
+    slots: u32,
+    unlink_name: Option<CString>,
+}
+
+const RING_MAGIC: u64 = u64::from_le_bytes(*b"FLIPRNG1");
+/// Frames start at a page boundary after the header.
+const RING_DATA_OFFSET: usize = 4096;
+
+#[repr(C, align(64))]
+struct CacheLine<T>(T);
+
+#[repr(C)]
+struct RingHeader {
+    // Stored last, so that a ring opened by name while being created isn't read half written.
+    magic: AtomicU64,
+    width: u32,
+    height: u32,
+    slots: u32,
+    // Written by the producer only: number of frames published.
+    head: CacheLine<AtomicU64>,
+    // Written by the consumer only: number of frames released.
+    tail: CacheLine<AtomicU64>,
+}
+
+impl FrameRing {
+    /// Creates a ring of `slots` frames in a new memfd.
+    ///
+    /// # Panics
+    ///
+    /// - If `slots` is 0.
+    pub fn new(width: u32, height: u32, slots: u32) -> io::Result<Self> {
+        assert!(slots > 0);
+        let fd = memfd(ring_len(width, height, slots))?;
+        Self::init(fd, width, height, slots, None)
+    }
+
+    /// Creates a ring of `slots` frames in a new POSIX shared memory object, which other
+    /// processes open with [`Self::open_named`]. The name is removed when this handle is
+    /// dropped; handles already open keep working.
+    ///
+    /// Unlike memfds, shared memory objects can't be sealed: any process that can open the
+    /// name can also truncate the object, and the next access to the ring then kills every
+    /// process using it with `SIGBUS`. Only use named rings between trusted processes.
+    ///
+    /// `name` must start with a `/` and contain no other slashes.
+    ///
+    /// # Panics
+    ///
+    /// - If `slots` is 0.
+    pub fn new_named(name: &str, width: u32, height: u32, slots: u32) -> io::Result<Self> {
+        assert!(slots > 0);
+        let name = shm_name(name)?;
+        let fd = unsafe {
+            libc::shm_open(
+                name.as_ptr(),
+                libc::O_RDWR | libc::O_CREAT | libc::O_EXCL | libc::O_CLOEXEC,
+                0o600,
+            )
+        };
+        if fd < 0 {
+            return Err(io::Error::last_os_error());
+        }
+        let file = unsafe { File::from_raw_fd(fd) };
+        if let Err(error) = file.set_len(ring_len(width, height, slots) as u64) {
+            unsafe { libc::shm_unlink(name.as_ptr()) };
+            return Err(error);
+        }
+        Self::init(file.into(), width, height, slots, Some(name))
+    }
+
+    /// Opens a ring created by another process with [`Self::new`], from its file descriptor.
+    ///
+    /// The file must be sealed against shrinking, so that the other process can't pull the
+    /// mapping out from under this one.
+    pub fn from_fd(fd: OwnedFd) -> io::Result<Self> {
+        if seals(fd.as_fd())? & libc::F_SEAL_SHRINK == 0 {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidInput,
+                "frame ring file not sealed against shrinking",
+            ));
+        }
+        Self::open(fd)
+    }
+
+    /// Opens a ring created by another process with [`Self::new_named`]. See there for the
+    /// risks of named rings.
+    pub fn open_named(name: &str) -> io::Result<Self> {
+        Self::open(open_shm(&shm_name(name)?)?)
+    }
+
+    fn open(fd: OwnedFd) -> io::Result<Self> {
+        let mapping = Mapping::new(&fd, true)?;
+        let invalid = |message: &str| io::Error::new(io::ErrorKind::InvalidData, message);
+        if mapping.len < RING_DATA_OFFSET {
+            return Err(invalid("file too small for a frame ring"));
+        }
+        let header = unsafe { &*(mapping.ptr as *const RingHeader) };
+        if header.magic.load(Ordering::Acquire) != RING_MAGIC {
+            return Err(invalid("not a frame ring"));
+        }
+        let (width, height, slots) = (header.width, header.height, header.slots);
+        if slots == 0 || mapping.len < ring_len(width, height, slots) {
+            return Err(invalid("frame ring file too small for its header"));
+        }
+        Ok(Self {
+            fd,
+            mapping,
+            width,
+            height,
+            slots,
+            unlink_name: None,
+        })
+    }
+
+    fn init(
+        fd: OwnedFd,
+        width: u32,
+        height: u32,
+        slots: u32,
+        unlink_name: Option<CString>,
+    ) -> io::Result<Self> {
+        let mapping = Mapping::new(&fd, true)?;
+        // The file is fresh and zeroed, and nobody else has seen it yet.
+        unsafe {
+            (mapping.ptr as *mut RingHeader).write(RingHeader {
+                magic: AtomicU64::new(0),
+                width,
+                height,
+                slots,
+                head: CacheLine(AtomicU64::new(0)),
+                tail: CacheLine(AtomicU64::new(0)),
+            });
+        }
+        let header = unsafe { &*(mapping.ptr as *const RingHeader) };
+        header.magic.store(RING_MAGIC, Ordering::Release);
+        Ok(Self {
+            fd,
+            mapping,
+            width,
+            height,
+            slots,
+            unlink_name,
+        })
+    }
+
+    /// Returns the file descriptor to pass to the other process.
+    pub fn fd(&self) -> BorrowedFd<'_> {
+        self.fd.as_fd()
+    }
+
+    /// Returns the width of every frame.
+    pub fn width(&self) -> u32 {
+        self.width
+    }
+
+    /// Returns the height of every frame.
+    pub fn height(&self) -> u32 {
+        self.height
+    }
+
+    /// Returns the number of frame slots.
+    pub fn slots(&self) -> u32 {
+        self.slots
+    }
+
+    /// Takes the next free slot for the producer to fill, or None if the consumer hasn't
+    /// released any. The frame is handed to the consumer with [`FrameWrite::publish`].
+    pub fn try_write(&mut self) -> Option<FrameWrite<'_>> {
+        let header = self.header();
+        let head = header.head.0.load(Ordering::Relaxed);
+        // Acquire: the consumer is done reading the slot before we overwrite it. A tail
+        // ahead of the head, from a misbehaving consumer, wraps around to a full ring.
+        let used = head.wrapping_sub(header.tail.0.load(Ordering::Acquire));
+        if used >= u64::from(self.slots) {
+            return None;
+        }
+        Some(FrameWrite { ring: self, head })
+    }
+
+    /// Takes the oldest published frame for the consumer to read, or None if there is none.
+    /// The slot is handed back to the producer when the returned frame is dropped.
+    pub fn try_read(&mut self) -> Option<FrameRead<'_>> {
+        let header = self.header();
+        let tail = header.tail.0.load(Ordering::Relaxed);
+        // Acquire: the producer's writes to the slot are visible before we read it.
+        if header.head.0.load(Ordering::Acquire) == tail {
+            return None;
+        }
+        Some(FrameRead { ring: self, tail })
+    }
+
+    fn header(&self) -> &RingHeader {
+        unsafe { &*(self.mapping.ptr as *const RingHeader) }
+    }
+
+    fn slot_range(&self, frame: u64) -> std::ops::Range<usize> {
+        let start = RING_DATA_OFFSET
+            + (frame % u64::from(self.slots)) as usize * slot_stride(self.width, self.height);
+        start..start + image_len(self.width, self.height)
+    }
+}
+
+impl Drop for FrameRing {
+    fn drop(&mut self) {
+        if let Some(name) = &self.unlink_name {
+            unsafe { libc::shm_unlink(name.as_ptr()) };
+        }
+    }
+}
+
+// SAFETY: The mapping is only reachable through the handle, and the shared header is
+// only touched atomically.
+unsafe impl Send for FrameRing {}
+
+/// A frame slot being filled by the producer, see [`FrameRing::try_write`].
+///
+/// Dereferences to the frame's pixels. Dropping it without publishing leaves the slot free.
+pub struct FrameWrite<'a> {
+    ring: &'a mut FrameRing,
+    head: u64,
+}
+
+impl FrameWrite<'_> {
+    /// Hands the frame to the consumer.
+    pub fn publish(self) {
+        // Release: our writes to the slot are visible to the consumer's acquire.
+        self.ring
+            .header()
+            .head
+            .0
+            .store(self.head + 1, Ordering::Release);
+    }
+}
+
+impl Deref for FrameWrite<'_> {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        // SAFETY: The consumer released the slot and doesn't touch it until it's published.
+        unsafe { self.ring.mapping.slice(self.ring.slot_range(self.head)) }
+    }
+}
+
+impl DerefMut for FrameWrite<'_> {
+    fn deref_mut(&mut self) -> &mut [u8] {
+        // SAFETY: As above, and `&mut self` keeps other borrows of the slot out.
+        unsafe { self.ring.mapping.slice_mut(self.ring.slot_range(self.head)) }
+    }
+}
+
+/// A published frame being read by the consumer, see [`FrameRing::try_read`].
+///
+/// Dereferences to the frame's pixels. Dropping it hands the slot back to the producer.
+pub struct FrameRead<'a> {
+    ring: &'a mut FrameRing,
+    tail: u64,
+}
+
+impl Deref for FrameRead<'_> {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        // SAFETY: The producer published the slot and doesn't touch it until it's released.
+        unsafe { self.ring.mapping.slice(self.ring.slot_range(self.tail)) }
+    }
+}
+
+impl Drop for FrameRead<'_> {
+    fn drop(&mut self) {
+        // Release: our reads of the slot are done before the producer's acquire.
+        self.ring
+            .header()
+            .tail
+            .0
+            .store(self.tail + 1, Ordering::Release);
+    }
+}
+
+fn image_len(width: u32, height: u32) -> usize {
+    width as usize * height as usize * 3
+}
+
+/// Slots are cache line aligned, so that neighbouring frames don't share lines.
+fn slot_stride(width: u32, height: u32) -> usize {
+    image_len(width, height).div_ceil(64) * 64
+}
+
+fn ring_len(width: u32, height: u32, slots: u32) -> usize {
+    RING_DATA_OFFSET + slots as usize * slot_stride(width, height)
+}
+
+fn shm_name(name: &str) -> io::Result<CString> {
+    if !name.starts_with('/') || name[1..].contains('/') {
+        return Err(io::Error::new(
+            io::ErrorKind::InvalidInput,
+            "shared memory names start with a single slash",
+        ));
+    }
+    CString::new(name).map_err(|error| io::Error::new(io::ErrorKind::InvalidInput, error))
+}
+
+fn open_shm(name: &CString) -> io::Result<OwnedFd> {
+    let fd = unsafe { libc::shm_open(name.as_ptr(), libc::O_RDWR | libc::O_CLOEXEC, 0) };
+    if fd < 0 {
+        return Err(io::Error::last_os_error());
+    }
+    Ok(unsafe { OwnedFd::from_raw_fd(fd) })
+}
+
+/// Creates an anonymous file of `len` zero bytes. Its size is sealed, so that a process
+/// mapping it can rely on all of it staying there.
+pub(crate) fn memfd(len: usize) -> io::Result<OwnedFd> {
+    let fd = unsafe {
+        libc::memfd_create(
+            c"nv-flip-image".as_ptr(),
+            libc::MFD_CLOEXEC | libc::MFD_ALLOW_SEALING,
+        )
+    };
+    if fd < 0 {
+        return Err(io::Error::last_os_error());
+    }
+    let file = unsafe { File::from_raw_fd(fd) };
+    file.set_len(len as u64)?;
+    let fd = OwnedFd::from(file);
+    add_seals(fd.as_fd(), libc::F_SEAL_SHRINK | libc::F_SEAL_GROW)?;
+    Ok(fd)
+}
+
+/// Adds `F_SEAL_*` flags to a memfd created with sealing allowed.
+pub(crate) fn add_seals(fd: BorrowedFd<'_>, seals: libc::c_int) -> io::Result<()> {
+    if unsafe { libc::fcntl(fd.as_raw_fd(), libc::F_ADD_SEALS, seals) } != 0 {
+        return Err(io::Error::last_os_error());
+    }
+    Ok(())
+}
+
+/// Returns the `F_SEAL_*` flags of a file, 0 for files that can't be sealed.
+pub(crate) fn seals(fd: BorrowedFd<'_>) -> io::Result<libc::c_int> {
+    let seals = unsafe { libc::fcntl(fd.as_raw_fd(), libc::F_GET_SEALS) };
+    if seals >= 0 {
+        return Ok(seals);
+    }
+    let error = io::Error::last_os_error();
+    if error.raw_os_error() == Some(libc::EINVAL) {
+        return Ok(0);
+    }
+    Err(error)
+}
+
+/// A shared mapping of a whole file.
+pub(crate) struct Mapping {
+    ptr: *mut libc::c_void,
+    len: usize,
+}
+
+impl Mapping {
+    pub(crate) fn new(fd: &OwnedFd, writable: bool) -> io::Result<Self> {
+        let mut stat = std::mem::MaybeUninit::<libc::stat>::uninit();
+        if unsafe { libc::fstat(fd.as_raw_fd(), stat.as_mut_ptr()) } != 0 {
+            return Err(io::Error::last_os_error());
+        }
+        let len = unsafe { stat.assume_init() }.st_size as usize;
+        if len == 0 {
+            return Ok(Self {
+                ptr: std::ptr::null_mut(),
+                len,
+            });
+        }
+        let protection = if writable {
+            libc::PROT_READ | libc::PROT_WRITE
+        } else {
+            libc::PROT_READ
+        };
+        let ptr = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                len,
+                protection,
+                libc::MAP_SHARED,
+                fd.as_raw_fd(),
+                0,
+            )
+        };
+        if ptr == libc::MAP_FAILED {
+            return Err(io::Error::last_os_error());
+        }
+        Ok(Self { ptr, len })
+    }
+
+    pub(crate) fn len(&self) -> usize {
+        self.len
+    }
+
+    /// Borrows part of the mapping. Never the whole mapping at once, parts of it may be
+    /// in use by other processes.
+    ///
+    /// # Safety
+    ///
+    /// Nothing may write the range while the slice is alive.
+    ///
+    /// # Panics
+    ///
+    /// - If the range is outside of the mapping.
+    pub(crate) unsafe fn slice(&self, range: std::ops::Range<usize>) -> &[u8] {
+        assert!(range.start <= range.end && range.end <= self.len);
+        if range.is_empty() {
+            return &[];
+        }
+        std::slice::from_raw_parts(self.ptr.cast::<u8>().add(range.start), range.len())
+    }
+
+    /// Copies part of the mapping out. Never borrows the range, so other processes writing
+    /// it meanwhile only make the copy meaningless.
+    ///
+    /// # Panics
+    ///
+    /// - If the range is outside of the mapping.
+    pub(crate) fn copy(&self, range: std::ops::Range<usize>) -> Vec<u8> {
+        assert!(range.start <= range.end && range.end <= self.len);
+        let mut copy = Vec::with_capacity(range.len());
+        if !range.is_empty() {
+            unsafe {
+                std::ptr::copy_nonoverlapping(
+                    self.ptr.cast::<u8>().add(range.start),
+                    copy.as_mut_ptr(),
+                    range.len(),
+                );
+                copy.set_len(range.len());
+            }
+        }
+        copy
+    }
+
+    /// Borrows part of a mapping created writable.
+    ///
+    /// # Safety
+    ///
+    /// Nothing else may read or write the range while the slice is alive.
+    ///
+    /// # Panics
+    ///
+    /// - If the range is outside of the mapping.
+    #[allow(clippy::mut_from_ref)]
+    unsafe fn slice_mut(&self, range: std::ops::Range<usize>) -> &mut [u8] {
+        assert!(range.start <= range.end && range.end <= self.len);
+        if range.is_empty() {
+            return &mut [];
+        }
+        std::slice::from_raw_parts_mut(self.ptr.cast::<u8>().add(range.start), range.len())
+    }
+}
+
+// SAFETY: The mapping is owned, borrowing from it goes through the unsafe accessors.
+unsafe impl Send for Mapping {}
+
+impl Drop for Mapping {
+    fn drop(&mut self) {
+        if self.len != 0 {
+            unsafe {
+                libc::munmap(self.ptr, self.len);
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn shared_image() {
+        let data: Vec<u8> = (0..4 * 3 * 3).map(|i| i as u8).collect();
+        let image = SharedImage::with_data(4, 3, &data).unwrap();
+        let mut view =
+            SharedImage::from_fd(image.fd().try_clone_to_owned().unwrap(), 4, 3).unwrap();
+        // SAFETY: Both handles are only used from this thread, one at a time.
+        unsafe {
+            assert_eq!(view.as_slice(), &data[..]);
+            view.as_mut_slice()[0] = 200;
+            assert_eq!(image.as_slice()[0], 200);
+        }
+        assert!(SharedImage::from_fd(image.fd().try_clone_to_owned().unwrap(), 4, 4).is_err());
+        let file = File::from(image.fd().try_clone_to_owned().unwrap());
+        assert!(file.set_len(1).is_err());
+    }
+
+    #[test]
+    fn frame_ring() {
+        let (width, height) = (20, 10);
+        let mut producer = FrameRing::new(width, height, 2).unwrap();
+        // A second mapping, as another process would have.
+        let mut consumer = FrameRing::from_fd(producer.fd().try_clone_to_owned().unwrap()).unwrap();
+        assert_eq!(
+            (consumer.width(), consumer.height(), consumer.slots()),
+            (20, 10, 2)
+        );
+        assert!(consumer.try_read().is_none());
+
+        let unsealed = unsafe { libc::memfd_create(c"unsealed".as_ptr(), libc::MFD_CLOEXEC) };
+        let unsealed = File::from(unsafe { OwnedFd::from_raw_fd(unsealed) });
+        unsealed.set_len(4096).unwrap();
+        assert!(FrameRing::from_fd(unsealed.into()).is_err());
+
+        for value in 1..=2 {
+            let mut frame = producer.try_write().unwrap();
+            frame.fill(value);
+            frame.publish();
+        }
+        assert!(producer.try_write().is_none());
+        let frame = consumer.try_read().unwrap();
+        assert!(frame.iter().all(|&v| v == 1));
+        drop(frame);
+
+        // Dropping an unpublished frame hands nothing over.
+        producer.try_write().unwrap().fill(9);
+        let frame = consumer.try_read().unwrap();
+        assert!(frame.iter().all(|&v| v == 2));
+        let statistics = nv_flip::flip_statistics(width, height, &frame, &frame, 67.0);
+        assert_eq!(statistics.mean, 0.0);
+        drop(frame);
+        assert!(consumer.try_read().is_none());
+
+        let mut frame = producer.try_write().unwrap();
+        frame.fill(3);
+        frame.publish();
+        assert!(consumer.try_read().unwrap().iter().all(|&v| v == 3));
+    }
+
+    #[test]
+    fn named_frame_ring() {
+        let name = format!("/nv-flip-test-{}", std::process::id());
+        let mut producer = FrameRing::new_named(&name, 4, 4, 1).unwrap();
+        let mut consumer = FrameRing::open_named(&name).unwrap();
+        producer.try_write().unwrap().publish();
+        assert!(consumer.try_read().is_some());
+        drop(producer);
+        assert!(FrameRing::open_named(&name).is_err());
+    }
+}
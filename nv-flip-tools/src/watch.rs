@@ -0,0 +1,462 @@
+//! Incremental re-comparison of a directory of test images against a directory of
+//! references, driven by inotify.
+//!
+//! Images are paired by file name. When a file is written, only its pair is compared again,
+//! and only if the file's contents changed: files are hashed before anything else is done
+//! with them, so rewriting identical output costs a read and a hash. The last few results of
+//! every pair are kept by content hashes, so switching back to contents compared before,
+//! such as when toggling a change, doesn't compare again either. Decoded references are
+//! kept, so a changed test image only pays for decoding itself and the comparison.
+
+use std::collections::hash_map::DefaultHasher;
+use std::collections::{BTreeMap, HashMap, HashSet};
+use std::ffi::{CStr, CString, OsStr, OsString};
+use std::hash::Hasher;
+use std::io;
+use std::os::unix::ffi::OsStrExt;
+use std::os::unix::io::{AsRawFd, FromRawFd, OwnedFd};
+use std::path::{Path, PathBuf};
+use std::sync::Arc;
+
+use nv_flip::FlipStatistics;
+
+/// Which of the two directories a file is in.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub enum Side {
+    Reference,
+    Test,
+}
+
+/// A decoded RGB8 image.
+///
+/// Data is expected in row-major order, from the top left, tightly packed. Do not include alpha.
+pub struct DecodedImage {
+    pub width: u32,
+    pub height: u32,
+    pub data: Vec<u8>,
+}
+
+/// What happened to a pair after a file changed.
+#[derive(Debug, Clone, PartialEq)]
+pub enum Update {
+    /// Both images are present and were compared.
+    Compared(FlipStatistics),
+    /// One of the images couldn't be read or decoded, or they differ in size.
+    Failed(String),
+    /// One of the images was removed, so the pair has no result anymore.
+    Removed,
+}
+
+/// Latest comparison of every pair of images in two directories.
+pub struct Comparisons<D> {
+    reference_dir: PathBuf,
+    test_dir: PathBuf,
+    pixels_per_degree: f32,
+    decode: D,
+    pairs: HashMap<OsString, Pair>,
+}
+
+#[derive(Default)]
+struct Pair {
+    reference: Option<FileState>,
+    test: Option<FileState>,
+    /// Content hashes of the (reference, test) files the last update was for.
+    compared: Option<(u64, u64)>,
+    /// Results by content hashes, most recent last.
+    results: Vec<((u64, u64), FlipStatistics)>,
+}
+
+/// Results kept per pair.
+const KEPT_RESULTS: usize = 4;
+
+struct FileState {
+    hash: u64,
+    /// Only kept for references, tests are compared right away.
+    image: Option<Arc<DecodedImage>>,
+}
+
+impl<D: FnMut(&[u8]) -> Result<DecodedImage, String>> Comparisons<D> {
+    /// Creates an empty set of comparisons, decoding image files with `decode`.
+    pub fn new(
+        reference_dir: impl Into<PathBuf>,
+        test_dir: impl Into<PathBuf>,
+        pixels_per_degree: f32,
+        decode: D,
+    ) -> Self {
+        Self {
+            reference_dir: reference_dir.into(),
+            test_dir: test_dir.into(),
+            pixels_per_degree,
+            decode,
+            pairs: HashMap::new(),
+        }
+    }
+
+    /// Returns the directory of the given side.
+    pub fn dir(&self, side: Side) -> &Path {
+        match side {
+            Side::Reference => &self.reference_dir,
+            Side::Test => &self.test_dir,
+        }
+    }
+
+    /// Reads every file in both directories, returning the updated pairs sorted by name.
+    /// Files seen before that are gone now are handled as removed.
+    ///
+    /// Call this again whenever changes may have been missed, such as after
+    /// [`Event::Overflow`].
+    pub fn scan(&mut self) -> io::Result<Vec<(OsString, Update)>> {
+        let mut updates = BTreeMap::new();
+        for side in [Side::Reference, Side::Test] {
+            let mut names = HashSet::new();
+            for entry in std::fs::read_dir(self.dir(side))? {
+                let entry = entry?;
+                if entry.file_type()?.is_file() {
+                    names.insert(entry.file_name());
+                }
+            }
+            let known = self.pairs.iter().filter(|(_, pair)| match side {
+                Side::Reference => pair.reference.is_some(),
+                Side::Test => pair.test.is_some(),
+            });
+            let gone: Vec<OsString> = known
+                .map(|(name, _)| name.clone())
+                .filter(|name| !names.contains(name))
+                .collect();
+            for name in names.into_iter().chain(gone) {
+                if let Some(update) = self.file_changed(side, &name) {
+                    updates.insert(name, update);
+                }
+            }
+        }
+        Ok(updates.into_iter().collect())
+    }
+
+    /// Handles a file written, created or removed. Returns None if its pair didn't change:
+    /// the contents are the same as before, or the other image of the pair is missing.
+    pub fn file_changed(&mut self, side: Side, name: &OsStr) -> Option<Update> {
+        let path = self.dir(side).join(name);
+        let Self {
+            reference_dir,
+            test_dir,
+            pixels_per_degree,
+            decode,
+            pairs,
+        } = self;
+        let pair = pairs.entry(name.to_owned()).or_default();
+        let state = match side {
+            Side::Reference => &mut pair.reference,
+            Side::Test => &mut pair.test,
+        };
+
+        let contents = match std::fs::read(&path) {
+            Ok(contents) => contents,
+            Err(error) if error.kind() == io::ErrorKind::NotFound => {
+                let removed = state.take().is_some() && pair.compared.take().is_some();
+                if pair.reference.is_none() && pair.test.is_none() {
+                    pairs.remove(name);
+                }
+                return removed.then_some(Update::Removed);
+            }
+            Err(error) => {
+                *state = None;
+                pair.compared = None;
+                return Some(Update::Failed(format!("{}: {error}", path.display())));
+            }
+        };
+        let hash = content_hash(&contents);
+        if state.as_ref().map(|state| state.hash) == Some(hash) {
+            return None;
+        }
+        *state = Some(FileState { hash, image: None });
+
+        let (Some(reference), Some(test)) = (&pair.reference, &pair.test) else {
+            return None;
+        };
+        let hashes = (reference.hash, test.hash);
+        if pair.compared == Some(hashes) {
+            return None;
+        }
+        pair.compared = Some(hashes);
+        if let Some(index) = pair.results.iter().position(|(key, _)| *key == hashes) {
+            let result = pair.results.remove(index);
+            pair.results.push(result);
+            return Some(Update::Compared(result.1));
+        }
+
+        // Either the reference changed and has to be decoded, or it is decoded already
+        // and only the test image is read.
+        let reference = match pair
+            .reference
+            .as_ref()
+            .and_then(|state| state.image.clone())
+        {
+            Some(image) => image,
+            None => {
+                let contents = if side == Side::Reference {
+                    Ok(contents.clone())
+                } else {
+                    std::fs::read(reference_dir.join(name)).map_err(|error| error.to_string())
+                };
+                match contents.and_then(|contents| decode(&contents)) {
+                    Ok(image) => {
+                        let image = Arc::new(image);
+                        pair.reference.as_mut().unwrap().image = Some(Arc::clone(&image));
+                        image
+                    }
+                    Err(error) => return Some(Update::Failed(format!("reference: {error}"))),
+                }
+            }
+        };
+        let test = if side == Side::Test {
+            Ok(contents)
+        } else {
+            std::fs::read(test_dir.join(name)).map_err(|error| error.to_string())
+        };
+        let test = match test.and_then(|contents| decode(&contents)) {
+            Ok(test) => test,
+            Err(error) => return Some(Update::Failed(format!("test: {error}"))),
+        };
+        if (test.width, test.height) != (reference.width, reference.height) {
+            return Some(Update::Failed(format!(
+                "size mismatch: reference is {}x{}, test is {}x{}",
+                reference.width, reference.height, test.width, test.height
+            )));
+        }
+
+        let statistics = nv_flip::flip_statistics(
+            reference.width,
+            reference.height,
+            &reference.data,
+            &test.data,
+            *pixels_per_degree,
+        );
+        if pair.results.len() == KEPT_RESULTS {
+            pair.results.remove(0);
+        }
+        pair.results.push((hashes, statistics));
+        Some(Update::Compared(statistics))
+    }
+}
+
+fn content_hash(contents: &[u8]) -> u64 {
+    let mut hasher = DefaultHasher::new();
+    hasher.write(contents);
+    hasher.finish()
+}
+
+/// A change reported by [`DirectoryWatch::wait`].
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub enum Event {
+    /// A file changed, in the directory of the given index.
+    File(usize, OsString),
+    /// The kernel's event queue overflowed and changes were dropped. Every directory has to
+    /// be scanned again, see [`Comparisons::scan`].
+    Overflow,
+}
+
+/// Files finished being written to, moved into or removed from a set of directories.
+pub struct DirectoryWatch {
+    fd: OwnedFd,
+    /// Watch descriptor to index of the directory in the list it was created with.
+    dirs: HashMap<i32, usize>,
+}
+
+impl DirectoryWatch {
+    /// Starts watching the directories.
+    pub fn new(dirs: &[&Path]) -> io::Result<Self> {
+        let fd = unsafe { libc::inotify_init1(libc::IN_CLOEXEC) };
+        if fd < 0 {
+            return Err(io::Error::last_os_error());
+        }
+        let fd = unsafe { OwnedFd::from_raw_fd(fd) };
+
+        let mut watches = HashMap::new();
+        for (index, dir) in dirs.iter().enumerate() {
+            let path = CString::new(dir.as_os_str().as_bytes())
+                .map_err(|error| io::Error::new(io::ErrorKind::InvalidInput, error))?;
+            // Writes are picked up when the file is closed, not on every partial write.
+            let mask =
+                libc::IN_CLOSE_WRITE | libc::IN_MOVED_TO | libc::IN_MOVED_FROM | libc::IN_DELETE;
+            let watch = unsafe { libc::inotify_add_watch(fd.as_raw_fd(), path.as_ptr(), mask) };
+            if watch < 0 {
+                return Err(io::Error::last_os_error());
+            }
+            watches.insert(watch, index);
+        }
+        Ok(Self { fd, dirs: watches })
+    }
+
+    /// Blocks until files changed, returning the changes in order.
+    pub fn wait(&mut self) -> io::Result<Vec<Event>> {
+        // Room for many events at once, aligned for inotify_event.
+        let mut buffer = vec![0u64; 4096];
+        let read = loop {
+            let read = unsafe {
+                libc::read(
+                    self.fd.as_raw_fd(),
+                    buffer.as_mut_ptr().cast(),
+                    std::mem::size_of_val(&buffer[..]),
+                )
+            };
+            if read >= 0 {
+                break read as usize;
+            }
+            let error = io::Error::last_os_error();
+            if error.kind() != io::ErrorKind::Interrupted {
+                return Err(error);
+            }
+        };
+
+        let bytes = unsafe { std::slice::from_raw_parts(buffer.as_ptr().cast::<u8>(), read) };
+        let mut changes = Vec::new();
+        let mut offset = 0;
+        while offset < read {
+            let event = unsafe {
+                std::ptr::read_unaligned(bytes[offset..].as_ptr().cast::<libc::inotify_event>())
+            };
+            let name_start = offset + std::mem::size_of::<libc::inotify_event>();
+            offset = name_start + event.len as usize;
+            if event.mask & libc::IN_Q_OVERFLOW != 0 {
+                changes.push(Event::Overflow);
+                continue;
+            }
+            if event.mask & libc::IN_ISDIR != 0 || event.len == 0 {
+                continue;
+            }
+            let Some(&dir) = self.dirs.get(&event.wd) else {
+                continue;
+            };
+            // The name is padded with nuls to the event length.
+            let name = CStr::from_bytes_until_nul(&bytes[name_start..offset])
+                .map_err(|error| io::Error::new(io::ErrorKind::InvalidData, error))?;
+            changes.push(Event::File(
+                dir,
+                OsStr::from_bytes(name.to_bytes()).to_owned(),
+            ));
+        }
+        Ok(changes)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    // Two bytes of size, then the pixels.
+    fn decode(contents: &[u8]) -> Result<DecodedImage, String> {
+        match contents {
+            [width, height, data @ ..] if data.len() == *width as usize * *height as usize * 3 => {
+                Ok(DecodedImage {
+                    width: *width as u32,
+                    height: *height as u32,
+                    data: data.to_vec(),
+                })
+            }
+            _ => Err("bad image".to_owned()),
+        }
+    }
+
+    /// The reference or the test image of the shared test pair, encoded for [`decode`].
+    fn encode(width: u8, height: u8, test: bool) -> Vec<u8> {
+        let (reference, test_image) = crate::tests::test_pair(width.into(), height.into());
+        let pixels = if test { test_image } else { reference };
+        [width, height].into_iter().chain(pixels).collect()
+    }
+
+    #[test]
+    fn incremental_comparisons() {
+        let root = std::env::temp_dir().join(format!("nv-flip-watch-{}", std::process::id()));
+        let (reference_dir, test_dir) = (root.join("reference"), root.join("test"));
+        std::fs::create_dir_all(&reference_dir).unwrap();
+        std::fs::create_dir_all(&test_dir).unwrap();
+        let mut watch = DirectoryWatch::new(&[&reference_dir, &test_dir]).unwrap();
+
+        std::fs::write(reference_dir.join("a"), encode(8, 8, false)).unwrap();
+        std::fs::write(test_dir.join("a"), encode(8, 8, false)).unwrap();
+        std::fs::write(reference_dir.join("b"), encode(8, 8, false)).unwrap();
+        let mut comparisons = Comparisons::new(&reference_dir, &test_dir, 67.0, decode);
+        let updates = comparisons.scan().unwrap();
+        assert_eq!(updates.len(), 1);
+        assert!(matches!(&updates[0], (name, Update::Compared(s)) if name == "a" && s.mean == 0.0));
+
+        // Rewriting the same contents changes nothing.
+        std::fs::write(test_dir.join("a"), encode(8, 8, false)).unwrap();
+        assert_eq!(comparisons.file_changed(Side::Test, OsStr::new("a")), None);
+
+        std::fs::write(test_dir.join("a"), encode(8, 8, true)).unwrap();
+        let expected = nv_flip::flip_statistics(
+            8,
+            8,
+            &encode(8, 8, false)[2..],
+            &encode(8, 8, true)[2..],
+            67.0,
+        );
+        assert_eq!(
+            comparisons.file_changed(Side::Test, OsStr::new("a")),
+            Some(Update::Compared(expected))
+        );
+        std::fs::write(test_dir.join("b"), encode(4, 4, false)).unwrap();
+        assert!(matches!(
+            comparisons.file_changed(Side::Test, OsStr::new("b")),
+            Some(Update::Failed(_))
+        ));
+        std::fs::remove_file(reference_dir.join("a")).unwrap();
+        assert_eq!(
+            comparisons.file_changed(Side::Reference, OsStr::new("a")),
+            Some(Update::Removed)
+        );
+
+        // inotify merges an event into an identical one still queued, like the two rewrites.
+        let mut changes = Vec::new();
+        while changes.len() < 6 {
+            changes.extend(watch.wait().unwrap());
+            changes.dedup();
+        }
+        let expected = [(0, "a"), (1, "a"), (0, "b"), (1, "a"), (1, "b"), (0, "a")];
+        assert_eq!(
+            changes,
+            expected.map(|(dir, name)| Event::File(dir, OsString::from(name)))
+        );
+        std::fs::remove_dir_all(&root).unwrap();
+    }
+
+    #[test]
+    fn kept_results_and_rescan() {
+        let root = std::env::temp_dir().join(format!("nv-flip-rescan-{}", std::process::id()));
+        let (reference_dir, test_dir) = (root.join("reference"), root.join("test"));
+        std::fs::create_dir_all(&reference_dir).unwrap();
+        std::fs::create_dir_all(&test_dir).unwrap();
+        let decodes = std::cell::Cell::new(0);
+        let counting_decode = |contents: &[u8]| {
+            decodes.set(decodes.get() + 1);
+            decode(contents)
+        };
+
+        std::fs::write(reference_dir.join("a"), encode(8, 8, false)).unwrap();
+        std::fs::write(test_dir.join("a"), encode(8, 8, false)).unwrap();
+        let mut comparisons = Comparisons::new(&reference_dir, &test_dir, 67.0, counting_decode);
+        let first = comparisons.scan().unwrap();
+        std::fs::write(test_dir.join("a"), encode(8, 8, true)).unwrap();
+        assert!(comparisons
+            .file_changed(Side::Test, OsStr::new("a"))
+            .is_some());
+        assert_eq!(decodes.get(), 3);
+
+        // Switching back to compared contents reuses the result.
+        std::fs::write(test_dir.join("a"), encode(8, 8, false)).unwrap();
+        assert_eq!(
+            comparisons.file_changed(Side::Test, OsStr::new("a")),
+            Some(first[0].1.clone())
+        );
+        assert_eq!(decodes.get(), 3);
+
+        // A scan picks up removals it wasn't told about.
+        std::fs::remove_file(test_dir.join("a")).unwrap();
+        assert_eq!(
+            comparisons.scan().unwrap(),
+            vec![(OsString::from("a"), Update::Removed)]
+        );
+        std::fs::remove_dir_all(&root).unwrap();
+    }
+}
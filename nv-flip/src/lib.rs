@@ -83,7 +83,10 @@
 //! [ꟻLIP]: https://github.com/NVlabs/flip
 //! [Unsplash License]: https://unsplash.com/license
 
-use std::marker::PhantomData;
+use std::{marker::PhantomData, mem::ManuallyDrop, ops::Range};
+
+#[cfg(feature = "rayon")]
+use rayon::prelude::*;
 
 pub use nv_flip_sys::{pixels_per_degree, DEFAULT_PIXELS_PER_DEGREE};
 
@@ -96,6 +99,8 @@ pub struct FlipImageRgb8 {
     height: u32,
 }
 
+// SAFETY: The image owns its allocation and the native library keeps no global mutable state.
+// Every function taking a `*const` or reading through a `*mut` from `&self` only reads the image.
 unsafe impl Send for FlipImageRgb8 {}
 unsafe impl Sync for FlipImageRgb8 {}
 
@@ -143,6 +148,97 @@ impl FlipImageRgb8 {
         }
     }
 
+    /// Creates a new image from a planar Y'CbCr (YUV) frame, such as a decoded video frame.
+    ///
+    /// Chroma is upsampled bilinearly and converted straight to the float values FLIP works
+    /// on, in one pass, without rounding to Rgb8 in between.
+    ///
+    /// Planes are expected in row-major order, from the top left, tightly packed, see
+    /// [`FlipYuvFormat::plane_sizes`].
+    ///
+    /// # Panics
+    ///
+    /// - If the bit depth is not between 8 and 16.
+    /// - If a plane is not large enough to fill the image.
+    pub fn with_yuv(
+        width: u32,
+        height: u32,
+        format: FlipYuvFormat,
+        y_plane: &[u8],
+        u_plane: &[u8],
+        v_plane: &[u8],
+    ) -> Self {
+        assert!(
+            (8..=16).contains(&format.bit_depth),
+            "Unsupported bit depth"
+        );
+        let (luma_size, chroma_size) = format.plane_sizes(width, height);
+        assert!(y_plane.len() >= luma_size);
+        assert!(u_plane.len() >= chroma_size);
+        assert!(v_plane.len() >= chroma_size);
+
+        let image = Self::new(width, height);
+        let subsampling = match format.subsampling {
+            FlipChromaSubsampling::Yuv420 => {
+                nv_flip_sys::FlipImageChromaSubsampling_FlipImageChromaSubsampling420
+            }
+            FlipChromaSubsampling::Yuv422 => {
+                nv_flip_sys::FlipImageChromaSubsampling_FlipImageChromaSubsampling422
+            }
+            FlipChromaSubsampling::Yuv444 => {
+                nv_flip_sys::FlipImageChromaSubsampling_FlipImageChromaSubsampling444
+            }
+        };
+        let siting = match format.siting {
+            FlipChromaSiting::Center => {
+                nv_flip_sys::FlipImageChromaSiting_FlipImageChromaSitingCenter
+            }
+            FlipChromaSiting::Left => nv_flip_sys::FlipImageChromaSiting_FlipImageChromaSitingLeft,
+            FlipChromaSiting::TopLeft => {
+                nv_flip_sys::FlipImageChromaSiting_FlipImageChromaSitingTopLeft
+            }
+        };
+        let matrix = match format.matrix {
+            FlipYuvMatrix::Bt601 => nv_flip_sys::FlipImageYuvMatrix_FlipImageYuvMatrixBt601,
+            FlipYuvMatrix::Bt709 => nv_flip_sys::FlipImageYuvMatrix_FlipImageYuvMatrixBt709,
+            FlipYuvMatrix::Bt2020 => nv_flip_sys::FlipImageYuvMatrix_FlipImageYuvMatrixBt2020,
+        };
+        unsafe {
+            nv_flip_sys::flip_image_color3_set_yuv(
+                image.inner,
+                y_plane.as_ptr(),
+                u_plane.as_ptr(),
+                v_plane.as_ptr(),
+                subsampling,
+                siting,
+                format.bit_depth,
+                matrix,
+                format.full_range,
+            );
+        }
+        image
+    }
+
+    /// Parallel version of [`Self::with_data`], converting bands of rows on the rayon thread pool.
+    ///
+    /// # Panics
+    ///
+    /// - If the data is not large enough to fill the image.
+    #[cfg(feature = "rayon")]
+    pub fn par_with_data(width: u32, height: u32, data: &[u8]) -> Self {
+        let len = width as usize * height as usize * 3;
+        assert!(data.len() >= len);
+        let image = Self::new(width, height);
+        if len != 0 {
+            let rows = rows_per_task(width);
+            data[..len]
+                .par_chunks(rows as usize * width as usize * 3)
+                .enumerate()
+                .for_each(|(task, data)| unsafe { image.write_rows(task as u32 * rows, data) });
+        }
+        image
+    }
+
     /// Extracts the data from the image and returns it as a vector.
     ///
     /// Data is returned in row-major order, from the top left, tightly packed.
@@ -154,6 +250,41 @@ impl FlipImageRgb8 {
         data
     }
 
+    /// Parallel version of [`Self::to_vec`], converting bands of rows on the rayon thread pool.
+    #[cfg(feature = "rayon")]
+    pub fn par_to_vec(&self) -> Vec<u8> {
+        let mut data = vec![0u8; self.width as usize * self.height as usize * 3];
+        if !data.is_empty() {
+            let rows = rows_per_task(self.width);
+            data.par_chunks_mut(rows as usize * self.width as usize * 3)
+                .enumerate()
+                .for_each(|(task, data)| self.read_rows(task as u32 * rows, data));
+        }
+        data
+    }
+
+    /// Writes whole rows starting at `y_begin`. `data` must hold a whole number of rows.
+    ///
+    /// # Safety
+    ///
+    /// No other thread may be accessing the written rows at the same time.
+    #[cfg(feature = "rayon")]
+    unsafe fn write_rows(&self, y_begin: u32, data: &[u8]) {
+        let y_end = y_begin + (data.len() / (self.width as usize * 3)) as u32;
+        assert!(y_end <= self.height);
+        nv_flip_sys::flip_image_color3_set_rows(self.inner, y_begin, y_end, data.as_ptr());
+    }
+
+    /// Reads whole rows starting at `y_begin`. `data` must hold a whole number of rows.
+    #[cfg(feature = "rayon")]
+    fn read_rows(&self, y_begin: u32, data: &mut [u8]) {
+        let y_end = y_begin + (data.len() / (self.width as usize * 3)) as u32;
+        assert!(y_end <= self.height);
+        unsafe {
+            nv_flip_sys::flip_image_color3_get_rows(self.inner, y_begin, y_end, data.as_mut_ptr());
+        }
+    }
+
     /// Returns the width of the image.
     pub fn width(&self) -> u32 {
         self.width
@@ -173,6 +304,236 @@ impl Drop for FlipImageRgb8 {
     }
 }
 
+/// How the chroma planes of a Y'CbCr frame are subsampled.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub enum FlipChromaSubsampling {
+    /// Half width, half height.
+    Yuv420,
+    /// Half width, full height.
+    Yuv422,
+    /// Full width, full height.
+    Yuv444,
+}
+
+/// The matrix converting between Y'CbCr and RGB.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash, Default)]
+pub enum FlipYuvMatrix {
+    /// BT.601, used by standard definition video.
+    Bt601,
+    /// BT.709, used by high definition video.
+    #[default]
+    Bt709,
+    /// BT.2020 non-constant luminance, used by ultra high definition video.
+    Bt2020,
+}
+
+/// Where subsampled chroma samples sit relative to the luma samples they cover.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash, Default)]
+pub enum FlipChromaSiting {
+    /// In the middle, as in JPEG and MPEG-1.
+    #[default]
+    Center,
+    /// Horizontally with the left luma sample, vertically in the middle, as in MPEG-2 and
+    /// most later video codecs.
+    Left,
+    /// With the top left luma sample.
+    TopLeft,
+}
+
+/// Layout and encoding of a planar Y'CbCr frame.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub struct FlipYuvFormat {
+    pub subsampling: FlipChromaSubsampling,
+    /// Ignored for 4:4:4.
+    pub siting: FlipChromaSiting,
+    /// Bits per sample, 8 to 16. Samples of more than 8 bits take 2 bytes, little endian.
+    pub bit_depth: u32,
+    pub matrix: FlipYuvMatrix,
+    /// Whether samples span the full range, rather than the limited range of 16 to 235
+    /// (240 for chroma) scaled to the bit depth.
+    pub full_range: bool,
+}
+
+impl FlipYuvFormat {
+    /// Returns the size in bytes of the luma plane and of each chroma plane of a frame.
+    /// Chroma planes of odd sized frames are rounded up.
+    pub fn plane_sizes(&self, width: u32, height: u32) -> (usize, usize) {
+        let (x_factor, y_factor) = match self.subsampling {
+            FlipChromaSubsampling::Yuv420 => (2, 2),
+            FlipChromaSubsampling::Yuv422 => (2, 1),
+            FlipChromaSubsampling::Yuv444 => (1, 1),
+        };
+        let sample_size = if self.bit_depth > 8 { 2 } else { 1 };
+        let chroma = width.div_ceil(x_factor) as usize * height.div_ceil(y_factor) as usize;
+        (
+            width as usize * height as usize * sample_size,
+            chroma * sample_size,
+        )
+    }
+}
+
+/// Reads the frames of a Y4M (YUV4MPEG2) video as images to compare.
+///
+/// Frames are read and converted on a background thread, so the next frame is ready as
+/// soon as the current one is compared. Interlacing and aspect ratio are ignored.
+/// Supported color spaces are 4:2:0, 4:2:2 and 4:4:4 at 8 bits and, with the `p10`
+/// style suffixes, up to 16 bits. Limited range is assumed unless the file has
+/// `XCOLORRANGE=FULL`. Chroma siting follows the color space, except that `420paldv`, whose
+/// Cb and Cr sit on alternating lines, is approximated as [`FlipChromaSiting::TopLeft`].
+///
+/// ```rust,no_run
+/// let file = std::fs::File::open("reference.y4m").unwrap();
+/// let reference = nv_flip::FlipY4mReader::new(file).unwrap();
+/// let file = std::fs::File::open("encoded.y4m").unwrap();
+/// let test = nv_flip::FlipY4mReader::new(file).unwrap();
+/// for (reference, test) in reference.zip(test) {
+///     let error_map = nv_flip::flip(reference.unwrap(), test.unwrap(), 67.0);
+///     println!("{}", nv_flip::FlipPool::from_image(&error_map).mean());
+/// }
+/// ```
+pub struct FlipY4mReader {
+    width: u32,
+    height: u32,
+    format: FlipYuvFormat,
+    frames: std::sync::mpsc::Receiver<std::io::Result<FlipImageRgb8>>,
+}
+
+impl FlipY4mReader {
+    /// Reads the stream header and starts reading frames, assuming the BT.709 matrix.
+    pub fn new(reader: impl std::io::Read + Send + 'static) -> std::io::Result<Self> {
+        Self::with_matrix(reader, FlipYuvMatrix::Bt709)
+    }
+
+    /// Reads the stream header and starts reading frames with the given matrix, which Y4M
+    /// files don't record.
+    pub fn with_matrix(
+        reader: impl std::io::Read + Send + 'static,
+        matrix: FlipYuvMatrix,
+    ) -> std::io::Result<Self> {
+        use std::io::{BufRead, Read};
+
+        let invalid =
+            |message: String| std::io::Error::new(std::io::ErrorKind::InvalidData, message);
+        let mut reader = std::io::BufReader::new(reader);
+        let mut header = Vec::new();
+        reader.read_until(b'\n', &mut header)?;
+        let header = String::from_utf8_lossy(&header);
+        let mut parameters = header
+            .trim_end()
+            .strip_prefix("YUV4MPEG2")
+            .ok_or_else(|| invalid("not a Y4M stream".to_owned()))?
+            .split(' ')
+            .filter(|parameter| !parameter.is_empty());
+
+        let (mut width, mut height) = (None, None);
+        let mut format = FlipYuvFormat {
+            subsampling: FlipChromaSubsampling::Yuv420,
+            siting: FlipChromaSiting::Center,
+            bit_depth: 8,
+            matrix,
+            full_range: false,
+        };
+        for parameter in &mut parameters {
+            let mut chars = parameter.chars();
+            let tag = chars.next();
+            let value = chars.as_str();
+            match tag {
+                Some('W') => width = value.parse::<u32>().ok(),
+                Some('H') => height = value.parse::<u32>().ok(),
+                Some('C') => {
+                    // Deeper samples are marked with a suffix like `p10`, unlike `420paldv`.
+                    let (subsampling, depth) = match value.rsplit_once('p') {
+                        Some((subsampling, depth)) if depth.parse::<u32>().is_ok() => {
+                            (subsampling, depth.parse().ok())
+                        }
+                        _ => (value, Some(8)),
+                    };
+                    // PAL DV alternates Cb and Cr between lines, approximated as top left.
+                    (format.subsampling, format.siting) = match subsampling {
+                        "420" | "420jpeg" => {
+                            (FlipChromaSubsampling::Yuv420, FlipChromaSiting::Center)
+                        }
+                        "420mpeg2" => (FlipChromaSubsampling::Yuv420, FlipChromaSiting::Left),
+                        "420paldv" => (FlipChromaSubsampling::Yuv420, FlipChromaSiting::TopLeft),
+                        "422" => (FlipChromaSubsampling::Yuv422, FlipChromaSiting::Center),
+                        "444" => (FlipChromaSubsampling::Yuv444, FlipChromaSiting::Center),
+                        _ => return Err(invalid(format!("unsupported Y4M color space {value}"))),
+                    };
+                    format.bit_depth = depth
+                        .filter(|depth| (8..=16).contains(depth))
+                        .ok_or_else(|| invalid(format!("unsupported Y4M color space {value}")))?;
+                }
+                Some('X') => format.full_range |= value == "COLORRANGE=FULL",
+                Some(tag) if !tag.is_ascii() => {
+                    return Err(invalid(format!("invalid Y4M header parameter {parameter}")))
+                }
+                _ => {}
+            }
+        }
+        let (Some(width), Some(height)) = (width, height) else {
+            return Err(invalid("Y4M header without frame size".to_owned()));
+        };
+
+        let (luma_size, chroma_size) = format.plane_sizes(width, height);
+        // One frame waits in the channel while the thread already reads the next.
+        let (sender, frames) = std::sync::mpsc::sync_channel(1);
+        std::thread::spawn(move || loop {
+            let mut line = Vec::new();
+            let frame = match reader.read_until(b'\n', &mut line) {
+                Ok(0) => return,
+                Ok(_) if !line.starts_with(b"FRAME") => {
+                    Err(invalid("missing Y4M frame header".to_owned()))
+                }
+                Ok(_) => {
+                    let mut data = vec![0; luma_size + 2 * chroma_size];
+                    reader.read_exact(&mut data).map(|()| {
+                        let (y_plane, chroma) = data.split_at(luma_size);
+                        let (u_plane, v_plane) = chroma.split_at(chroma_size);
+                        FlipImageRgb8::with_yuv(width, height, format, y_plane, u_plane, v_plane)
+                    })
+                }
+                Err(error) => Err(error),
+            };
+            let failed = frame.is_err();
+            if sender.send(frame).is_err() || failed {
+                return;
+            }
+        });
+
+        Ok(Self {
+            width,
+            height,
+            format,
+            frames,
+        })
+    }
+
+    /// Returns the width of every frame.
+    pub fn width(&self) -> u32 {
+        self.width
+    }
+
+    /// Returns the height of every frame.
+    pub fn height(&self) -> u32 {
+        self.height
+    }
+
+    /// Returns the format of the frames as stored in the stream.
+    pub fn format(&self) -> FlipYuvFormat {
+        self.format
+    }
+}
+
+impl Iterator for FlipY4mReader {
+    type Item = std::io::Result<FlipImageRgb8>;
+
+    /// Returns the next frame, waiting for it if the background thread isn't done yet.
+    /// After an error no more frames are returned.
+    fn next(&mut self) -> Option<Self::Item> {
+        self.frames.recv().ok()
+    }
+}
+
 /// 2D FLIP image that stores a single float per pixel.
 pub struct FlipImageFloat {
     inner: *mut nv_flip_sys::FlipImageFloat,
@@ -180,6 +541,7 @@ pub struct FlipImageFloat {
     height: u32,
 }
 
+// SAFETY: See `FlipImageRgb8`.
 unsafe impl Send for FlipImageFloat {}
 unsafe impl Sync for FlipImageFloat {}
 
@@ -226,6 +588,26 @@ impl FlipImageFloat {
         }
     }
 
+    /// Parallel version of [`Self::with_data`], copying bands of rows on the rayon thread pool.
+    ///
+    /// # Panics
+    ///
+    /// - If the data is not large enough to fill the image.
+    #[cfg(feature = "rayon")]
+    pub fn par_with_data(width: u32, height: u32, data: &[f32]) -> Self {
+        let len = width as usize * height as usize;
+        assert!(data.len() >= len);
+        let image = Self::new(width, height);
+        if len != 0 {
+            let rows = rows_per_task(width);
+            data[..len]
+                .par_chunks(rows as usize * width as usize)
+                .enumerate()
+                .for_each(|(task, data)| unsafe { image.write_rows(task as u32 * rows, data) });
+        }
+        image
+    }
+
     /// Applies the given 1D color lut to turn this single channel values into 3 channel values.
     ///
     /// Applies the following algorithm to each pixel:
@@ -261,6 +643,91 @@ impl FlipImageFloat {
         data
     }
 
+    /// Parallel version of [`Self::to_vec`], copying bands of rows on the rayon thread pool.
+    #[cfg(feature = "rayon")]
+    pub fn par_to_vec(&self) -> Vec<f32> {
+        let mut data = vec![0f32; self.width as usize * self.height as usize];
+        if !data.is_empty() {
+            let rows = rows_per_task(self.width);
+            data.par_chunks_mut(rows as usize * self.width as usize)
+                .enumerate()
+                .for_each(|(task, data)| self.read_rows(task as u32 * rows, data));
+        }
+        data
+    }
+
+    /// Writes whole rows starting at `y_begin`. `data` must hold a whole number of rows.
+    ///
+    /// # Safety
+    ///
+    /// No other thread may be accessing the written rows at the same time.
+    #[cfg(feature = "rayon")]
+    unsafe fn write_rows(&self, y_begin: u32, data: &[f32]) {
+        let y_end = y_begin + (data.len() / self.width as usize) as u32;
+        assert!(y_end <= self.height);
+        nv_flip_sys::flip_image_float_set_rows(self.inner, y_begin, y_end, data.as_ptr());
+    }
+
+    /// Reads whole rows starting at `y_begin`. `data` must hold a whole number of rows.
+    #[cfg(feature = "rayon")]
+    fn read_rows(&self, y_begin: u32, data: &mut [f32]) {
+        let y_end = y_begin + (data.len() / self.width as usize) as u32;
+        assert!(y_end <= self.height);
+        unsafe {
+            nv_flip_sys::flip_image_float_get_rows(self.inner, y_begin, y_end, data.as_mut_ptr());
+        }
+    }
+
+    /// Returns the fraction of values above each of the given thresholds, in a single
+    /// pass over the image.
+    ///
+    /// Returns 0.0 for every threshold if the image is empty.
+    pub fn exceedance(&self, thresholds: &[f32]) -> Vec<f64> {
+        self.exceedance_with_cdf(thresholds, 0).0
+    }
+
+    /// Returns the cumulative distribution of the values over `bucket_count` equal buckets
+    /// covering [0, 1]: element `i` is the fraction of values below `(i + 1) / bucket_count`.
+    /// Values outside of [0, 1] count towards the first or last bucket, so the last
+    /// element is 1.0.
+    ///
+    /// Returns all 0.0 if the image is empty.
+    pub fn cdf(&self, bucket_count: usize) -> Vec<f64> {
+        self.exceedance_with_cdf(&[], bucket_count).1
+    }
+
+    /// Computes both [`Self::exceedance`] and [`Self::cdf`] in a single pass over the image.
+    pub fn exceedance_with_cdf(
+        &self,
+        thresholds: &[f32],
+        bucket_count: usize,
+    ) -> (Vec<f64>, Vec<f64>) {
+        let mut exceeding = vec![0u64; thresholds.len()];
+        let mut cdf = vec![0u64; bucket_count];
+        unsafe {
+            nv_flip_sys::flip_image_float_threshold_counts(
+                self.inner,
+                thresholds.as_ptr(),
+                thresholds.len(),
+                exceeding.as_mut_ptr(),
+                bucket_count,
+                cdf.as_mut_ptr(),
+            );
+        }
+        let count = self.width as f64 * self.height as f64;
+        let fraction = |value: u64| {
+            if count > 0.0 {
+                value as f64 / count
+            } else {
+                0.0
+            }
+        };
+        (
+            exceeding.into_iter().map(fraction).collect(),
+            cdf.into_iter().map(fraction).collect(),
+        )
+    }
+
     /// Returns the width of the image.
     pub fn width(&self) -> u32 {
         self.width
@@ -280,6 +747,16 @@ impl Drop for FlipImageFloat {
     }
 }
 
+/// Amount of pixels each rayon task converts in one FFI call.
+#[cfg(feature = "rayon")]
+const PIXELS_PER_TASK: u32 = 16 * 1024;
+
+/// Amount of whole rows each rayon task converts in one FFI call.
+#[cfg(feature = "rayon")]
+fn rows_per_task(width: u32) -> u32 {
+    (PIXELS_PER_TASK / width.max(1)).max(1)
+}
+
 /// Generates a 1D lut using the builtin magma colormap for mapping error values to colors.
 pub fn magma_lut() -> FlipImageRgb8 {
     let inner = unsafe { nv_flip_sys::flip_image_color3_magma_map() };
@@ -335,122 +812,713 @@ pub fn flip(
     error_map
 }
 
-/// Bucket based histogram used internally by [`FlipPool`].
+/// Which terms of the FLIP error to compute.
 ///
-/// Generally you should not need to use this directly and any mutating
-/// operations are unsafe to prevent violating FlipPool invariants.
-pub struct FlipHistogram<'a> {
-    inner: *mut nv_flip_sys::FlipImageHistogramRef,
-    _phantom: PhantomData<&'a ()>,
+/// FLIP's error combines a color term and a feature term as `color ^ (1 - feature)`.
+/// Checks that only look for one kind of difference can skip the other half of the work.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash, Default)]
+pub enum FlipComponents {
+    /// Only the color term: differences between the colors as perceived at the given
+    /// pixels per degree.
+    Color,
+    /// Only the feature term: differences between the edges and points in the luminance.
+    Feature,
+    /// The full FLIP error, the same as [`flip`].
+    #[default]
+    Both,
 }
-impl<'a> FlipHistogram<'a> {
-    /// Returns the difference between the maximum and minimum bucket values.
-    pub fn bucket_size(&self) -> usize {
-        unsafe { nv_flip_sys::flip_image_histogram_ref_get_bucket_size(self.inner) }
+
+/// Performs a FLIP comparison between the two images, computing only the given components.
+///
+/// With [`FlipComponents::Both`] this is the same as [`flip`]. Otherwise each pixel of the
+/// returned map holds that term of the error, between 0 and 1.
+///
+/// Consumes both images as the algorithm uses them for scratch space.
+///
+/// # Panics
+///
+/// - If the images are not the same size.
+pub fn flip_with_components(
+    reference_image: FlipImageRgb8,
+    test_image: FlipImageRgb8,
+    pixels_per_degree: f32,
+    components: FlipComponents,
+) -> FlipImageFloat {
+    assert_eq!(
+        reference_image.width(),
+        test_image.width(),
+        "Width mismatch between reference and test image"
+    );
+    assert_eq!(
+        reference_image.height(),
+        test_image.height(),
+        "Height mismatch between reference and test image"
+    );
+
+    let error_map = FlipImageFloat::new(reference_image.width(), reference_image.height());
+    unsafe {
+        nv_flip_sys::flip_image_float_flip_components(
+            error_map.inner,
+            reference_image.inner,
+            test_image.inner,
+            pixels_per_degree,
+            components.to_sys(),
+        );
     }
+    error_map
+}
 
-    /// Returns the index of the lowest bucket currently in use.
-    ///
-    /// If no buckets are in use, returns None.
-    pub fn bucket_id_min(&self) -> Option<usize> {
-        let value = unsafe { nv_flip_sys::flip_image_histogram_ref_get_bucket_id_min(self.inner) };
-        if value == usize::MAX {
-            None
-        } else {
-            Some(value)
+impl FlipComponents {
+    fn to_sys(self) -> nv_flip_sys::FlipImageComponents {
+        match self {
+            Self::Color => nv_flip_sys::FlipImageComponents_FlipImageComponentsColor,
+            Self::Feature => nv_flip_sys::FlipImageComponents_FlipImageComponentsFeature,
+            Self::Both => nv_flip_sys::FlipImageComponents_FlipImageComponentsBoth,
         }
     }
+}
 
-    /// Returns the index of the highest bucket currently in use.
-    ///
-    /// If no buckets are in use, returns 0.
-    pub fn bucket_id_max(&self) -> usize {
-        unsafe { nv_flip_sys::flip_image_histogram_ref_get_bucket_id_max(self.inner) }
-    }
+/// Performs a FLIP comparison between two single channel images, such as depth
+/// visualizations, ambient occlusion buffers or shadow masks.
+///
+/// The result is exactly the same as comparing RGB images with the gray value in every
+/// channel. With [`FlipComponents::Color`] or [`FlipComponents::Feature`] the images are never
+/// expanded, and the color term skips the chroma filters, as gray has no chroma.
+/// [`FlipComponents::Both`] runs FLIP's full pipeline, so it only saves building RGB buffers.
+///
+/// Data is expected in row-major order, from the top left, tightly packed.
+///
+/// # Panics
+///
+/// - If either data slice is not `width * height` long.
+pub fn flip_gray_u8(
+    width: u32,
+    height: u32,
+    reference_data: &[u8],
+    test_data: &[u8],
+    pixels_per_degree: f32,
+    components: FlipComponents,
+) -> FlipImageFloat {
+    let count = width as usize * height as usize;
+    assert_eq!(
+        reference_data.len(),
+        count,
+        "Reference data length mismatch"
+    );
+    assert_eq!(test_data.len(), count, "Test data length mismatch");
 
-    /// Returns the amount of values contained within a given bucket.
-    ///
-    /// # Panics
-    ///
-    /// - If the bucket_id is out of bounds.
-    pub fn bucket_value_count(&self, bucket_id: usize) -> usize {
-        assert!(bucket_id < self.bucket_count());
-        unsafe { nv_flip_sys::flip_image_histogram_ref_get_bucket_value(self.inner, bucket_id) }
+    let error_map = FlipImageFloat::new(width, height);
+    unsafe {
+        nv_flip_sys::flip_image_float_flip_gray8(
+            error_map.inner,
+            reference_data.as_ptr(),
+            test_data.as_ptr(),
+            pixels_per_degree,
+            components.to_sys(),
+        );
     }
+    error_map
+}
 
-    /// Returns the amount of buckets in the histogram.
-    pub fn bucket_count(&self) -> usize {
-        unsafe { nv_flip_sys::flip_image_histogram_ref_size(self.inner) }
-    }
+/// Performs a FLIP comparison between two single channel images with values in `[0, 1]`.
+///
+/// The same as [`flip_gray_u8`], with float values instead of bytes.
+///
+/// # Panics
+///
+/// - If either data slice is not `width * height` long.
+pub fn flip_gray_f32(
+    width: u32,
+    height: u32,
+    reference_data: &[f32],
+    test_data: &[f32],
+    pixels_per_degree: f32,
+    components: FlipComponents,
+) -> FlipImageFloat {
+    let count = width as usize * height as usize;
+    assert_eq!(
+        reference_data.len(),
+        count,
+        "Reference data length mismatch"
+    );
+    assert_eq!(test_data.len(), count, "Test data length mismatch");
 
-    /// Returns the smallest value the histogram can handle.
-    pub fn minimum_allowed_value(&self) -> f32 {
-        unsafe { nv_flip_sys::flip_image_histogram_ref_get_min_value(self.inner) }
+    let error_map = FlipImageFloat::new(width, height);
+    unsafe {
+        nv_flip_sys::flip_image_float_flip_gray32f(
+            error_map.inner,
+            reference_data.as_ptr(),
+            test_data.as_ptr(),
+            pixels_per_degree,
+            components.to_sys(),
+        );
     }
+    error_map
+}
 
-    /// Returns the largest value the histogram can handle.
-    pub fn maximum_allowed_value(&self) -> f32 {
-        unsafe { nv_flip_sys::flip_image_histogram_ref_get_max_value(self.inner) }
-    }
+/// Token to stop a running [`flip_cancellable`] comparison, for example from another thread.
+///
+/// Clones share the same state: cancelling one cancels all of them.
+#[derive(Clone)]
+pub struct FlipCancelToken {
+    inner: std::sync::Arc<CancelTokenHandle>,
+}
 
-    /// Clears the histogram of all values
-    ///
-    /// # Safety
-    ///
-    /// Due to the many invariants between the histogram and the pool,
-    /// we do not provide any safty guarentees when mutating the histogram.
-    pub unsafe fn clear(&mut self) {
-        unsafe {
-            nv_flip_sys::flip_image_histogram_ref_clear(self.inner);
-        }
-    }
+struct CancelTokenHandle(*mut nv_flip_sys::FlipImageCancelToken);
 
-    /// Resizes the histogram to have `bucket_size` buckets.
-    ///
-    /// # Safety
-    ///
-    /// Due to the many invariants between the histogram and the pool,
-    /// we do not provide any safty guarentees when mutating the histogram.
-    pub unsafe fn resize(&mut self, bucket_size: usize) {
+// SAFETY: The native token is a single atomic flag.
+unsafe impl Send for CancelTokenHandle {}
+unsafe impl Sync for CancelTokenHandle {}
+
+impl Drop for CancelTokenHandle {
+    fn drop(&mut self) {
         unsafe {
-            nv_flip_sys::flip_image_histogram_ref_resize(self.inner, bucket_size);
+            nv_flip_sys::flip_image_cancel_token_free(self.0);
         }
     }
+}
 
-    /// Returns which bucket a given value would fall into.
-    pub fn bucket_id(&self, value: f32) -> usize {
-        unsafe { nv_flip_sys::flip_image_histogram_ref_value_bucket_id(self.inner, value) }
+impl FlipCancelToken {
+    /// Creates a new token that is not cancelled.
+    pub fn new() -> Self {
+        let inner = unsafe { nv_flip_sys::flip_image_cancel_token_new() };
+        assert!(!inner.is_null());
+        Self {
+            inner: std::sync::Arc::new(CancelTokenHandle(inner)),
+        }
     }
 
-    /// Includes `count` instances of the following `value` in the histogram.
-    ///
-    /// # Safety
-    ///
-    /// Due to the many invariants between the histogram and the pool,
-    /// we do not provide any safty guarentees when mutating the histogram.
-    pub unsafe fn include_value(&mut self, value: f32, count: usize) {
+    /// Cancels every comparison using this token. There is no way to undo this.
+    pub fn cancel(&self) {
         unsafe {
-            nv_flip_sys::flip_image_histogram_ref_inc_value(self.inner, value, count);
+            nv_flip_sys::flip_image_cancel_token_cancel(self.inner.0);
         }
     }
 
-    /// Includes one instance of each value in the given image in the histogram.
-    ///
-    /// # Safety
-    ///
-    /// Due to the many invariants between the histogram and the pool,
+    /// Returns true once [`Self::cancel`] was called on this token or one of its clones.
+    pub fn is_cancelled(&self) -> bool {
+        unsafe { nv_flip_sys::flip_image_cancel_token_is_cancelled(self.inner.0) }
+    }
+}
+
+impl Default for FlipCancelToken {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// Performs a FLIP comparison between two Rgb8 buffers that can be stopped part way.
+///
+/// The comparison runs in bands of rows. Before every band `token` is checked, and after
+/// every band `progress` is called with the fraction of rows done so far, which can return
+/// false to stop as well. Scratch images are freed as soon as the comparison stops.
+///
+/// Returns the same error map as [`flip`], or `None` if the comparison was stopped.
+///
+/// Data is expected in row-major order, from the top left, tightly packed. Do not include alpha.
+///
+/// # Panics
+///
+/// - If either buffer is not large enough to fill the image.
+/// - If `progress` panics, after the comparison has stopped.
+pub fn flip_cancellable<F: FnMut(f32) -> bool>(
+    width: u32,
+    height: u32,
+    reference_data: &[u8],
+    test_data: &[u8],
+    pixels_per_degree: f32,
+    token: Option<&FlipCancelToken>,
+    progress: F,
+) -> Option<FlipImageFloat> {
+    struct Progress<F> {
+        callback: F,
+        panic: Option<Box<dyn std::any::Any + Send>>,
+    }
+
+    unsafe extern "C" fn trampoline<F: FnMut(f32) -> bool>(
+        user_data: *mut std::os::raw::c_void,
+        progress: f32,
+    ) -> bool {
+        let state = unsafe { &mut *(user_data as *mut Progress<F>) };
+        // Unwinding into native code is not allowed, the panic is resumed once it returns.
+        match std::panic::catch_unwind(std::panic::AssertUnwindSafe(|| (state.callback)(progress)))
+        {
+            Ok(keep_going) => keep_going,
+            Err(panic) => {
+                state.panic = Some(panic);
+                false
+            }
+        }
+    }
+
+    let len = width as usize * height as usize * 3;
+    assert!(reference_data.len() >= len);
+    assert!(test_data.len() >= len);
+
+    let error_map = FlipImageFloat::new(width, height);
+    let mut state = Progress {
+        callback: progress,
+        panic: None,
+    };
+    let finished = unsafe {
+        nv_flip_sys::flip_image_float_flip_rgb8_cancellable(
+            error_map.inner,
+            reference_data.as_ptr(),
+            test_data.as_ptr(),
+            pixels_per_degree,
+            token.map_or(std::ptr::null(), |token| token.inner.0),
+            Some(trampoline::<F>),
+            &mut state as *mut Progress<F> as *mut std::os::raw::c_void,
+        )
+    };
+    if let Some(panic) = state.panic {
+        std::panic::resume_unwind(panic);
+    }
+    finished.then_some(error_map)
+}
+
+/// Error map of a comparison that skipped identical regions, as returned by [`flip_guided`].
+pub struct FlipGuided {
+    /// Error map, identical to the one [`flip`] returns.
+    pub error_map: FlipImageFloat,
+    /// Number of pixels FLIP was evaluated at. All other pixels have identical inputs
+    /// over the whole reach of FLIP's filters, so their error is exactly 0.
+    pub evaluated_pixel_count: usize,
+}
+
+/// Performs a FLIP comparison between two Rgb8 buffers, only evaluating FLIP where
+/// the inputs differ.
+///
+/// A cheap prepass takes the largest absolute difference of every 32x32 tile of the
+/// raw data. FLIP is evaluated on the tiles that have a difference within the reach
+/// of its filters, every other tile is set to 0 without evaluation. The result is the
+/// same as that of [`flip`], at a fraction of the cost when most of the image matches,
+/// like renders that only differ in a few objects.
+///
+/// Data is expected in row-major order, from the top left, tightly packed. Do not include alpha.
+///
+/// # Panics
+///
+/// - If either buffer is not large enough to fill the image.
+pub fn flip_guided(
+    width: u32,
+    height: u32,
+    reference_data: &[u8],
+    test_data: &[u8],
+    pixels_per_degree: f32,
+) -> FlipGuided {
+    let len = width as usize * height as usize * 3;
+    assert!(reference_data.len() >= len);
+    assert!(test_data.len() >= len);
+
+    let error_map = FlipImageFloat::new(width, height);
+    let evaluated_pixel_count = unsafe {
+        nv_flip_sys::flip_image_float_flip_guided_rgb8(
+            error_map.inner,
+            reference_data.as_ptr(),
+            test_data.as_ptr(),
+            pixels_per_degree,
+        )
+    };
+    FlipGuided {
+        error_map,
+        evaluated_pixel_count,
+    }
+}
+
+/// Summary statistics of an error map, as returned by [`flip_statistics`].
+///
+/// These are the same statistics shown by the command line tool.
+#[derive(Debug, Clone, Copy, PartialEq, Default)]
+pub struct FlipStatistics {
+    /// Mean error. The paper's writers recommend this if a single number is needed.
+    pub mean: f32,
+    /// Weighted 50th percentile, equal to `pool.get_percentile(0.5, true)`.
+    pub weighted_median: f32,
+    /// Weighted 25th percentile, equal to `pool.get_percentile(0.25, true)`.
+    pub first_weighted_quartile: f32,
+    /// Weighted 75th percentile, equal to `pool.get_percentile(0.75, true)`.
+    pub third_weighted_quartile: f32,
+    /// Smallest error value.
+    pub min_value: f32,
+    /// Largest error value.
+    pub max_value: f32,
+}
+
+impl FlipStatistics {
+    /// Returns the name and value of every field, in declaration order.
+    fn fields(&self) -> [(&'static str, f32); 6] {
+        [
+            ("mean", self.mean),
+            ("weighted_median", self.weighted_median),
+            ("first_weighted_quartile", self.first_weighted_quartile),
+            ("third_weighted_quartile", self.third_weighted_quartile),
+            ("min_value", self.min_value),
+            ("max_value", self.max_value),
+        ]
+    }
+}
+
+/// Performs a FLIP comparison between two Rgb8 buffers and returns the statistics
+/// of the error map, as if by [`flip`] followed by [`FlipPool::from_image`].
+///
+/// This is a single call into the native library which creates no handles. Scratch
+/// images are kept per thread and reused while the image size stays the same,
+/// which makes repeated comparisons of small images considerably cheaper. Scratch for
+/// images above 1920x1080 pixels is freed after the call, see also [`release_scratch`].
+///
+/// Data is expected in row-major order, from the top left, tightly packed. Do not include alpha.
+///
+/// All statistics are 0.0 for empty images.
+///
+/// # Panics
+///
+/// - If either buffer is not large enough to fill the image.
+pub fn flip_statistics(
+    width: u32,
+    height: u32,
+    reference_data: &[u8],
+    test_data: &[u8],
+    pixels_per_degree: f32,
+) -> FlipStatistics {
+    let len = width as usize * height as usize * 3;
+    assert!(reference_data.len() >= len);
+    assert!(test_data.len() >= len);
+
+    let mut statistics = std::mem::MaybeUninit::<nv_flip_sys::FlipImageStatistics>::uninit();
+    let statistics = unsafe {
+        nv_flip_sys::flip_image_statistics_from_rgb8(
+            width,
+            height,
+            reference_data.as_ptr(),
+            test_data.as_ptr(),
+            pixels_per_degree,
+            statistics.as_mut_ptr(),
+        );
+        statistics.assume_init()
+    };
+    FlipStatistics {
+        mean: statistics.mean,
+        weighted_median: statistics.weighted_median,
+        first_weighted_quartile: statistics.first_weighted_quartile,
+        third_weighted_quartile: statistics.third_weighted_quartile,
+        min_value: statistics.min_value,
+        max_value: statistics.max_value,
+    }
+}
+
+/// Performs a FLIP comparison between two Rgb8 buffers and returns only the mean error,
+/// the single number the paper's writers recommend.
+///
+/// Like [`flip_statistics`] this reuses per-thread scratch images, but it builds no pool:
+/// the error map is summed with compensated summation in double precision, so the result
+/// is more accurate than [`FlipPool::mean`] on large images. It still computes the full
+/// error map, so it is barely faster than [`flip_statistics`]; for a cheaper estimate see
+/// [`flip_sampled_mean`].
+///
+/// Data is expected in row-major order, from the top left, tightly packed. Do not include alpha.
+///
+/// Returns 0.0 for empty images.
+///
+/// # Panics
+///
+/// - If either buffer is not large enough to fill the image.
+pub fn flip_mean(
+    width: u32,
+    height: u32,
+    reference_data: &[u8],
+    test_data: &[u8],
+    pixels_per_degree: f32,
+) -> f32 {
+    let len = width as usize * height as usize * 3;
+    assert!(reference_data.len() >= len);
+    assert!(test_data.len() >= len);
+
+    unsafe {
+        nv_flip_sys::flip_image_mean_from_rgb8(
+            width,
+            height,
+            reference_data.as_ptr(),
+            test_data.as_ptr(),
+            pixels_per_degree,
+        )
+    }
+}
+
+/// Frees the scratch images [`flip_statistics`] and [`flip_mean`] keep on the calling thread.
+///
+/// The next call on this thread allocates them again.
+pub fn release_scratch() {
+    unsafe {
+        nv_flip_sys::flip_image_release_workspace();
+    }
+}
+
+/// Estimated mean error, as returned by [`flip_sampled_mean`] and [`flip_budgeted_mean`].
+#[derive(Debug, Clone, Copy, PartialEq, Default)]
+pub struct FlipSampledMean {
+    /// Estimate of the mean error.
+    pub mean: f32,
+    /// Standard error of the estimate.
+    pub standard_error: f32,
+    /// Lower end of the 95% confidence interval of the mean.
+    pub lower: f32,
+    /// Upper end of the 95% confidence interval of the mean.
+    pub upper: f32,
+    /// Number of pixels that were evaluated.
+    pub sample_count: usize,
+}
+
+impl From<nv_flip_sys::FlipImageSampledMean> for FlipSampledMean {
+    fn from(mean: nv_flip_sys::FlipImageSampledMean) -> Self {
+        Self {
+            mean: mean.mean,
+            standard_error: mean.standard_error,
+            lower: mean.lower,
+            upper: mean.upper,
+            sample_count: mean.sample_count as usize,
+        }
+    }
+}
+
+/// Estimates the mean error of a FLIP comparison between two Rgb8 buffers by only
+/// evaluating FLIP at about `sample_count` pixels.
+///
+/// The image is divided into a grid of about `sample_count` cells and one random pixel
+/// of each cell is compared, using only the inputs within the reach of FLIP's filters
+/// around it. The cost is proportional to the number of samples rather than the size
+/// of the image. The same `seed` always picks the same pixels.
+///
+/// The confidence interval assumes independent samples, so it is conservative. Once
+/// there are as many samples as pixels, every pixel is evaluated and the result is
+/// the exact mean with an empty interval.
+///
+/// Data is expected in row-major order, from the top left, tightly packed. Do not include alpha.
+///
+/// All fields are 0 for empty images or if `sample_count` is 0.
+///
+/// # Panics
+///
+/// - If either buffer is not large enough to fill the image.
+pub fn flip_sampled_mean(
+    width: u32,
+    height: u32,
+    reference_data: &[u8],
+    test_data: &[u8],
+    pixels_per_degree: f32,
+    sample_count: usize,
+    seed: u64,
+) -> FlipSampledMean {
+    let len = width as usize * height as usize * 3;
+    assert!(reference_data.len() >= len);
+    assert!(test_data.len() >= len);
+
+    let mut mean = std::mem::MaybeUninit::<nv_flip_sys::FlipImageSampledMean>::uninit();
+    let mean = unsafe {
+        nv_flip_sys::flip_image_sampled_mean_from_rgb8(
+            width,
+            height,
+            reference_data.as_ptr(),
+            test_data.as_ptr(),
+            pixels_per_degree,
+            sample_count,
+            seed,
+            mean.as_mut_ptr(),
+        );
+        mean.assume_init()
+    };
+    mean.into()
+}
+
+/// Estimates the mean error of a FLIP comparison between two Rgb8 buffers within a time budget.
+///
+/// A first small round of samples, as in [`flip_sampled_mean`], measures how long a
+/// sample takes. If a full comparison fits in the remaining budget, it is done and the
+/// exact mean is returned, with a `standard_error` of 0 and every pixel counted in
+/// `sample_count`. Otherwise rounds of twice as many samples run while they are expected
+/// to fit, and all rounds are combined. The confidence interval tells how good the
+/// estimate is.
+///
+/// The first round always runs, so tiny budgets may be exceeded by its cost.
+///
+/// Data is expected in row-major order, from the top left, tightly packed. Do not include alpha.
+///
+/// All fields are 0 for empty images.
+///
+/// # Panics
+///
+/// - If either buffer is not large enough to fill the image.
+pub fn flip_budgeted_mean(
+    width: u32,
+    height: u32,
+    reference_data: &[u8],
+    test_data: &[u8],
+    pixels_per_degree: f32,
+    budget: std::time::Duration,
+    seed: u64,
+) -> FlipSampledMean {
+    let len = width as usize * height as usize * 3;
+    assert!(reference_data.len() >= len);
+    assert!(test_data.len() >= len);
+
+    let mut mean = std::mem::MaybeUninit::<nv_flip_sys::FlipImageSampledMean>::uninit();
+    let mean = unsafe {
+        nv_flip_sys::flip_image_budgeted_mean_from_rgb8(
+            width,
+            height,
+            reference_data.as_ptr(),
+            test_data.as_ptr(),
+            pixels_per_degree,
+            budget.as_secs_f64(),
+            seed,
+            mean.as_mut_ptr(),
+        );
+        mean.assume_init()
+    };
+    mean.into()
+}
+
+/// Bucket based histogram used internally by [`FlipPool`].
+///
+/// Generally you should not need to use this directly and any mutating
+/// operations are unsafe to prevent violating FlipPool invariants.
+pub struct FlipHistogram<'a> {
+    inner: *mut nv_flip_sys::FlipImageHistogramRef,
+    _phantom: PhantomData<&'a ()>,
+}
+impl<'a> FlipHistogram<'a> {
+    /// Returns the difference between the maximum and minimum bucket values.
+    pub fn bucket_size(&self) -> usize {
+        unsafe { nv_flip_sys::flip_image_histogram_ref_get_bucket_size(self.inner) }
+    }
+
+    /// Returns the index of the lowest bucket currently in use.
+    ///
+    /// If no buckets are in use, returns None.
+    pub fn bucket_id_min(&self) -> Option<usize> {
+        let value = unsafe { nv_flip_sys::flip_image_histogram_ref_get_bucket_id_min(self.inner) };
+        if value == usize::MAX {
+            None
+        } else {
+            Some(value)
+        }
+    }
+
+    /// Returns the index of the highest bucket currently in use.
+    ///
+    /// If no buckets are in use, returns 0.
+    pub fn bucket_id_max(&self) -> usize {
+        unsafe { nv_flip_sys::flip_image_histogram_ref_get_bucket_id_max(self.inner) }
+    }
+
+    /// Returns the amount of values contained within a given bucket.
+    ///
+    /// # Panics
+    ///
+    /// - If the bucket_id is out of bounds.
+    pub fn bucket_value_count(&self, bucket_id: usize) -> usize {
+        assert!(bucket_id < self.bucket_count());
+        unsafe { nv_flip_sys::flip_image_histogram_ref_get_bucket_value(self.inner, bucket_id) }
+    }
+
+    /// Returns the amount of buckets in the histogram.
+    pub fn bucket_count(&self) -> usize {
+        unsafe { nv_flip_sys::flip_image_histogram_ref_size(self.inner) }
+    }
+
+    /// Copies the value count of every bucket into `values` in a single call.
+    ///
+    /// # Panics
+    ///
+    /// - If `values.len()` is not equal to [`Self::bucket_count`].
+    pub fn copy_buckets(&self, values: &mut [usize]) {
+        assert_eq!(values.len(), self.bucket_count());
+        unsafe {
+            nv_flip_sys::flip_image_histogram_ref_get_bucket_values(
+                self.inner,
+                values.as_mut_ptr(),
+            );
+        }
+    }
+
+    /// Returns the value count of every bucket.
+    pub fn buckets(&self) -> Vec<usize> {
+        let mut values = vec![0; self.bucket_count()];
+        self.copy_buckets(&mut values);
+        values
+    }
+
+    /// Returns the [`Self::bucket_count`] + 1 edges of the buckets.
+    ///
+    /// Bucket `i` contains the values in the range `edges[i]..edges[i + 1]`.
+    pub fn bucket_edges(&self) -> Vec<f32> {
+        let mut edges = vec![0.0; self.bucket_count() + 1];
+        unsafe {
+            nv_flip_sys::flip_image_histogram_ref_get_bucket_edges(self.inner, edges.as_mut_ptr());
+        }
+        edges
+    }
+
+    /// Returns the smallest value the histogram can handle.
+    pub fn minimum_allowed_value(&self) -> f32 {
+        unsafe { nv_flip_sys::flip_image_histogram_ref_get_min_value(self.inner) }
+    }
+
+    /// Returns the largest value the histogram can handle.
+    pub fn maximum_allowed_value(&self) -> f32 {
+        unsafe { nv_flip_sys::flip_image_histogram_ref_get_max_value(self.inner) }
+    }
+
+    /// Clears the histogram of all values
+    ///
+    /// # Safety
+    ///
+    /// Due to the many invariants between the histogram and the pool,
     /// we do not provide any safty guarentees when mutating the histogram.
-    pub unsafe fn include_image(&mut self, image: &FlipImageFloat) {
+    pub unsafe fn clear(&mut self) {
         unsafe {
-            nv_flip_sys::flip_image_histogram_ref_inc_image(self.inner, image.inner);
+            nv_flip_sys::flip_image_histogram_ref_clear(self.inner);
         }
     }
-}
 
-impl Drop for FlipHistogram<'_> {
-    fn drop(&mut self) {
+    /// Resizes the histogram to have `bucket_size` buckets.
+    ///
+    /// # Safety
+    ///
+    /// Due to the many invariants between the histogram and the pool,
+    /// we do not provide any safty guarentees when mutating the histogram.
+    pub unsafe fn resize(&mut self, bucket_size: usize) {
+        unsafe {
+            nv_flip_sys::flip_image_histogram_ref_resize(self.inner, bucket_size);
+        }
+    }
+
+    /// Returns which bucket a given value would fall into.
+    pub fn bucket_id(&self, value: f32) -> usize {
+        unsafe { nv_flip_sys::flip_image_histogram_ref_value_bucket_id(self.inner, value) }
+    }
+
+    /// Includes `count` instances of the following `value` in the histogram.
+    ///
+    /// # Safety
+    ///
+    /// Due to the many invariants between the histogram and the pool,
+    /// we do not provide any safty guarentees when mutating the histogram.
+    pub unsafe fn include_value(&mut self, value: f32, count: usize) {
+        unsafe {
+            nv_flip_sys::flip_image_histogram_ref_inc_value(self.inner, value, count);
+        }
+    }
+
+    /// Includes one instance of each value in the given image in the histogram.
+    ///
+    /// # Safety
+    ///
+    /// Due to the many invariants between the histogram and the pool,
+    /// we do not provide any safty guarentees when mutating the histogram.
+    pub unsafe fn include_image(&mut self, image: &FlipImageFloat) {
         unsafe {
-            nv_flip_sys::flip_image_histogram_ref_free(self.inner);
+            nv_flip_sys::flip_image_histogram_ref_inc_image(self.inner, image.inner);
         }
     }
 }
@@ -463,6 +1531,11 @@ pub struct FlipPool {
     values_added: usize,
 }
 
+// SAFETY: The pool owns its allocation. All `&self` methods call `const` functions on the
+// native pool, the only lazily mutated state (sorting for percentiles) requires `&mut self`.
+unsafe impl Send for FlipPool {}
+unsafe impl Sync for FlipPool {}
+
 impl FlipPool {
     /// Creates a new pool with 100 buckets.
     pub fn new() -> Self {
@@ -487,8 +1560,10 @@ impl FlipPool {
     }
 
     /// Accesses the internal histogram of the pool.
+    ///
+    /// This does not allocate, the histogram is borrowed from the pool.
     pub fn histogram(&mut self) -> FlipHistogram<'_> {
-        let inner = unsafe { nv_flip_sys::flip_image_pool_get_histogram(self.inner) };
+        let inner = unsafe { nv_flip_sys::flip_image_pool_borrow_histogram(self.inner) };
         assert!(!inner.is_null());
         FlipHistogram {
             inner,
@@ -574,6 +1649,22 @@ impl FlipPool {
         self.values_added += image.width() as usize * image.height() as usize;
     }
 
+    /// Updates the given pool with the given rows of the image.
+    ///
+    /// Pooling a whole image one band of rows at a time gives the same result as
+    /// [`Self::update_with_image`], so bands can be pooled as soon as they are available.
+    ///
+    /// # Panics
+    ///
+    /// - If the row range is out of bounds of the image.
+    pub fn update_with_rows(&mut self, image: &FlipImageFloat, rows: Range<u32>) {
+        assert!(rows.start <= rows.end && rows.end <= image.height());
+        unsafe {
+            nv_flip_sys::flip_image_pool_update_rows(self.inner, image.inner, rows.start, rows.end);
+        }
+        self.values_added += image.width() as usize * rows.len();
+    }
+
     /// Clears the pool.
     pub fn clear(&mut self) {
         unsafe {
@@ -581,7 +1672,19 @@ impl FlipPool {
         }
         self.values_added = 0;
     }
-}
+
+    /// Gets the summary statistics of the pool, the same ones [`flip_statistics`] returns.
+    pub fn statistics(&mut self) -> FlipStatistics {
+        FlipStatistics {
+            mean: self.mean(),
+            weighted_median: self.get_percentile(0.5, true),
+            first_weighted_quartile: self.get_percentile(0.25, true),
+            third_weighted_quartile: self.get_percentile(0.75, true),
+            min_value: self.min_value(),
+            max_value: self.max_value(),
+        }
+    }
+}
 
 impl Default for FlipPool {
     fn default() -> Self {
@@ -589,10 +1692,1057 @@ impl Default for FlipPool {
     }
 }
 
-impl Drop for FlipPool {
+impl Drop for FlipPool {
+    fn drop(&mut self) {
+        unsafe {
+            nv_flip_sys::flip_image_pool_free(self.inner);
+        }
+    }
+}
+
+/// Writes one compact JSON object per comparison, one per line (NDJSON), as results come in.
+///
+/// Records are collected and handed to the writer in batches, then flushed, so a crash loses
+/// at most the last batch, and the file always ends in whole lines. Each record holds the
+/// comparison's name and the fields of [`FlipStatistics`]. Non-finite values are written as
+/// `null`.
+///
+/// ```rust
+/// let mut writer = nv_flip::FlipNdjsonWriter::new(Vec::new());
+/// let mut pool = nv_flip::FlipPool::new();
+/// writer.write_pool("frame 1", &mut pool).unwrap();
+/// let output = String::from_utf8(writer.into_inner().unwrap()).unwrap();
+/// assert!(output.starts_with(r#"{"name":"frame 1","mean":0,"#));
+/// ```
+pub struct FlipNdjsonWriter<W: std::io::Write> {
+    // Only None after into_inner.
+    writer: Option<W>,
+    buffer: String,
+    batch_size: usize,
+    pending: usize,
+}
+
+impl<W: std::io::Write> FlipNdjsonWriter<W> {
+    /// Creates a writer flushing every 64 records.
+    pub fn new(writer: W) -> Self {
+        Self::with_batch_size(writer, 64)
+    }
+
+    /// Creates a writer flushing every `batch_size` records.
+    ///
+    /// # Panics
+    ///
+    /// - If `batch_size` is 0.
+    pub fn with_batch_size(writer: W, batch_size: usize) -> Self {
+        assert!(batch_size > 0);
+        Self {
+            writer: Some(writer),
+            buffer: String::new(),
+            batch_size,
+            pending: 0,
+        }
+    }
+
+    /// Writes the statistics of a pool as the record of the comparison called `name`.
+    pub fn write_pool(&mut self, name: &str, pool: &mut FlipPool) -> std::io::Result<()> {
+        self.write_statistics(name, &pool.statistics())
+    }
+
+    /// Writes the record of the comparison called `name`.
+    pub fn write_statistics(
+        &mut self,
+        name: &str,
+        statistics: &FlipStatistics,
+    ) -> std::io::Result<()> {
+        use std::fmt::Write;
+
+        self.buffer.push_str("{\"name\":\"");
+        for c in name.chars() {
+            match c {
+                '"' => self.buffer.push_str("\\\""),
+                '\\' => self.buffer.push_str("\\\\"),
+                '\n' => self.buffer.push_str("\\n"),
+                '\r' => self.buffer.push_str("\\r"),
+                '\t' => self.buffer.push_str("\\t"),
+                c if c < ' ' => write!(self.buffer, "\\u{:04x}", c as u32).unwrap(),
+                c => self.buffer.push(c),
+            }
+        }
+        self.buffer.push('"');
+        for (key, value) in statistics.fields() {
+            if value.is_finite() {
+                write!(self.buffer, ",\"{key}\":{value}").unwrap();
+            } else {
+                write!(self.buffer, ",\"{key}\":null").unwrap();
+            }
+        }
+        self.buffer.push_str("}\n");
+
+        self.pending += 1;
+        if self.pending >= self.batch_size {
+            self.flush()?;
+        }
+        Ok(())
+    }
+
+    /// Hands all pending records to the writer and flushes it.
+    pub fn flush(&mut self) -> std::io::Result<()> {
+        let Some(writer) = &mut self.writer else {
+            return Ok(());
+        };
+        writer.write_all(self.buffer.as_bytes())?;
+        self.buffer.clear();
+        self.pending = 0;
+        writer.flush()
+    }
+
+    /// Flushes pending records and returns the writer.
+    pub fn into_inner(mut self) -> std::io::Result<W> {
+        self.flush()?;
+        Ok(self.writer.take().unwrap())
+    }
+}
+
+impl<W: std::io::Write> Drop for FlipNdjsonWriter<W> {
+    /// Flushes pending records, ignoring errors. Call [`Self::flush`] to see them.
+    fn drop(&mut self) {
+        let _ = self.flush();
+    }
+}
+
+/// Writes comparison results in a binary columnar format, for fast loading in analysis
+/// scripts, as results come in.
+///
+/// Like [`FlipNdjsonWriter`], records are written in batches. The file starts with the 8
+/// bytes `FLIPCOL1`, followed by one block per batch, all numbers little endian:
+///
+/// - `u32` number of records `n`.
+/// - `n` `f32` values of each [`FlipStatistics`] field in declaration order: all means,
+///   then all weighted medians, and so on, 6 columns in total.
+/// - `n` names, each a `u32` byte length followed by UTF-8 bytes.
+///
+/// With numpy, a block's statistics are `np.frombuffer(data, "<f4", 6 * n, offset + 4)`.
+pub struct FlipColumnarWriter<W: std::io::Write> {
+    // Only None after into_inner.
+    writer: Option<W>,
+    names: Vec<u8>,
+    columns: [Vec<f32>; 6],
+    batch_size: usize,
+    header_written: bool,
+}
+
+impl<W: std::io::Write> FlipColumnarWriter<W> {
+    /// Creates a writer writing a block every 1024 records.
+    pub fn new(writer: W) -> Self {
+        Self::with_batch_size(writer, 1024)
+    }
+
+    /// Creates a writer writing a block every `batch_size` records.
+    ///
+    /// # Panics
+    ///
+    /// - If `batch_size` is 0.
+    pub fn with_batch_size(writer: W, batch_size: usize) -> Self {
+        assert!(batch_size > 0);
+        Self {
+            writer: Some(writer),
+            names: Vec::new(),
+            columns: Default::default(),
+            batch_size,
+            header_written: false,
+        }
+    }
+
+    /// Writes the statistics of a pool as the record of the comparison called `name`.
+    pub fn write_pool(&mut self, name: &str, pool: &mut FlipPool) -> std::io::Result<()> {
+        self.write_statistics(name, &pool.statistics())
+    }
+
+    /// Writes the record of the comparison called `name`.
+    pub fn write_statistics(
+        &mut self,
+        name: &str,
+        statistics: &FlipStatistics,
+    ) -> std::io::Result<()> {
+        self.names
+            .extend_from_slice(&(name.len() as u32).to_le_bytes());
+        self.names.extend_from_slice(name.as_bytes());
+        for (column, (_, value)) in self.columns.iter_mut().zip(statistics.fields()) {
+            column.push(value);
+        }
+        if self.columns[0].len() >= self.batch_size {
+            self.flush()?;
+        }
+        Ok(())
+    }
+
+    /// Writes all pending records as a block and flushes the writer.
+    pub fn flush(&mut self) -> std::io::Result<()> {
+        let Some(writer) = &mut self.writer else {
+            return Ok(());
+        };
+        if !self.header_written {
+            writer.write_all(b"FLIPCOL1")?;
+            self.header_written = true;
+        }
+        let count = self.columns[0].len();
+        if count != 0 {
+            let mut block = Vec::with_capacity(4 + count * 6 * 4 + self.names.len());
+            block.extend_from_slice(&(count as u32).to_le_bytes());
+            for column in &mut self.columns {
+                block.extend(column.drain(..).flat_map(f32::to_le_bytes));
+            }
+            block.append(&mut self.names);
+            writer.write_all(&block)?;
+        }
+        writer.flush()
+    }
+
+    /// Flushes pending records and returns the writer.
+    pub fn into_inner(mut self) -> std::io::Result<W> {
+        self.flush()?;
+        Ok(self.writer.take().unwrap())
+    }
+}
+
+impl<W: std::io::Write> Drop for FlipColumnarWriter<W> {
+    /// Flushes pending records, ignoring errors. Call [`Self::flush`] to see them.
+    fn drop(&mut self) {
+        let _ = self.flush();
+    }
+}
+
+/// Reads everything written by a [`FlipColumnarWriter`], returning the name and statistics
+/// of every record.
+pub fn read_flip_columnar(
+    mut reader: impl std::io::Read,
+) -> std::io::Result<Vec<(String, FlipStatistics)>> {
+    fn take<'a>(data: &mut &'a [u8], len: usize) -> std::io::Result<&'a [u8]> {
+        if data.len() < len {
+            return Err(std::io::Error::new(
+                std::io::ErrorKind::InvalidData,
+                "truncated FLIP columnar file",
+            ));
+        }
+        let (taken, rest) = data.split_at(len);
+        *data = rest;
+        Ok(taken)
+    }
+
+    let invalid = |message| std::io::Error::new(std::io::ErrorKind::InvalidData, message);
+    let mut data = Vec::new();
+    reader.read_to_end(&mut data)?;
+    let mut data = data
+        .strip_prefix(b"FLIPCOL1")
+        .ok_or_else(|| invalid("not a FLIP columnar file"))?;
+    let u32_at = |bytes: &[u8]| u32::from_le_bytes(bytes.try_into().unwrap()) as usize;
+
+    let mut records = Vec::new();
+    while !data.is_empty() {
+        let count = u32_at(take(&mut data, 4)?);
+        let values = take(&mut data, count * 6 * 4)?;
+        let column = |index: usize, row: usize| {
+            let offset = (index * count + row) * 4;
+            f32::from_le_bytes(values[offset..offset + 4].try_into().unwrap())
+        };
+        for row in 0..count {
+            let len = u32_at(take(&mut data, 4)?);
+            let name = String::from_utf8(take(&mut data, len)?.to_vec())
+                .map_err(|_| invalid("name is not UTF-8"))?;
+            records.push((
+                name,
+                FlipStatistics {
+                    mean: column(0, row),
+                    weighted_median: column(1, row),
+                    first_weighted_quartile: column(2, row),
+                    third_weighted_quartile: column(3, row),
+                    min_value: column(4, row),
+                    max_value: column(5, row),
+                },
+            ));
+        }
+    }
+    Ok(records)
+}
+
+/// Describes how values in [0.0, 1.0] are assigned to the buckets of a [`FlipBucketPool`].
+///
+/// The bucket a value falls into is always found in constant time.
+pub struct FlipBucketLayout {
+    inner: *mut nv_flip_sys::FlipImageBucketLayout,
+}
+
+// SAFETY: Layouts are immutable after creation.
+unsafe impl Send for FlipBucketLayout {}
+unsafe impl Sync for FlipBucketLayout {}
+
+impl Clone for FlipBucketLayout {
+    fn clone(&self) -> Self {
+        let inner = unsafe { nv_flip_sys::flip_image_bucket_layout_clone(self.inner) };
+        assert!(!inner.is_null());
+        Self { inner }
+    }
+}
+
+impl FlipBucketLayout {
+    /// Creates a layout with `bucket_count` buckets of equal width, like [`FlipPool`] uses.
+    pub fn linear(bucket_count: usize) -> Self {
+        Self::from_raw(unsafe { nv_flip_sys::flip_image_bucket_layout_new_linear(bucket_count) })
+    }
+
+    /// Creates a layout with `2^sub_bucket_bits` buckets for every power of two between
+    /// `2^min_exponent` and 1.0, plus a single bucket for everything below `2^min_exponent`.
+    ///
+    /// Every bucket spans the same _relative_ range of values, so small errors are resolved as
+    /// well as large ones. `logarithmic(4, -14)` uses 225 buckets, each at most 6.25% wide
+    /// relative to its values, and resolves errors down to 0.00006.
+    ///
+    /// `sub_bucket_bits` is clamped to 16 and `min_exponent` to [-126, -1].
+    pub fn logarithmic(sub_bucket_bits: u32, min_exponent: i32) -> Self {
+        Self::from_raw(unsafe {
+            nv_flip_sys::flip_image_bucket_layout_new_logarithmic(sub_bucket_bits, min_exponent)
+        })
+    }
+
+    /// Creates a layout with up to `bucket_count` buckets, refined to the values in `training`.
+    ///
+    /// This is usually the error map of a representative comparison. Buckets are concentrated
+    /// where the training values are dense and in their upper tail, making high percentiles
+    /// of similar error maps precise with few buckets. Values unlike the training data are
+    /// still resolved, but coarser.
+    pub fn adaptive(bucket_count: usize, training: &FlipImageFloat) -> Self {
+        Self::from_raw(unsafe {
+            nv_flip_sys::flip_image_bucket_layout_new_adaptive(bucket_count, training.inner)
+        })
+    }
+
+    fn from_raw(inner: *mut nv_flip_sys::FlipImageBucketLayout) -> Self {
+        assert!(!inner.is_null());
+        Self { inner }
+    }
+
+    /// Returns the amount of buckets in the layout.
+    pub fn bucket_count(&self) -> usize {
+        unsafe { nv_flip_sys::flip_image_bucket_layout_size(self.inner) }
+    }
+
+    /// Returns which bucket a given value would fall into.
+    ///
+    /// Values outside of [0.0, 1.0] fall into the first or last bucket.
+    pub fn bucket_id(&self, value: f32) -> usize {
+        unsafe { nv_flip_sys::flip_image_bucket_layout_value_bucket_id(self.inner, value) }
+    }
+
+    /// Returns the [`Self::bucket_count`] + 1 edges of the buckets.
+    ///
+    /// Bucket `i` contains the values in the range `edges[i]..edges[i + 1]`.
+    pub fn bucket_edges(&self) -> Vec<f32> {
+        let mut edges = vec![0.0; self.bucket_count() + 1];
+        unsafe {
+            nv_flip_sys::flip_image_bucket_layout_get_edges(self.inner, edges.as_mut_ptr());
+        }
+        edges
+    }
+}
+
+impl Drop for FlipBucketLayout {
+    fn drop(&mut self) {
+        unsafe {
+            nv_flip_sys::flip_image_bucket_layout_free(self.inner);
+        }
+    }
+}
+
+/// Histogram based value pool with a configurable [`FlipBucketLayout`].
+///
+/// Unlike [`FlipPool`], this does not store every value. Percentiles are interpolated
+/// within their bucket, so their precision depends on the layout, and memory use stays
+/// constant however many values are added.
+pub struct FlipBucketPool {
+    inner: *mut nv_flip_sys::FlipImageBucketPool,
+}
+
+// SAFETY: The pool owns its allocation and all `&self` methods only read it.
+unsafe impl Send for FlipBucketPool {}
+unsafe impl Sync for FlipBucketPool {}
+
+impl Clone for FlipBucketPool {
+    fn clone(&self) -> Self {
+        let inner = unsafe { nv_flip_sys::flip_image_bucket_pool_clone(self.inner) };
+        assert!(!inner.is_null());
+        Self { inner }
+    }
+}
+
+impl FlipBucketPool {
+    /// Creates a new empty pool with the given layout.
+    pub fn new(layout: &FlipBucketLayout) -> Self {
+        let inner = unsafe { nv_flip_sys::flip_image_bucket_pool_new(layout.inner) };
+        assert!(!inner.is_null());
+        Self { inner }
+    }
+
+    /// Creates a new pool with the given layout and adds the values of the given image.
+    pub fn from_image(layout: &FlipBucketLayout, image: &FlipImageFloat) -> Self {
+        let mut pool = Self::new(layout);
+        pool.update_with_image(image);
+        pool
+    }
+
+    /// Returns the amount of values added to the pool.
+    pub fn value_count(&self) -> f64 {
+        unsafe { nv_flip_sys::flip_image_bucket_pool_get_count(self.inner) }
+    }
+
+    /// Gets the minimum value stored in the pool.
+    ///
+    /// Returns 0.0 if no values have been added to the pool.
+    pub fn min_value(&self) -> f32 {
+        if self.value_count() == 0.0 {
+            return 0.0;
+        }
+        unsafe { nv_flip_sys::flip_image_bucket_pool_get_min_value(self.inner) }
+    }
+
+    /// Gets the maximum value stored in the pool.
+    ///
+    /// Returns 0.0 if no values have been added to the pool.
+    pub fn max_value(&self) -> f32 {
+        if self.value_count() == 0.0 {
+            return 0.0;
+        }
+        unsafe { nv_flip_sys::flip_image_bucket_pool_get_max_value(self.inner) }
+    }
+
+    /// Gets the mean value stored in the pool. This is exact, it does not depend on the layout.
+    ///
+    /// Returns 0.0 if no values have been added to the pool.
+    pub fn mean(&self) -> f32 {
+        unsafe { nv_flip_sys::flip_image_bucket_pool_get_mean(self.inner) }
+    }
+
+    /// Get the value of the given percentile [0.0, 1.0] from the pool.
+    ///
+    /// If `weighted` is true, every value is weighted by itself, like [`FlipPool::get_percentile`].
+    ///
+    /// Returns 0.0 if no values have been added to the pool.
+    pub fn get_percentile(&self, percentile: f32, weighted: bool) -> f32 {
+        unsafe {
+            nv_flip_sys::flip_image_bucket_pool_get_percentile(self.inner, percentile, weighted)
+        }
+    }
+
+    /// Returns the amount of buckets in the pool.
+    pub fn bucket_count(&self) -> usize {
+        unsafe { nv_flip_sys::flip_image_bucket_pool_size(self.inner) }
+    }
+
+    /// Copies the value count of every bucket into `values`.
+    ///
+    /// # Panics
+    ///
+    /// - If `values.len()` is not equal to [`Self::bucket_count`].
+    pub fn copy_buckets(&self, values: &mut [f64]) {
+        assert_eq!(values.len(), self.bucket_count());
+        unsafe {
+            nv_flip_sys::flip_image_bucket_pool_get_bucket_values(self.inner, values.as_mut_ptr());
+        }
+    }
+
+    /// Returns the value count of every bucket.
+    pub fn buckets(&self) -> Vec<f64> {
+        let mut values = vec![0.0; self.bucket_count()];
+        self.copy_buckets(&mut values);
+        values
+    }
+
+    /// Returns the [`Self::bucket_count`] + 1 edges of the buckets.
+    pub fn bucket_edges(&self) -> Vec<f32> {
+        let mut edges = vec![0.0; self.bucket_count() + 1];
+        unsafe {
+            nv_flip_sys::flip_image_bucket_pool_get_bucket_edges(self.inner, edges.as_mut_ptr());
+        }
+        edges
+    }
+
+    /// Updates the pool with the contents of the given image.
+    pub fn update_with_image(&mut self, image: &FlipImageFloat) {
+        unsafe {
+            nv_flip_sys::flip_image_bucket_pool_update_image(self.inner, image.inner);
+        }
+    }
+
+    /// Adds the contents of another pool to this one.
+    ///
+    /// Both pools must have been created with the same layout.
+    ///
+    /// # Panics
+    ///
+    /// - If the pools have layouts of a different kind or with different bucket edges.
+    pub fn merge(&mut self, other: &FlipBucketPool) {
+        let merged = unsafe { nv_flip_sys::flip_image_bucket_pool_merge(self.inner, other.inner) };
+        assert!(merged);
+    }
+
+    /// Clears the pool.
+    pub fn clear(&mut self) {
+        unsafe {
+            nv_flip_sys::flip_image_bucket_pool_clear(self.inner);
+        }
+    }
+}
+
+impl Drop for FlipBucketPool {
+    fn drop(&mut self) {
+        unsafe {
+            nv_flip_sys::flip_image_bucket_pool_free(self.inner);
+        }
+    }
+}
+
+/// Pools the error map separately for every label in `labels`, in a single pass.
+///
+/// `labels` holds one label per pixel of the error map, in row-major order, for example an
+/// object or material ID buffer. Returns `label_count` pools, the pool at index `i` holding the
+/// errors of all pixels labeled `i`. Pixels with a label of `label_count` or above are ignored.
+///
+/// # Panics
+///
+/// - If `labels` is not large enough to cover the error map.
+pub fn pool_by_label(
+    layout: &FlipBucketLayout,
+    error_map: &FlipImageFloat,
+    labels: &[u32],
+    label_count: usize,
+) -> Vec<FlipBucketPool> {
+    assert!(labels.len() >= error_map.width() as usize * error_map.height() as usize);
+    let mut pools: Vec<_> = (0..label_count)
+        .map(|_| FlipBucketPool::new(layout))
+        .collect();
+    update_labeled_rows(&mut pools, error_map, labels, 0..error_map.height());
+    pools
+}
+
+/// Parallel version of [`pool_by_label`], pooling bands of rows on the rayon thread pool
+/// and merging the per-label pools of every band.
+///
+/// # Panics
+///
+/// - If `labels` is not large enough to cover the error map.
+#[cfg(feature = "rayon")]
+pub fn par_pool_by_label(
+    layout: &FlipBucketLayout,
+    error_map: &FlipImageFloat,
+    labels: &[u32],
+    label_count: usize,
+) -> Vec<FlipBucketPool> {
+    assert!(labels.len() >= error_map.width() as usize * error_map.height() as usize);
+    let new_pools = || -> Vec<_> {
+        (0..label_count)
+            .map(|_| FlipBucketPool::new(layout))
+            .collect()
+    };
+    let rows = rows_per_task(error_map.width());
+    let bands = error_map.height().div_ceil(rows);
+    (0..bands)
+        .into_par_iter()
+        .fold(new_pools, |mut pools, band| {
+            let y_begin = band * rows;
+            let y_end = (y_begin + rows).min(error_map.height());
+            update_labeled_rows(&mut pools, error_map, labels, y_begin..y_end);
+            pools
+        })
+        .reduce(new_pools, |mut pools, other| {
+            for (pool, other) in pools.iter_mut().zip(&other) {
+                pool.merge(other);
+            }
+            pools
+        })
+}
+
+fn update_labeled_rows(
+    pools: &mut [FlipBucketPool],
+    error_map: &FlipImageFloat,
+    labels: &[u32],
+    rows: Range<u32>,
+) {
+    let pointers: Vec<_> = pools.iter().map(|pool| pool.inner).collect();
+    unsafe {
+        nv_flip_sys::flip_image_bucket_pool_update_labeled_rows(
+            pointers.as_ptr(),
+            pointers.len(),
+            error_map.inner,
+            labels.as_ptr(),
+            rows.start,
+            rows.end,
+        );
+    }
+}
+
+/// Pool that can be updated from many threads at once, without locks.
+///
+/// Updates pool their values locally, then publish them with atomic adds into counters
+/// sharded by thread. Reading the statistics merges the shards into a [`FlipBucketPool`].
+/// Its buckets, value count, extrema and percentiles match a serial pool fed with the same
+/// values exactly, its mean only up to rounding, since the shards sum in another order.
+pub struct FlipConcurrentPool {
+    inner: *mut nv_flip_sys::FlipImageConcurrentPool,
+}
+
+// SAFETY: Updates only use atomics and may race with each other and with snapshots,
+// clearing requires `&mut self`.
+unsafe impl Send for FlipConcurrentPool {}
+unsafe impl Sync for FlipConcurrentPool {}
+
+impl FlipConcurrentPool {
+    /// Creates a new empty pool with the given layout and one shard per hardware thread.
+    pub fn new(layout: &FlipBucketLayout) -> Self {
+        Self::with_shards(layout, 0)
+    }
+
+    /// Creates a new empty pool with the given layout and amount of counter shards.
+    ///
+    /// Passing 0 shards uses one per hardware thread.
+    pub fn with_shards(layout: &FlipBucketLayout, shards: usize) -> Self {
+        let inner = unsafe { nv_flip_sys::flip_image_concurrent_pool_new(layout.inner, shards) };
+        assert!(!inner.is_null());
+        Self { inner }
+    }
+
+    /// Adds the contents of the given image. May be called from any thread.
+    pub fn update_with_image(&self, image: &FlipImageFloat) {
+        unsafe {
+            nv_flip_sys::flip_image_concurrent_pool_update_image(self.inner, image.inner);
+        }
+    }
+
+    /// Adds the given values. May be called from any thread.
+    pub fn update_with_values(&self, values: &[f32]) {
+        unsafe {
+            nv_flip_sys::flip_image_concurrent_pool_update_values(
+                self.inner,
+                values.as_ptr(),
+                values.len(),
+            );
+        }
+    }
+
+    /// Merges all updates so far into a regular pool to read statistics from.
+    ///
+    /// Updates running concurrently with this call may be partially included.
+    pub fn snapshot(&self) -> FlipBucketPool {
+        let inner = unsafe { nv_flip_sys::flip_image_concurrent_pool_snapshot(self.inner) };
+        assert!(!inner.is_null());
+        FlipBucketPool { inner }
+    }
+
+    /// Clears the pool.
+    pub fn clear(&mut self) {
+        unsafe {
+            nv_flip_sys::flip_image_concurrent_pool_clear(self.inner);
+        }
+    }
+}
+
+impl Drop for FlipConcurrentPool {
+    fn drop(&mut self) {
+        unsafe {
+            nv_flip_sys::flip_image_concurrent_pool_free(self.inner);
+        }
+    }
+}
+
+/// Pool over the error maps of the last `N` frames, for rolling statistics.
+///
+/// Each pushed frame is pooled on its own and the window's totals are updated by adding the
+/// new frame's buckets and removing the evicted frame's, costing O(buckets) per frame on top
+/// of pooling the frame itself.
+pub struct FlipWindowedPool {
+    inner: *mut nv_flip_sys::FlipImageWindowedPool,
+    // Borrowed from `inner`, never dropped.
+    pool: ManuallyDrop<FlipBucketPool>,
+}
+
+// SAFETY: See `FlipBucketPool`.
+unsafe impl Send for FlipWindowedPool {}
+unsafe impl Sync for FlipWindowedPool {}
+
+impl FlipWindowedPool {
+    /// Creates a new empty pool over the last `frames` frames with the given layout.
+    ///
+    /// # Panics
+    ///
+    /// - If `frames` is 0.
+    pub fn new(layout: &FlipBucketLayout, frames: usize) -> Self {
+        assert_ne!(frames, 0);
+        let inner = unsafe { nv_flip_sys::flip_image_windowed_pool_new(layout.inner, frames) };
+        assert!(!inner.is_null());
+        let pool = unsafe { nv_flip_sys::flip_image_windowed_pool_get_pool(inner) };
+        Self {
+            inner,
+            pool: ManuallyDrop::new(FlipBucketPool {
+                inner: pool as *mut _,
+            }),
+        }
+    }
+
+    /// Returns the pool containing the values of all frames in the window.
+    pub fn pool(&self) -> &FlipBucketPool {
+        &self.pool
+    }
+
+    /// Returns the amount of frames the window holds when full.
+    pub fn window_size(&self) -> usize {
+        unsafe { nv_flip_sys::flip_image_windowed_pool_get_window_size(self.inner) }
+    }
+
+    /// Returns the amount of frames currently in the window.
+    pub fn frame_count(&self) -> usize {
+        unsafe { nv_flip_sys::flip_image_windowed_pool_get_frame_count(self.inner) }
+    }
+
+    /// Adds the given error map as the newest frame, evicting the oldest frame if the window is full.
+    pub fn push_image(&mut self, image: &FlipImageFloat) {
+        unsafe {
+            nv_flip_sys::flip_image_windowed_pool_push_image(self.inner, image.inner);
+        }
+    }
+
+    /// Removes all frames from the window.
+    pub fn clear(&mut self) {
+        unsafe {
+            nv_flip_sys::flip_image_windowed_pool_clear(self.inner);
+        }
+    }
+}
+
+impl Drop for FlipWindowedPool {
+    fn drop(&mut self) {
+        unsafe {
+            nv_flip_sys::flip_image_windowed_pool_free(self.inner);
+        }
+    }
+}
+
+/// Pool whose contents decay exponentially, for statistics that follow recent frames.
+///
+/// On every [`Self::update_with_image`] the weight of everything already in the pool is
+/// multiplied by the decay factor before the new values are added with weight 1.
+/// The decay is applied lazily, so it costs nothing per pixel, and memory use is constant.
+pub struct FlipDecayingPool {
+    inner: *mut nv_flip_sys::FlipImageDecayingPool,
+}
+
+// SAFETY: The pool owns its allocation and all `&self` methods only read it.
+unsafe impl Send for FlipDecayingPool {}
+unsafe impl Sync for FlipDecayingPool {}
+
+impl FlipDecayingPool {
+    /// Creates a new empty pool with the given layout and decay factor.
+    ///
+    /// A decay of 1.0 never forgets, a decay of 0.0 only keeps the latest image.
+    ///
+    /// # Panics
+    ///
+    /// - If `decay` is not within [0.0, 1.0].
+    pub fn new(layout: &FlipBucketLayout, decay: f64) -> Self {
+        assert!((0.0..=1.0).contains(&decay));
+        let inner = unsafe { nv_flip_sys::flip_image_decaying_pool_new(layout.inner, decay) };
+        assert!(!inner.is_null());
+        Self { inner }
+    }
+
+    /// Returns the decay factor of the pool.
+    pub fn decay(&self) -> f64 {
+        unsafe { nv_flip_sys::flip_image_decaying_pool_get_decay(self.inner) }
+    }
+
+    /// Returns the total weight of the values in the pool.
+    pub fn value_count(&self) -> f64 {
+        unsafe { nv_flip_sys::flip_image_decaying_pool_get_count(self.inner) }
+    }
+
+    /// Gets the minimum of the values that haven't decayed away, to the precision of
+    /// their bucket. Values whose weight dropped below 2^-24 of a fresh one no longer count.
+    ///
+    /// Returns 0.0 if no values have been added to the pool.
+    pub fn min_value(&self) -> f32 {
+        if self.value_count() == 0.0 {
+            return 0.0;
+        }
+        unsafe { nv_flip_sys::flip_image_decaying_pool_get_min_value(self.inner) }
+    }
+
+    /// Gets the maximum of the values that haven't decayed away, to the precision of
+    /// their bucket. Values whose weight dropped below 2^-24 of a fresh one no longer count.
+    ///
+    /// Returns 0.0 if no values have been added to the pool.
+    pub fn max_value(&self) -> f32 {
+        if self.value_count() == 0.0 {
+            return 0.0;
+        }
+        unsafe { nv_flip_sys::flip_image_decaying_pool_get_max_value(self.inner) }
+    }
+
+    /// Gets the weighted mean of the values in the pool.
+    ///
+    /// Returns 0.0 if no values have been added to the pool.
+    pub fn mean(&self) -> f32 {
+        unsafe { nv_flip_sys::flip_image_decaying_pool_get_mean(self.inner) }
+    }
+
+    /// Get the value of the given percentile [0.0, 1.0] from the pool.
+    ///
+    /// See [`FlipBucketPool::get_percentile`].
+    pub fn get_percentile(&self, percentile: f32, weighted: bool) -> f32 {
+        unsafe {
+            nv_flip_sys::flip_image_decaying_pool_get_percentile(self.inner, percentile, weighted)
+        }
+    }
+
+    /// Returns the weight in every bucket.
+    pub fn buckets(&self) -> Vec<f64> {
+        let mut values =
+            vec![0.0; unsafe { nv_flip_sys::flip_image_decaying_pool_size(self.inner) }];
+        unsafe {
+            nv_flip_sys::flip_image_decaying_pool_get_bucket_values(
+                self.inner,
+                values.as_mut_ptr(),
+            );
+        }
+        values
+    }
+
+    /// Decays the contents of the pool, then adds the contents of the given image.
+    pub fn update_with_image(&mut self, image: &FlipImageFloat) {
+        unsafe {
+            nv_flip_sys::flip_image_decaying_pool_update_image(self.inner, image.inner);
+        }
+    }
+
+    /// Clears the pool.
+    pub fn clear(&mut self) {
+        unsafe {
+            nv_flip_sys::flip_image_decaying_pool_clear(self.inner);
+        }
+    }
+}
+
+impl Drop for FlipDecayingPool {
     fn drop(&mut self) {
         unsafe {
-            nv_flip_sys::flip_image_pool_free(self.inner);
+            nv_flip_sys::flip_image_decaying_pool_free(self.inner);
+        }
+    }
+}
+
+/// Compares two images row by row as they are decoded.
+///
+/// Rows of both images are pushed in order, and error rows are returned as soon as
+/// all rows within the reach of FLIP's filters have arrived, so the comparison of
+/// the top of an image overlaps with the decoding of the rest. Only the rows still
+/// needed for the next comparison are kept. The concatenated error rows equal the
+/// error map [`flip`] returns for the whole images.
+///
+/// ```rust
+/// # let (width, height) = (8, 4);
+/// # let reference = vec![0u8; 8 * 4 * 3];
+/// # let test = vec![255u8; 8 * 4 * 3];
+/// let mut stream = nv_flip::FlipStream::new(width, nv_flip::DEFAULT_PIXELS_PER_DEGREE);
+/// let mut error_map = Vec::new();
+/// for (reference_row, test_row) in reference.chunks(width as usize * 3).zip(test.chunks(width as usize * 3)) {
+///     error_map.extend(stream.push_rows(reference_row, test_row));
+/// }
+/// error_map.extend(stream.finish());
+/// assert_eq!(error_map.len(), (width * height) as usize);
+/// ```
+pub struct FlipStream {
+    inner: *mut nv_flip_sys::FlipImageStream,
+    width: u32,
+}
+
+// SAFETY: The stream owns all of its state, and every method that touches it requires `&mut self`.
+unsafe impl Send for FlipStream {}
+unsafe impl Sync for FlipStream {}
+
+impl FlipStream {
+    /// Creates a stream for two images of the given width.
+    pub fn new(width: u32, pixels_per_degree: f32) -> Self {
+        let inner = unsafe { nv_flip_sys::flip_image_stream_new(width, pixels_per_degree) };
+        assert!(!inner.is_null());
+        Self { inner, width }
+    }
+
+    /// Pushes the next rows of both images, and returns the error rows that became ready,
+    /// possibly none.
+    ///
+    /// Data is expected in row-major order, tightly packed. Do not include alpha.
+    ///
+    /// # Panics
+    ///
+    /// - If the buffers have different lengths or don't hold whole rows.
+    pub fn push_rows(&mut self, reference_rows: &[u8], test_rows: &[u8]) -> Vec<f32> {
+        assert_eq!(
+            reference_rows.len(),
+            test_rows.len(),
+            "Row count mismatch between reference and test rows"
+        );
+        let row_len = self.width as usize * 3;
+        let rows = if row_len == 0 {
+            0
+        } else {
+            assert_eq!(reference_rows.len() % row_len, 0);
+            reference_rows.len() / row_len
+        };
+
+        unsafe {
+            nv_flip_sys::flip_image_stream_push_rows(
+                self.inner,
+                rows as u32,
+                reference_rows.as_ptr(),
+                test_rows.as_ptr(),
+            );
+        }
+        self.take_rows()
+    }
+
+    /// Marks the images as complete and returns the remaining error rows.
+    pub fn finish(mut self) -> Vec<f32> {
+        unsafe {
+            nv_flip_sys::flip_image_stream_finish(self.inner);
+        }
+        self.take_rows()
+    }
+
+    fn take_rows(&mut self) -> Vec<f32> {
+        let rows = unsafe { nv_flip_sys::flip_image_stream_ready_rows(self.inner) };
+        let mut values = vec![0.0; rows as usize * self.width as usize];
+        unsafe {
+            nv_flip_sys::flip_image_stream_take_rows(self.inner, values.as_mut_ptr());
+        }
+        values
+    }
+}
+
+impl Drop for FlipStream {
+    fn drop(&mut self) {
+        unsafe {
+            nv_flip_sys::flip_image_stream_free(self.inner);
+        }
+    }
+}
+
+/// FLIP comparison split into tasks for an external job system.
+///
+/// The error map is divided into bands of rows. Every band has a task converting its
+/// inputs and a task comparing it, which depends on the first. No threads are created:
+/// the caller fetches [`Self::ready_tasks`], runs each with [`Self::run_task`] on any
+/// thread, and retires it with [`Self::mark_done`], which makes the tasks depending on
+/// it ready. Once [`Self::is_done`] the error map holds the same values [`flip`] returns.
+///
+/// ```rust
+/// # let (width, height) = (8, 4);
+/// # let reference = vec![0u8; 8 * 4 * 3];
+/// # let test = vec![255u8; 8 * 4 * 3];
+/// let mut error_map = nv_flip::FlipImageFloat::new(width, height);
+/// let graph = nv_flip::FlipTaskGraph::new(&mut error_map, &reference, &test, nv_flip::DEFAULT_PIXELS_PER_DEGREE, 0);
+/// while !graph.is_done() {
+///     for task in graph.ready_tasks() {
+///         // Usually pushed into the engine's own job queue instead.
+///         graph.run_task(task);
+///         graph.mark_done(task);
+///     }
+/// }
+/// ```
+pub struct FlipTaskGraph<'a> {
+    inner: *mut nv_flip_sys::FlipImageTaskGraph,
+    _phantom: PhantomData<(&'a mut FlipImageFloat, &'a [u8])>,
+}
+
+// SAFETY: Task states are guarded by a mutex on the native side, which only lets each task
+// run once and only after its dependencies. Tasks of different bands touch disjoint rows.
+unsafe impl Send for FlipTaskGraph<'_> {}
+unsafe impl Sync for FlipTaskGraph<'_> {}
+
+impl<'a> FlipTaskGraph<'a> {
+    /// Creates the tasks comparing two Rgb8 buffers into `error_map`, in bands of
+    /// `band_rows` rows. Passing 0 picks a default of 64 rows.
+    ///
+    /// Data is expected in row-major order, from the top left, tightly packed. Do not include alpha.
+    ///
+    /// # Panics
+    ///
+    /// - If either buffer is not large enough to fill the error map.
+    pub fn new(
+        error_map: &'a mut FlipImageFloat,
+        reference_data: &'a [u8],
+        test_data: &'a [u8],
+        pixels_per_degree: f32,
+        band_rows: u32,
+    ) -> Self {
+        let len = error_map.width() as usize * error_map.height() as usize * 3;
+        assert!(reference_data.len() >= len);
+        assert!(test_data.len() >= len);
+
+        let inner = unsafe {
+            nv_flip_sys::flip_image_task_graph_new(
+                error_map.inner,
+                reference_data.as_ptr(),
+                test_data.as_ptr(),
+                pixels_per_degree,
+                band_rows,
+            )
+        };
+        assert!(!inner.is_null());
+        Self {
+            inner,
+            _phantom: PhantomData,
+        }
+    }
+
+    /// Returns the total number of tasks.
+    pub fn task_count(&self) -> usize {
+        unsafe { nv_flip_sys::flip_image_task_graph_task_count(self.inner) }
+    }
+
+    /// Returns the tasks whose dependencies are done and which weren't returned before.
+    pub fn ready_tasks(&self) -> Vec<u32> {
+        let mut tasks = vec![0; self.task_count()];
+        let count = unsafe {
+            nv_flip_sys::flip_image_task_graph_get_ready_tasks(
+                self.inner,
+                tasks.as_mut_ptr(),
+                tasks.len(),
+            )
+        };
+        tasks.truncate(count);
+        tasks
+    }
+
+    /// Runs a task returned by [`Self::ready_tasks`] on the calling thread.
+    ///
+    /// Returns false without doing anything if the task wasn't handed out or already ran.
+    pub fn run_task(&self, task: u32) -> bool {
+        unsafe { nv_flip_sys::flip_image_task_graph_run_task(self.inner, task) }
+    }
+
+    /// Retires a task that ran, making the tasks that depend on it ready.
+    ///
+    /// Returns false if the task hasn't run yet.
+    pub fn mark_done(&self, task: u32) -> bool {
+        unsafe { nv_flip_sys::flip_image_task_graph_mark_done(self.inner, task) }
+    }
+
+    /// Returns true once every task is done.
+    pub fn is_done(&self) -> bool {
+        unsafe { nv_flip_sys::flip_image_task_graph_is_done(self.inner) }
+    }
+}
+
+impl Drop for FlipTaskGraph<'_> {
+    fn drop(&mut self) {
+        unsafe {
+            nv_flip_sys::flip_image_task_graph_free(self.inner);
         }
     }
 }
@@ -608,12 +2758,947 @@ mod tests {
     pub use super::*;
     use float_eq::assert_float_eq;
 
+    /// A noisy reference and a test image differing from it everywhere, tightly packed RGB8.
+    fn test_pair(width: u32, height: u32) -> (Vec<u8>, Vec<u8>) {
+        let noise = |step: u32| {
+            (0..width * height * 3)
+                .map(|i| (i * step % 256) as u8)
+                .collect()
+        };
+        (noise(7), noise(13))
+    }
+
+    /// The error map of a whole-image [`flip`], to check other entry points against.
+    fn full_flip(width: u32, height: u32, reference: &[u8], test: &[u8]) -> FlipImageFloat {
+        flip(
+            FlipImageRgb8::with_data(width, height, reference),
+            FlipImageRgb8::with_data(width, height, test),
+            67.0,
+        )
+    }
+
     #[test]
     fn zeroed_init() {
         assert_eq!(FlipImageRgb8::new(10, 10).to_vec(), vec![0u8; 10 * 10 * 3]);
         assert_eq!(FlipImageFloat::new(10, 10).to_vec(), vec![0.0f32; 10 * 10]);
     }
 
+    #[test]
+    fn pool_update_with_rows() {
+        let data: Vec<f32> = (0..64 * 48).map(|i| (i % 97) as f32 / 97.0).collect();
+        let image = FlipImageFloat::with_data(64, 48, &data);
+
+        let mut whole = FlipPool::from_image(&image);
+        let mut banded = FlipPool::new();
+        banded.update_with_rows(&image, 0..5);
+        banded.update_with_rows(&image, 5..5);
+        banded.update_with_rows(&image, 5..48);
+
+        assert_eq!(whole.mean(), banded.mean());
+        assert_eq!(whole.max_value(), banded.max_value());
+        assert_eq!(
+            whole.get_percentile(0.9, false),
+            banded.get_percentile(0.9, false)
+        );
+    }
+
+    #[cfg(feature = "rayon")]
+    #[test]
+    fn parallel_conversion() {
+        // Odd width so that bands do not line up with power of two boundaries.
+        let (width, height) = (1001, 37);
+        let rgb: Vec<u8> = (0..width * height * 3).map(|i| (i % 251) as u8).collect();
+        let float: Vec<f32> = (0..width * height).map(|i| i as f32).collect();
+
+        let rgb_image = FlipImageRgb8::par_with_data(width, height, &rgb);
+        assert_eq!(rgb_image.par_to_vec(), rgb);
+        assert_eq!(rgb_image.to_vec(), rgb);
+
+        let float_image = FlipImageFloat::par_with_data(width, height, &float);
+        assert_eq!(float_image.par_to_vec(), float);
+        assert_eq!(float_image.to_vec(), float);
+
+        assert!(FlipImageFloat::par_with_data(0, 0, &[])
+            .par_to_vec()
+            .is_empty());
+    }
+
+    #[test]
+    fn concurrent_matches_serial() {
+        const WIDTH: u32 = 97;
+        const HEIGHT: u32 = 61;
+        const THREADS: u32 = 16;
+        const ROUNDS: u32 = 4;
+
+        fn pattern(seed: u32) -> Vec<u8> {
+            (0..WIDTH * HEIGHT * 3)
+                .map(|i| (i.wrapping_mul(2_654_435_761).wrapping_add(seed * 977) >> 24) as u8)
+                .collect()
+        }
+
+        // Shared inputs exercise the Sync impls, per-thread inputs the Send impls.
+        let reference = FlipImageRgb8::with_data(WIDTH, HEIGHT, &pattern(0));
+        let lut = magma_lut();
+        let run = |seed: u32| {
+            let test = FlipImageRgb8::with_data(WIDTH, HEIGHT, &pattern(seed + 1));
+            let error_map = flip(reference.clone(), test, DEFAULT_PIXELS_PER_DEGREE);
+            let mut pool = FlipPool::from_image(&error_map);
+            (
+                error_map.to_vec(),
+                error_map.apply_color_lut(&lut).to_vec(),
+                pool.mean(),
+                pool.get_percentile(0.95, true),
+                pool.get_weighted_percentile(0.5),
+            )
+        };
+
+        let serial: Vec<_> = (0..THREADS).map(run).collect();
+        for _ in 0..ROUNDS {
+            let concurrent: Vec<_> = std::thread::scope(|scope| {
+                let handles: Vec<_> = (0..THREADS)
+                    .map(|seed| scope.spawn(move || run(seed)))
+                    .collect();
+                handles.into_iter().map(|h| h.join().unwrap()).collect()
+            });
+            assert!(serial == concurrent);
+        }
+    }
+
+    #[test]
+    fn statistics_match_pool() {
+        // Two sizes in a row makes sure the per-thread scratch space is rebuilt properly.
+        for (width, height) in [(37, 23), (64, 64), (64, 64), (1, 1)] {
+            let (reference, test) = test_pair(width, height);
+
+            let statistics = flip_statistics(width, height, &reference, &test, 67.0);
+
+            let error_map = full_flip(width, height, &reference, &test);
+            let mut pool = FlipPool::from_image(&error_map);
+            assert_eq!(statistics.mean, pool.mean());
+            assert_eq!(statistics.weighted_median, pool.get_percentile(0.5, true));
+            assert_eq!(
+                statistics.first_weighted_quartile,
+                pool.get_percentile(0.25, true)
+            );
+            assert_eq!(
+                statistics.third_weighted_quartile,
+                pool.get_percentile(0.75, true)
+            );
+            assert_eq!(statistics.min_value, pool.min_value());
+            assert_eq!(statistics.max_value, pool.max_value());
+        }
+
+        // Releasing the scratch space only costs the next call its allocations.
+        let (reference, test) = test_pair(64, 64);
+        let before = flip_statistics(64, 64, &reference, &test, 67.0);
+        release_scratch();
+        assert_eq!(flip_statistics(64, 64, &reference, &test, 67.0), before);
+
+        assert_eq!(
+            flip_statistics(0, 0, &[], &[], 67.0),
+            FlipStatistics::default()
+        );
+    }
+
+    #[test]
+    fn mean_matches_error_map() {
+        for (width, height) in [(37, 23), (64, 64), (1, 1)] {
+            let (reference, test) = test_pair(width, height);
+
+            let error_map = full_flip(width, height, &reference, &test);
+            let values = error_map.to_vec();
+            let expected = values.iter().map(|&v| v as f64).sum::<f64>() / values.len() as f64;
+            assert_float_eq!(
+                flip_mean(width, height, &reference, &test, 67.0),
+                expected as f32,
+                abs <= 1e-6
+            );
+        }
+
+        assert_eq!(flip_mean(0, 0, &[], &[], 67.0), 0.0);
+    }
+
+    #[test]
+    fn sampled_mean() {
+        let (width, height) = (96, 64);
+        let (reference, _) = test_pair(width, height);
+        let test: Vec<u8> = (0..width * height * 3)
+            .map(|i| ((i * 7 + i / 300) % 256) as u8)
+            .collect();
+        let exact = flip_mean(width, height, &reference, &test, 67.0);
+
+        // Sampling every pixel compares each one with only its filter support.
+        let full = flip_sampled_mean(width, height, &reference, &test, 67.0, 1 << 20, 1);
+        assert_eq!(full.sample_count, (width * height) as usize);
+        assert_float_eq!(full.mean, exact, abs <= 1e-6);
+        assert_eq!(full.standard_error, 0.0);
+
+        let sampled = flip_sampled_mean(width, height, &reference, &test, 67.0, 500, 7);
+        assert!(sampled.sample_count >= 400 && sampled.sample_count <= 600);
+        assert!(sampled.standard_error > 0.0);
+        assert!(sampled.lower <= exact && exact <= sampled.upper);
+        assert_eq!(
+            flip_sampled_mean(width, height, &reference, &test, 67.0, 500, 7),
+            sampled
+        );
+
+        assert_eq!(
+            flip_sampled_mean(0, 0, &[], &[], 67.0, 100, 1),
+            FlipSampledMean::default()
+        );
+    }
+
+    #[test]
+    fn budgeted_mean() {
+        let (width, height) = (200, 150);
+        let (reference, _) = test_pair(width, height);
+        let test: Vec<u8> = (0..width * height * 3)
+            .map(|i| ((i * 7 + i / 300) % 256) as u8)
+            .collect();
+        let exact = flip_mean(width, height, &reference, &test, 67.0);
+
+        let generous = flip_budgeted_mean(
+            width,
+            height,
+            &reference,
+            &test,
+            67.0,
+            std::time::Duration::from_secs(60),
+            1,
+        );
+        assert_eq!(generous.mean, exact);
+        assert_eq!(generous.standard_error, 0.0);
+        assert_eq!(generous.sample_count, (width * height) as usize);
+
+        // Only the first round fits, which still gives an interval.
+        let tight = flip_budgeted_mean(
+            width,
+            height,
+            &reference,
+            &test,
+            67.0,
+            std::time::Duration::ZERO,
+            1,
+        );
+        assert!(tight.sample_count > 0 && tight.sample_count < (width * height) as usize);
+        assert!(tight.standard_error > 0.0);
+        assert!(tight.lower <= tight.mean && tight.mean <= tight.upper);
+
+        assert_eq!(
+            flip_budgeted_mean(0, 0, &[], &[], 67.0, std::time::Duration::ZERO, 1),
+            FlipSampledMean::default()
+        );
+    }
+
+    #[test]
+    fn guided_matches_full() {
+        let (width, height) = (150, 100);
+        let (reference, _) = test_pair(width, height);
+        let mut test = reference.clone();
+        // Two small changes, one on the image border.
+        for (x, y) in [(40, 30), (41, 30), (149, 99)] {
+            test[((y * width + x) * 3) as usize] ^= 0x40;
+        }
+
+        let full = full_flip(width, height, &reference, &test);
+        let guided = flip_guided(width, height, &reference, &test, 67.0);
+        assert_eq!(guided.error_map.to_vec(), full.to_vec());
+        assert!(guided.evaluated_pixel_count > 0);
+        assert!(guided.evaluated_pixel_count < (width * height) as usize);
+
+        let same = flip_guided(width, height, &reference, &reference, 67.0);
+        assert_eq!(same.evaluated_pixel_count, 0);
+        assert!(same.error_map.to_vec().iter().all(|&v| v == 0.0));
+    }
+
+    #[test]
+    fn components() {
+        let (width, height) = (60, 40);
+        let (reference, _) = test_pair(width, height);
+        let mut test = reference.clone();
+        test[((20 * width + 30) * 3) as usize] ^= 0x40;
+        let run = |reference: &[u8], test: &[u8], components| {
+            flip_with_components(
+                FlipImageRgb8::with_data(width, height, reference),
+                FlipImageRgb8::with_data(width, height, test),
+                67.0,
+                components,
+            )
+            .to_vec()
+        };
+
+        let full = full_flip(width, height, &reference, &test);
+        assert_eq!(run(&reference, &test, FlipComponents::Both), full.to_vec());
+        for components in [FlipComponents::Color, FlipComponents::Feature] {
+            let terms = run(&reference, &test, components);
+            assert!(terms.iter().all(|v| (0.0..=1.0).contains(v)));
+            assert!(terms[(20 * width + 30) as usize] > 0.0);
+            let same = run(&reference, &reference, components);
+            assert!(same.iter().all(|&v| v == 0.0));
+        }
+
+        // Flat images have no edges or points, only a color difference.
+        let red = [255, 0, 0].repeat((width * height) as usize);
+        let blue = [0, 0, 255].repeat((width * height) as usize);
+        assert!(run(&red, &blue, FlipComponents::Feature)
+            .iter()
+            .all(|&v| v < 1e-3));
+        assert!(run(&red, &blue, FlipComponents::Color)
+            .iter()
+            .all(|&v| v > 0.5));
+    }
+
+    #[test]
+    fn components_combine_to_flip() {
+        let (width, height) = (64, 48);
+        let (reference, test) = test_pair(width, height);
+        let run = |components| {
+            flip_with_components(
+                FlipImageRgb8::with_data(width, height, &reference),
+                FlipImageRgb8::with_data(width, height, &test),
+                67.0,
+                components,
+            )
+            .to_vec()
+        };
+
+        // The separate terms are computed apart from FLIP, this catches them drifting.
+        let full = run(FlipComponents::Both);
+        let color = run(FlipComponents::Color);
+        let feature = run(FlipComponents::Feature);
+        let mut max = 0.0f32;
+        for ((full, color), feature) in full.iter().zip(&color).zip(&feature) {
+            max = max.max((color.powf(1.0 - feature) - full).abs());
+        }
+        assert!(max < 1e-4, "{max}");
+    }
+
+    #[test]
+    fn gray_matches_rgb() {
+        let (width, height) = (50, 30);
+        let reference: Vec<u8> = (0..width * height).map(|i| (i * 7 % 256) as u8).collect();
+        let mut test = reference.clone();
+        test[(10 * width + 20) as usize] ^= 0x40;
+        let rgb = |gray: &[u8]| {
+            FlipImageRgb8::with_data(
+                width,
+                height,
+                &gray.iter().flat_map(|&v| [v, v, v]).collect::<Vec<_>>(),
+            )
+        };
+        let to_f32 = |gray: &[u8]| gray.iter().map(|&v| v as f32 / 255.0).collect::<Vec<_>>();
+
+        for components in [
+            FlipComponents::Color,
+            FlipComponents::Feature,
+            FlipComponents::Both,
+        ] {
+            let expected =
+                flip_with_components(rgb(&reference), rgb(&test), 67.0, components).to_vec();
+            let gray = flip_gray_u8(width, height, &reference, &test, 67.0, components);
+            assert_eq!(gray.to_vec(), expected);
+            let gray = flip_gray_f32(
+                width,
+                height,
+                &to_f32(&reference),
+                &to_f32(&test),
+                67.0,
+                components,
+            );
+            assert_eq!(gray.to_vec(), expected);
+        }
+    }
+
+    #[test]
+    fn result_writers() {
+        let statistics = FlipStatistics {
+            mean: 0.25,
+            weighted_median: 0.5,
+            first_weighted_quartile: 0.125,
+            third_weighted_quartile: f32::NAN,
+            min_value: 0.0,
+            max_value: 1.0,
+        };
+        let mut ndjson = FlipNdjsonWriter::with_batch_size(Vec::new(), 2);
+        ndjson.write_statistics("a\"b\\\n", &statistics).unwrap();
+        ndjson.write_pool("empty", &mut FlipPool::new()).unwrap();
+        ndjson.write_statistics("c", &statistics).unwrap();
+        let output = String::from_utf8(ndjson.into_inner().unwrap()).unwrap();
+        let lines: Vec<_> = output.lines().collect();
+        assert_eq!(lines.len(), 3);
+        assert_eq!(
+            lines[0],
+            r#"{"name":"a\"b\\\n","mean":0.25,"weighted_median":0.5,"first_weighted_quartile":0.125,"third_weighted_quartile":null,"min_value":0,"max_value":1}"#
+        );
+
+        let mut columnar = FlipColumnarWriter::with_batch_size(Vec::new(), 2);
+        let mut empty = FlipPool::new();
+        columnar.write_statistics("a", &statistics).unwrap();
+        columnar.write_pool("empty", &mut empty).unwrap();
+        columnar.write_statistics("ü", &statistics).unwrap();
+        let output = columnar.into_inner().unwrap();
+        let records = read_flip_columnar(&output[..]).unwrap();
+        let names: Vec<_> = records.iter().map(|(name, _)| name.as_str()).collect();
+        assert_eq!(names, ["a", "empty", "ü"]);
+        assert_eq!(records[1].1, empty.statistics());
+        assert_eq!(records[2].1.mean, 0.25);
+        assert!(records[2].1.third_weighted_quartile.is_nan());
+        assert!(read_flip_columnar(&output[..output.len() - 1]).is_err());
+    }
+
+    #[test]
+    fn yuv_frames() {
+        let (width, height) = (4, 2);
+        // Limited range mid gray and, in full range, pure red.
+        let mut y4m = b"YUV4MPEG2 W4 H2 F30:1 Ip A1:1 C420jpeg\n".to_vec();
+        for _ in 0..2 {
+            y4m.extend(b"FRAME\n");
+            y4m.extend([126; 8]);
+            y4m.extend([128; 4]);
+        }
+        let frames: Vec<_> = FlipY4mReader::new(std::io::Cursor::new(y4m))
+            .unwrap()
+            .map(|frame| frame.unwrap().to_vec())
+            .collect();
+        assert_eq!(frames, vec![vec![128; 24]; 2]);
+
+        let format = FlipYuvFormat {
+            subsampling: FlipChromaSubsampling::Yuv422,
+            siting: FlipChromaSiting::Left,
+            bit_depth: 10,
+            matrix: FlipYuvMatrix::Bt709,
+            full_range: true,
+        };
+        assert_eq!(format.plane_sizes(width, height), (16, 8));
+        let sample = |value: u16| value.to_le_bytes().repeat(8);
+        let red = FlipImageRgb8::with_yuv(
+            width,
+            height,
+            format,
+            &sample(217),
+            &sample(395),
+            &sample(1023),
+        );
+        for pixel in red.to_vec().chunks(3) {
+            assert!(
+                pixel[0] >= 253 && pixel[1] <= 2 && pixel[2] <= 2,
+                "{pixel:?}"
+            );
+        }
+
+        // Co-sited chroma falls on even pixels, odd ones blend their neighbours.
+        let cosited = FlipYuvFormat {
+            subsampling: FlipChromaSubsampling::Yuv422,
+            siting: FlipChromaSiting::Left,
+            bit_depth: 8,
+            matrix: FlipYuvMatrix::Bt709,
+            full_range: true,
+        };
+        let full = FlipYuvFormat {
+            subsampling: FlipChromaSubsampling::Yuv444,
+            ..cosited
+        };
+        assert_eq!(
+            FlipImageRgb8::with_yuv(4, 1, cosited, &[90; 4], &[100, 140], &[150, 110]).to_vec(),
+            FlipImageRgb8::with_yuv(
+                4,
+                1,
+                full,
+                &[90; 4],
+                &[100, 120, 140, 140],
+                &[150, 130, 110, 110]
+            )
+            .to_vec()
+        );
+
+        let header = std::io::Cursor::new(b"YUV4MPEG2 W4 H2 Cmono\n".to_vec());
+        assert!(FlipY4mReader::new(header).is_err());
+        let header = std::io::Cursor::new("YUV4MPEG2 W4 H2 \u{e9}x\n".as_bytes().to_vec());
+        assert!(FlipY4mReader::new(header).is_err());
+        let header = std::io::Cursor::new(b"YUV4MPEG2 W4 H2 C420mpeg2\n".to_vec());
+        assert_eq!(
+            FlipY4mReader::new(header).unwrap().format().siting,
+            FlipChromaSiting::Left
+        );
+        let truncated = std::io::Cursor::new(b"YUV4MPEG2 W4 H2\nFRAME\n\0".to_vec());
+        let mut reader = FlipY4mReader::new(truncated).unwrap();
+        assert!(reader.next().unwrap().is_err());
+        assert!(reader.next().is_none());
+    }
+
+    #[test]
+    fn stream_matches_full() {
+        let (width, height) = (40, 150);
+        let (reference, test) = test_pair(width, height);
+        let full = full_flip(width, height, &reference, &test);
+
+        let row_len = width as usize * 3;
+        let mut stream = FlipStream::new(width, 67.0);
+        let mut streamed = Vec::new();
+        let mut row = 0;
+        for rows in [1, 0, 30, 2, 50, 7, 60] {
+            let range = row * row_len..(row + rows) * row_len;
+            streamed.extend(stream.push_rows(&reference[range.clone()], &test[range]));
+            row += rows;
+            assert!(streamed.len() <= row * width as usize);
+        }
+        // Rows were emitted before the end of the images.
+        assert!(!streamed.is_empty());
+        streamed.extend(stream.finish());
+        assert_eq!(streamed, full.to_vec());
+
+        assert!(FlipStream::new(0, 67.0).finish().is_empty());
+    }
+
+    #[test]
+    fn exceedance_and_cdf() {
+        let data: Vec<f32> = (0..40 * 25).map(|i| (i % 100) as f32 / 100.0).collect();
+        let image = FlipImageFloat::with_data(40, 25, &data);
+
+        let thresholds = [0.05, 0.1, 0.2, 0.5, 1.0];
+        let exceedance = image.exceedance(&thresholds);
+        for (&threshold, &fraction) in thresholds.iter().zip(&exceedance) {
+            let expected = data.iter().filter(|&&v| v > threshold).count() as f64 / 1000.0;
+            assert_eq!(fraction, expected);
+        }
+
+        let cdf = image.cdf(10);
+        assert_eq!(cdf.len(), 10);
+        for (i, &fraction) in cdf.iter().enumerate() {
+            let edge = (i + 1) as f32 / 10.0;
+            let expected = data.iter().filter(|&&v| v < edge).count() as f64 / 1000.0;
+            assert_eq!(fraction, if i == 9 { 1.0 } else { expected });
+        }
+
+        assert_eq!(
+            image.exceedance_with_cdf(&thresholds, 10),
+            (exceedance, cdf)
+        );
+
+        let empty = FlipImageFloat::new(0, 0);
+        assert_eq!(empty.exceedance(&[0.1]), vec![0.0]);
+        assert_eq!(empty.cdf(2), vec![0.0, 0.0]);
+    }
+
+    #[test]
+    fn task_graph_matches_full() {
+        let (width, height) = (40, 100);
+        let (reference, test) = test_pair(width, height);
+        let full = full_flip(width, height, &reference, &test).to_vec();
+
+        let mut error_map = FlipImageFloat::new(width, height);
+        let graph = FlipTaskGraph::new(&mut error_map, &reference, &test, 67.0, 7);
+        assert_eq!(graph.task_count(), 2 * 15);
+        // Only preparation tasks are ready at first, and nothing runs twice.
+        let first = graph.ready_tasks();
+        assert_eq!(first.len(), 15);
+        assert!(!graph.run_task(1));
+        assert!(!graph.mark_done(first[0]));
+
+        let queue = std::sync::Mutex::new(first);
+        std::thread::scope(|scope| {
+            for _ in 0..4 {
+                scope.spawn(|| {
+                    while !graph.is_done() {
+                        let task = queue.lock().unwrap().pop();
+                        match task {
+                            Some(task) => {
+                                assert!(graph.run_task(task));
+                                assert!(!graph.run_task(task));
+                                assert!(graph.mark_done(task));
+                                queue.lock().unwrap().extend(graph.ready_tasks());
+                            }
+                            None => std::thread::yield_now(),
+                        }
+                    }
+                });
+            }
+        });
+        drop(graph);
+        assert_eq!(error_map.to_vec(), full);
+    }
+
+    #[test]
+    fn cancellable() {
+        // Tall enough for several bands at 67 pixels per degree.
+        let (width, height) = (30, 1000);
+        let (reference, test) = test_pair(width, height);
+        let full = full_flip(width, height, &reference, &test);
+
+        let mut reported = Vec::new();
+        let error_map = flip_cancellable(width, height, &reference, &test, 67.0, None, |p| {
+            reported.push(p);
+            true
+        })
+        .unwrap();
+        assert_eq!(error_map.to_vec(), full.to_vec());
+        assert!(reported.len() > 1);
+        assert!(reported.windows(2).all(|w| w[0] < w[1]));
+        assert_eq!(reported.last(), Some(&1.0));
+
+        // Stopping from the callback.
+        let mut calls = 0;
+        let stopped = flip_cancellable(width, height, &reference, &test, 67.0, None, |_| {
+            calls += 1;
+            false
+        });
+        assert!(stopped.is_none());
+        assert_eq!(calls, 1);
+
+        // Cancelling through a clone of the token, part way.
+        let token = FlipCancelToken::new();
+        let clone = token.clone();
+        let mut calls = 0;
+        let stopped =
+            flip_cancellable(width, height, &reference, &test, 67.0, Some(&token), |_| {
+                calls += 1;
+                clone.cancel();
+                true
+            });
+        assert!(stopped.is_none());
+        assert_eq!(calls, 1);
+        assert!(token.is_cancelled());
+    }
+
+    #[test]
+    fn histogram_bulk_export() {
+        let data: Vec<f32> = (0..50 * 20).map(|i| (i % 101) as f32 / 100.0).collect();
+        let mut pool = FlipPool::with_buckets(64);
+        pool.update_with_image(&FlipImageFloat::with_data(50, 20, &data));
+
+        let histogram = pool.histogram();
+        let buckets = histogram.buckets();
+        assert_eq!(buckets.len(), 64);
+        assert_eq!(buckets.iter().sum::<usize>(), 50 * 20);
+        for (id, &count) in buckets.iter().enumerate() {
+            assert_eq!(count, histogram.bucket_value_count(id));
+        }
+
+        let mut copied = vec![0; 64];
+        histogram.copy_buckets(&mut copied);
+        assert_eq!(copied, buckets);
+
+        let edges = histogram.bucket_edges();
+        assert_eq!(edges.len(), 65);
+        assert_eq!(edges[0], 0.0);
+        assert_eq!(edges[64], 1.0);
+        assert!(edges.windows(2).all(|w| w[0] < w[1]));
+    }
+
+    /// Error map where almost all errors are tiny, with a long tail.
+    fn small_error_map() -> FlipImageFloat {
+        let (width, height) = (256, 128);
+        let data: Vec<f32> = (0..width * height)
+            .map(|i| {
+                let t = ((i * 7919) % (width * height)) as f32 / (width * height) as f32;
+                0.3 * t.powi(8)
+            })
+            .collect();
+        FlipImageFloat::with_data(width, height, &data)
+    }
+
+    #[test]
+    fn bucket_layouts() {
+        let linear = FlipBucketLayout::linear(4);
+        assert_eq!(linear.bucket_edges(), vec![0.0, 0.25, 0.5, 0.75, 1.0]);
+        assert_eq!(linear.bucket_id(-1.0), 0);
+        assert_eq!(linear.bucket_id(0.3), 1);
+        assert_eq!(linear.bucket_id(1.0), 3);
+
+        let log = FlipBucketLayout::logarithmic(4, -14);
+        assert_eq!(log.bucket_count(), 225);
+        assert_eq!(log.bucket_id(0.0), 0);
+        assert_eq!(log.bucket_id(1.0), 224);
+        assert_eq!(log.bucket_id(f32::NAN), 0);
+
+        let adaptive = FlipBucketLayout::adaptive(200, &small_error_map());
+        assert!(adaptive.bucket_count() <= 200);
+        assert_eq!(adaptive.bucket_id(1.0), adaptive.bucket_count() - 1);
+
+        for layout in [linear, log, adaptive] {
+            let edges = layout.bucket_edges();
+            assert_eq!(edges[0], 0.0);
+            assert_eq!(*edges.last().unwrap(), 1.0);
+            assert!(edges.windows(2).all(|w| w[0] < w[1]));
+            for (id, window) in edges.windows(2).enumerate() {
+                assert_eq!(layout.bucket_id(window[0]), id);
+            }
+        }
+    }
+
+    #[test]
+    fn bulk_bucketing_matches_bucket_id() {
+        // Odd length so that the scalar tail of the bulk kernel runs too.
+        let mut data: Vec<f32> = (0..4001).map(|i| (i as f32 / 3000.0).powi(3)).collect();
+        data.extend([0.0, -0.0, -0.5, 1.0, 1.5, f32::NAN, f32::INFINITY, 1e-30]);
+        let image = FlipImageFloat::with_data(data.len() as u32, 1, &data);
+
+        let layouts = [
+            FlipBucketLayout::linear(100),
+            FlipBucketLayout::logarithmic(4, -14),
+            FlipBucketLayout::adaptive(200, &small_error_map()),
+        ];
+        for layout in layouts {
+            let mut expected = vec![0.0; layout.bucket_count()];
+            for &value in &data {
+                expected[layout.bucket_id(value)] += 1.0;
+            }
+            assert_eq!(
+                FlipBucketPool::from_image(&layout, &image).buckets(),
+                expected
+            );
+        }
+
+        let in_range: Vec<f32> = data
+            .iter()
+            .copied()
+            .filter(|v| (0.0..=1.0).contains(v))
+            .collect();
+        let mut bulk = FlipPool::with_buckets(37);
+        let mut single = FlipPool::with_buckets(37);
+        unsafe {
+            bulk.histogram().include_image(&FlipImageFloat::with_data(
+                in_range.len() as u32,
+                1,
+                &in_range,
+            ));
+            for &value in &in_range {
+                single.histogram().include_value(value, 1);
+            }
+        }
+        assert_eq!(bulk.histogram().buckets(), single.histogram().buckets());
+        assert_eq!(
+            bulk.histogram().bucket_id_min(),
+            single.histogram().bucket_id_min()
+        );
+        assert_eq!(
+            bulk.histogram().bucket_id_max(),
+            single.histogram().bucket_id_max()
+        );
+    }
+
+    #[test]
+    fn bucket_pool_tail_percentiles() {
+        let error_map = small_error_map();
+        let mut exact = FlipPool::from_image(&error_map);
+
+        let log = FlipBucketPool::from_image(&FlipBucketLayout::logarithmic(4, -14), &error_map);
+        let adaptive =
+            FlipBucketPool::from_image(&FlipBucketLayout::adaptive(225, &error_map), &error_map);
+        let linear = FlipBucketPool::from_image(&FlipBucketLayout::linear(225), &error_map);
+
+        assert_eq!(log.value_count(), 256.0 * 128.0);
+        assert_eq!(log.buckets().iter().sum::<f64>(), 256.0 * 128.0);
+        assert_float_eq!(log.mean(), exact.mean(), abs <= 1e-6);
+        assert_eq!(log.max_value(), exact.max_value());
+
+        for percentile in [0.5, 0.9, 0.99, 0.999] {
+            let expected = exact.get_percentile(percentile, false);
+            let log_error = (log.get_percentile(percentile, false) - expected).abs() / expected;
+            let adaptive_error =
+                (adaptive.get_percentile(percentile, false) - expected).abs() / expected;
+            assert!(log_error < 0.03, "p{percentile}: {log_error}");
+            assert!(adaptive_error < 0.03, "p{percentile}: {adaptive_error}");
+        }
+
+        // Same amount of linear buckets can't resolve the median at all.
+        let expected = exact.get_percentile(0.5, false);
+        assert!((linear.get_percentile(0.5, false) - expected).abs() / expected > 0.5);
+    }
+
+    #[test]
+    fn windowed_pool_matches_last_frames() {
+        let layout = FlipBucketLayout::logarithmic(4, -14);
+        let frames: Vec<FlipImageFloat> = (0..7u32)
+            .map(|frame| {
+                let data: Vec<f32> = (0..32 * 16)
+                    .map(|i| ((i * (frame + 3)) % 257) as f32 / 256.0 * 0.1 * (frame + 1) as f32)
+                    .collect();
+                FlipImageFloat::with_data(32, 16, &data)
+            })
+            .collect();
+
+        let mut window = FlipWindowedPool::new(&layout, 3);
+        assert_eq!(window.window_size(), 3);
+        for (pushed, frame) in frames.iter().enumerate() {
+            window.push_image(frame);
+            assert_eq!(window.frame_count(), (pushed + 1).min(3));
+
+            let mut expected = FlipBucketPool::new(&layout);
+            for frame in &frames[pushed.saturating_sub(2)..=pushed] {
+                expected.update_with_image(frame);
+            }
+            let pool = window.pool();
+            assert_eq!(pool.buckets(), expected.buckets());
+            assert_eq!(pool.value_count(), expected.value_count());
+            assert_float_eq!(pool.mean(), expected.mean(), abs <= 1e-6);
+            assert_eq!(pool.min_value(), expected.min_value());
+            assert_eq!(pool.max_value(), expected.max_value());
+            assert_eq!(
+                pool.get_percentile(0.95, false),
+                expected.get_percentile(0.95, false)
+            );
+        }
+
+        window.clear();
+        assert_eq!(window.frame_count(), 0);
+        assert_eq!(window.pool().mean(), 0.0);
+    }
+
+    #[test]
+    fn decaying_pool() {
+        let layout = FlipBucketLayout::linear(100);
+        let low = FlipImageFloat::with_data(10, 10, &[0.1; 100]);
+        let high = FlipImageFloat::with_data(10, 10, &[0.3; 100]);
+
+        let mut pool = FlipDecayingPool::new(&layout, 0.5);
+        pool.update_with_image(&low);
+        pool.update_with_image(&high);
+        assert_float_eq!(pool.value_count(), 150.0, abs <= 1e-9);
+        assert_float_eq!(pool.mean(), (0.05 + 0.3) / 1.5, abs <= 1e-6);
+        assert_float_eq!(pool.buckets()[10], 50.0, abs <= 1e-9);
+        assert_float_eq!(pool.buckets()[30], 100.0, abs <= 1e-9);
+        assert_eq!(pool.min_value(), 0.1);
+        assert_eq!(pool.max_value(), 0.3);
+
+        // Long enough to go through the lazy rescaling several times.
+        for _ in 0..1000 {
+            pool.update_with_image(&low);
+        }
+        assert_float_eq!(pool.value_count(), 200.0, abs <= 1e-9);
+        assert_float_eq!(pool.mean(), 0.1, abs <= 1e-6);
+        // The high image has decayed away, so the maximum is back to the low values' bucket.
+        assert_eq!(pool.min_value(), 0.1);
+        assert_float_eq!(pool.max_value(), 0.11, abs <= 1e-6);
+
+        let mut latest = FlipDecayingPool::new(&layout, 0.0);
+        latest.update_with_image(&low);
+        latest.update_with_image(&high);
+        assert_eq!(latest.value_count(), 100.0);
+        assert_float_eq!(latest.mean(), 0.3, abs <= 1e-6);
+
+        latest.clear();
+        assert_eq!(latest.value_count(), 0.0);
+        assert_eq!(latest.mean(), 0.0);
+    }
+
+    #[test]
+    fn labeled_pooling() {
+        let (width, height) = (40, 30);
+        let data: Vec<f32> = (0..width * height)
+            .map(|i| (i % 89) as f32 / 88.0)
+            .collect();
+        // Label 3 is out of range and must be skipped.
+        let labels: Vec<u32> = (0..width * height).map(|i| (i / 7) % 4).collect();
+        let error_map = FlipImageFloat::with_data(width, height, &data);
+        let layout = FlipBucketLayout::logarithmic(4, -14);
+
+        let pools = pool_by_label(&layout, &error_map, &labels, 3);
+        assert_eq!(pools.len(), 3);
+        for (label, pool) in pools.iter().enumerate() {
+            let values: Vec<f32> = data
+                .iter()
+                .zip(&labels)
+                .filter(|&(_, &l)| l == label as u32)
+                .map(|(&v, _)| v)
+                .collect();
+            let expected = FlipBucketPool::from_image(
+                &layout,
+                &FlipImageFloat::with_data(values.len() as u32, 1, &values),
+            );
+            assert_eq!(pool.buckets(), expected.buckets());
+            assert_eq!(pool.max_value(), expected.max_value());
+            assert_float_eq!(pool.mean(), expected.mean(), abs <= 1e-6);
+        }
+
+        #[cfg(feature = "rayon")]
+        for (pool, expected) in par_pool_by_label(&layout, &error_map, &labels, 3)
+            .iter()
+            .zip(&pools)
+        {
+            assert_eq!(pool.buckets(), expected.buckets());
+            assert_float_eq!(pool.mean(), expected.mean(), abs <= 1e-6);
+        }
+    }
+
+    #[test]
+    fn concurrent_pool_matches_serial() {
+        let layout = FlipBucketLayout::logarithmic(4, -14);
+        let tiles: Vec<Vec<f32>> = (0..64u32)
+            .map(|tile| {
+                (0..32 * 32u32)
+                    .map(|i| ((i * 31 + tile * 17) % 1009) as f32 / 1008.0 * 0.5)
+                    .collect()
+            })
+            .collect();
+
+        let mut serial = FlipBucketPool::new(&layout);
+        for tile in &tiles {
+            serial.update_with_image(&FlipImageFloat::with_data(32, 32, tile));
+        }
+
+        let mut concurrent = FlipConcurrentPool::with_shards(&layout, 4);
+        std::thread::scope(|scope| {
+            for chunk in tiles.chunks(8) {
+                let concurrent = &concurrent;
+                scope.spawn(move || {
+                    for tile in chunk {
+                        concurrent.update_with_values(tile);
+                    }
+                });
+            }
+        });
+
+        let snapshot = concurrent.snapshot();
+        assert_eq!(snapshot.buckets(), serial.buckets());
+        assert_eq!(snapshot.value_count(), serial.value_count());
+        assert_float_eq!(snapshot.mean(), serial.mean(), abs <= 1e-6);
+        assert_eq!(snapshot.min_value(), serial.min_value());
+        assert_eq!(snapshot.max_value(), serial.max_value());
+        for percentile in [0.1, 0.5, 0.99] {
+            assert_eq!(
+                snapshot.get_percentile(percentile, false),
+                serial.get_percentile(percentile, false)
+            );
+        }
+
+        concurrent.clear();
+        assert_eq!(concurrent.snapshot().value_count(), 0.0);
+        concurrent.update_with_image(&FlipImageFloat::with_data(32, 32, &tiles[0]));
+        assert_eq!(concurrent.snapshot().value_count(), 1024.0);
+    }
+
+    #[test]
+    fn concurrent_pool_large_sums() {
+        // Sums well beyond 2^32 in total, and beyond 2^31 within a single update.
+        let layout = FlipBucketLayout::linear(16);
+        let values: Vec<Vec<f32>> = (0..8u32)
+            .map(|chunk| {
+                (0..4096u32)
+                    .map(|i| 1.0e6 + ((i * 7 + chunk) % 101) as f32 * 1.0e4)
+                    .collect()
+            })
+            .collect();
+
+        let mut serial = FlipBucketPool::new(&layout);
+        for chunk in &values {
+            serial.update_with_image(&FlipImageFloat::with_data(64, 64, chunk));
+        }
+        let concurrent = FlipConcurrentPool::with_shards(&layout, 3);
+        std::thread::scope(|scope| {
+            for chunk in &values {
+                let concurrent = &concurrent;
+                scope.spawn(move || concurrent.update_with_values(chunk));
+            }
+        });
+
+        let snapshot = concurrent.snapshot();
+        assert_eq!(snapshot.value_count(), serial.value_count());
+        assert_float_eq!(snapshot.mean(), serial.mean(), abs <= 1.0);
+        assert_eq!(snapshot.min_value(), serial.min_value());
+        assert_eq!(snapshot.max_value(), serial.max_value());
+    }
+
     #[test]
     fn zero_size_pool_ops() {
         let mut pool = FlipPool::new();
@@ -623,6 +3708,13 @@ mod tests {
         assert_eq!(pool.get_percentile(0.0, false), 0.0);
         assert_eq!(pool.get_percentile(0.0, true), 0.0);
         assert_eq!(pool.get_weighted_percentile(0.0), 0.0);
+
+        let pool = FlipBucketPool::new(&FlipBucketLayout::logarithmic(4, -14));
+        assert_eq!(pool.min_value(), 0.0);
+        assert_eq!(pool.max_value(), 0.0);
+        assert_eq!(pool.mean(), 0.0);
+        assert_eq!(pool.get_percentile(0.5, false), 0.0);
+        assert_eq!(pool.get_percentile(0.5, true), 0.0);
     }
 
     #[test]